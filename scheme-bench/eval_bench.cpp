@@ -0,0 +1,87 @@
+#include "gc.h"
+#include "jit.h"
+#include "parser.h"
+#include "scheme.h"
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+struct Program {
+  const char *name;
+  const char *setup;
+  const char *run;
+};
+
+const Program kPrograms[] = {
+    {"fib", "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))",
+     "(fib 22)"},
+    {"loop",
+     "(define (loop i acc) (if (= i 0) acc (loop (- i 1) (+ acc 1))))",
+     "(loop 5000 0)"},
+    {"closures",
+     "(define (make-counter) (define n 0) (lambda () (set! n (+ n 1)) n)) "
+     "(define (count c k) (if (= k 0) (c) (and (c) (count c (- k 1)))))",
+     "(count (make-counter) 1000)"},
+};
+
+// Evaluates every form of `source`; returns the printed last result.
+std::string Run(SchemeInterpreter *interpreter, const std::string &source) {
+  std::stringstream in{source};
+  Parser parser((Tokenizer(&in)));
+  std::stringstream out;
+  while (true) {
+    GCManager::GetInstance().SetPhase(Phase::Read);
+    auto obj = parser.Read();
+    if (!obj)
+      break;
+    GCManager::GetInstance().SetPhase(Phase::Eval);
+    out.str("");
+    PrintTo(interpreter->Eval(obj), &out);
+    GCManager::GetInstance().Safepoint();
+  }
+  GCManager::GetInstance().SetPhase(Phase::Read);
+  return out.str();
+}
+
+// Milliseconds per round of `program.run`.
+double Time(EvalMode mode, const Program &program, size_t rounds,
+            std::string *result) {
+  SchemeInterpreter interpreter(mode);
+  Run(&interpreter, program.setup);
+  auto start = std::chrono::steady_clock::now();
+  for (size_t round = 0; round < rounds; ++round)
+    *result = Run(&interpreter, program.run);
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / rounds;
+}
+
+} // namespace
+
+// Runs each program with the tree-walker, with the bytecode VM, and with
+// the VM and the JIT, and reports the time per round and the speedups over
+// the tree-walker.
+//
+//   eval-bench [rounds]
+int main(int argc, char **argv) {
+  size_t rounds = argc > 1 ? std::stoul(argv[1]) : 5;
+  if (!Jit::Available())
+    std::cout << "built without the JIT: jit runs the VM\n";
+  for (const auto &program : kPrograms) {
+    std::string tree_result, vm_result, jit_result;
+    auto tree = Time(EvalMode::TreeWalk, program, rounds, &tree_result);
+    auto vm = Time(EvalMode::Bytecode, program, rounds, &vm_result);
+    auto jit = Time(EvalMode::Native, program, rounds, &jit_result);
+    std::cout << program.name << ": tree-walk " << tree << " ms, bytecode "
+              << vm << " ms (" << tree / vm << "x), jit " << jit << " ms ("
+              << tree / jit << "x)";
+    if (tree_result != vm_result || tree_result != jit_result)
+      std::cout << " (results differ: " << tree_result << ", " << vm_result
+                << ", " << jit_result << ")";
+    std::cout << '\n';
+  }
+  return 0;
+}
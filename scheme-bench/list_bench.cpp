@@ -0,0 +1,54 @@
+#include "create.h"
+#include "gc.h"
+#include "parser.h"
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+// Builds one long list and walks it repeatedly, reporting the heap bytes
+// per cell and the time per cell visited.
+//
+//   list-bench-<layout> [length] [rounds]
+int main(int argc, char **argv) {
+  size_t length = argc > 1 ? std::stoul(argv[1]) : 1000000;
+  size_t rounds = argc > 2 ? std::stoul(argv[2]) : 50;
+
+  auto &gc = GCManager::GetInstance();
+  gc.SetPhase(Phase::Read); // the list is unrooted, so never collect
+  auto heap = gc.GetHeap();
+  auto used_before = heap->UsedBytes();
+  auto committed_before = heap->CommittedBytes();
+
+  Object *list = nullptr;
+  for (size_t ind = 0; ind < length; ++ind)
+    list = Create<Cell>(Create<Number>(static_cast<int64_t>(ind % 1000)), list);
+
+  auto used = heap->UsedBytes() - used_before;
+  auto committed = heap->CommittedBytes() - committed_before;
+
+  // Types are known here, so the walk skips the checked casts and measures
+  // the memory traffic of the cells.
+  int64_t sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t round = 0; round < rounds; ++round)
+    for (auto cell = static_cast<Cell *>(list); cell;
+         cell = static_cast<Cell *>(cell->GetSecond()))
+      sum += static_cast<Number *>(cell->GetFirst())->GetValue();
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+#ifdef SCHEME_COMPRESSED_REFS
+  std::cout << "layout: compressed\n";
+#else
+  std::cout << "layout: pointer\n";
+#endif
+  std::cout << "sizeof(Cell): " << sizeof(Cell) << " bytes\n"
+            << "cells: " << length << ", heap " << used << " bytes used, "
+            << committed << " bytes committed ("
+            << static_cast<double>(used) / length << " bytes/cell)\n"
+            << "traversal: " << elapsed.count() / (length * rounds)
+            << " ns/cell over " << rounds << " rounds (checksum " << sum
+            << ")\n";
+  return 0;
+}
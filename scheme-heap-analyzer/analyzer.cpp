@@ -0,0 +1,218 @@
+#include "heap_snapshot.h"
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+constexpr size_t kNone = SIZE_MAX;
+
+// Snapshot graph over strong edges, with a synthetic root at index 0 that
+// points to every root of the snapshot.
+struct Graph {
+  explicit Graph(const heap_snapshot::Snapshot &snapshot) {
+    std::unordered_map<uint64_t, size_t> index;
+    for (size_t ind = 0; ind < snapshot.nodes.size(); ++ind)
+      index[snapshot.nodes[ind].id] = ind + 1;
+
+    successors.resize(snapshot.nodes.size() + 1);
+    predecessors.resize(successors.size());
+    auto add_edge = [&](size_t from, uint64_t to) {
+      auto it = index.find(to);
+      if (it == index.end())
+        throw std::runtime_error("edge to unknown node " + std::to_string(to));
+      successors[from].push_back(it->second);
+      predecessors[it->second].push_back(from);
+    };
+    for (const auto &root : snapshot.roots)
+      add_edge(0, root.target);
+    for (size_t ind = 0; ind < snapshot.nodes.size(); ++ind)
+      for (const auto &edge : snapshot.nodes[ind].edges)
+        if (!(edge.flags & heap_snapshot::kWeak))
+          add_edge(ind + 1, edge.target);
+  }
+
+  std::vector<std::vector<size_t>> successors;
+  std::vector<std::vector<size_t>> predecessors;
+};
+
+std::vector<size_t> ReversePostorder(const Graph &graph) {
+  std::vector<size_t> order;
+  std::vector<bool> visited(graph.successors.size());
+  std::vector<std::pair<size_t, size_t>> stack = {{0, 0}};
+  visited[0] = true;
+  while (!stack.empty()) {
+    auto &[node, next] = stack.back();
+    if (next < graph.successors[node].size()) {
+      auto succ = graph.successors[node][next++];
+      if (!visited[succ]) {
+        visited[succ] = true;
+        stack.push_back({succ, 0});
+      }
+    } else {
+      order.push_back(node);
+      stack.pop_back();
+    }
+  }
+  std::reverse(order.begin(), order.end());
+  return order;
+}
+
+// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm".
+// Unreachable nodes keep kNone as their dominator.
+std::vector<size_t> Dominators(const Graph &graph,
+                               const std::vector<size_t> &rpo) {
+  std::vector<size_t> position(graph.successors.size(), kNone);
+  for (size_t ind = 0; ind < rpo.size(); ++ind)
+    position[rpo[ind]] = ind;
+
+  std::vector<size_t> idom(graph.successors.size(), kNone);
+  idom[0] = 0;
+  auto intersect = [&](size_t lhs, size_t rhs) {
+    while (lhs != rhs) {
+      while (position[lhs] > position[rhs])
+        lhs = idom[lhs];
+      while (position[rhs] > position[lhs])
+        rhs = idom[rhs];
+    }
+    return lhs;
+  };
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t ind = 1; ind < rpo.size(); ++ind) {
+      auto node = rpo[ind];
+      auto new_idom = kNone;
+      for (auto pred : graph.predecessors[node]) {
+        if (idom[pred] == kNone)
+          continue;
+        new_idom = new_idom == kNone ? pred : intersect(pred, new_idom);
+      }
+      if (idom[node] != new_idom) {
+        idom[node] = new_idom;
+        changed = true;
+      }
+    }
+  }
+  return idom;
+}
+
+// Breadth-first parents, so that following them gives a shortest path from
+// the roots.
+std::vector<size_t> ShortestPathParents(const Graph &graph) {
+  std::vector<size_t> parent(graph.successors.size(), kNone);
+  std::queue<size_t> queue;
+  parent[0] = 0;
+  queue.push(0);
+  while (!queue.empty()) {
+    auto node = queue.front();
+    queue.pop();
+    for (auto succ : graph.successors[node]) {
+      if (parent[succ] == kNone) {
+        parent[succ] = node;
+        queue.push(succ);
+      }
+    }
+  }
+  return parent;
+}
+
+void PrintUsage() {
+  std::cerr << "usage: scheme-heap-analyzer <snapshot> [--top N]" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc != 2 && !(argc == 4 && std::string(argv[2]) == "--top")) {
+    PrintUsage();
+    return 2;
+  }
+  size_t top = argc == 4 ? std::stoul(argv[3]) : 10;
+
+  std::ifstream in(argv[1], std::ios::binary);
+  if (!in) {
+    std::cerr << "cannot open " << argv[1] << std::endl;
+    return 1;
+  }
+
+  heap_snapshot::Snapshot snapshot;
+  try {
+    snapshot = heap_snapshot::ReadSnapshot(&in);
+  } catch (const std::exception &e) {
+    std::cerr << argv[1] << ": " << e.what() << std::endl;
+    return 1;
+  }
+
+  Graph graph(snapshot);
+  auto rpo = ReversePostorder(graph);
+  auto idom = Dominators(graph, rpo);
+  auto parent = ShortestPathParents(graph);
+
+  std::vector<uint64_t> retained(graph.successors.size(), 0);
+  for (size_t ind = 0; ind < snapshot.nodes.size(); ++ind)
+    retained[ind + 1] = snapshot.nodes[ind].size;
+  for (auto it = rpo.rbegin(); it != rpo.rend(); ++it)
+    if (*it != 0)
+      retained[idom[*it]] += retained[*it];
+
+  auto describe = [&](size_t node) {
+    const auto &obj = snapshot.nodes[node - 1];
+    return snapshot.types[obj.type] + "#" + std::to_string(obj.id);
+  };
+  std::unordered_map<uint64_t, const std::string *> root_labels;
+  for (const auto &root : snapshot.roots)
+    root_labels.emplace(root.target, &root.label);
+
+  uint64_t total = 0;
+  std::map<std::string, std::pair<uint64_t, uint64_t>> per_type;
+  for (const auto &node : snapshot.nodes) {
+    total += node.size;
+    auto &[count, size] = per_type[snapshot.types[node.type]];
+    ++count;
+    size += node.size;
+  }
+
+  std::cout << "nodes: " << snapshot.nodes.size() << ", " << total
+            << " bytes; reachable: " << rpo.size() - 1 << " nodes, "
+            << retained[0] << " bytes; roots: " << snapshot.roots.size()
+            << "\n\nby type:\n";
+  for (const auto &[type, stats] : per_type)
+    std::cout << "  " << type << ": " << stats.first << " objects, "
+              << stats.second << " bytes\n";
+
+  std::vector<size_t> candidates(rpo.begin() + 1, rpo.end());
+  std::sort(candidates.begin(), candidates.end(), [&](size_t lhs, size_t rhs) {
+    return retained[lhs] > retained[rhs];
+  });
+  candidates.resize(std::min(candidates.size(), top));
+
+  std::cout << "\nbiggest retainers:\n";
+  for (auto node : candidates) {
+    std::cout << "  " << describe(node) << ": retains " << retained[node]
+              << " bytes (self " << snapshot.nodes[node - 1].size
+              << "), dominated by "
+              << (idom[node] == 0 ? std::string("<roots>")
+                                  : describe(idom[node]))
+              << "\n    path:";
+
+    std::vector<size_t> path;
+    for (auto cur = node; cur != 0; cur = parent[cur])
+      path.push_back(cur);
+    std::reverse(path.begin(), path.end());
+    auto label = root_labels.find(snapshot.nodes[path.front() - 1].id);
+    std::cout << " [" << (label != root_labels.end() ? *label->second : "?")
+              << "]";
+    for (auto cur : path)
+      std::cout << " -> " << describe(cur);
+    std::cout << "\n";
+  }
+  return 0;
+}
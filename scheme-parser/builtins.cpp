@@ -0,0 +1,30 @@
+#include "builtins.h"
+#include "create.h"
+#include "parser.h"
+#include <iterator>
+#include <string>
+#include <string_view>
+
+void InstallBuiltins(Scope *scope) {
+  auto &variables = scope->variables_;
+  variables.reserve(variables.size() + std::size(kBuiltins) +
+                    std::size(kBuiltinForms));
+  for (const auto &builtin : kBuiltins)
+    variables[std::string(builtin.name)] =
+        Create<Function>(std::string(builtin.name),
+                         Function::ApplyMethod(builtin.apply),
+                         builtin.signature);
+  for (const auto &form : kBuiltinForms)
+    variables[std::string(form.name)] =
+        Create<SpecialForm>(std::string(form.name),
+                            SpecialForm::ApplyMethod(form.apply));
+}
+
+Function *CreateBuiltin(std::string_view name) {
+  auto builtin = FindBuiltin(name);
+  if (!builtin)
+    throw RuntimeError("no builtin " + std::string(name));
+  return Create<Function>(std::string(builtin->name),
+                          Function::ApplyMethod(builtin->apply),
+                          builtin->signature);
+}
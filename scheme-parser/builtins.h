@@ -0,0 +1,139 @@
+#pragma once
+
+#include "cek.h"
+#include "gc.h"
+#include "lists.h"
+#include "macro.h"
+#include "memo.h"
+#include "parser.h"
+#include "sort.h"
+#include "vectors.h"
+#include <iterator>
+#include <string_view>
+
+// The builtins every interpreter starts with. Each function is listed with
+// its Signature, which Function::Apply checks before calling it, so the
+// functions themselves do not count or type-check their arguments.
+struct Builtin {
+  std::string_view name;
+  Function::ApplyMethod apply;
+  Signature signature;
+};
+
+struct BuiltinForm {
+  std::string_view name;
+  SpecialForm::ApplyMethod apply;
+};
+
+inline constexpr Builtin kBuiltins[] = {
+    {"+", Plus, Signature::Numbers(0)},
+    {"-", Minus, Signature::Numbers(1)},
+    {"*", Multiply, Signature::Numbers(0)},
+    {"/", Divide, Signature::Numbers(1)},
+    {"null?", CheckNull, Signature::Exactly(1)},
+    {"pair?", CheckPair, Signature::Exactly(1)},
+    {"number?", CheckNumber, Signature::Exactly(1)},
+    {"boolean?", CheckBoolean, Signature::Exactly(1)},
+    {"symbol?", CheckSymbol, Signature::Exactly(1)},
+    {"list?", CheckList, Signature::Exactly(1)},
+    {"string?", CheckString, Signature::Exactly(1)},
+    {"vector?", CheckVector, Signature::Exactly(1)},
+    {"eq?", Eq, Signature::AtLeast(1)},
+    {"integer-equal?", IntegerEqual, Signature::Numbers(0)},
+    {"not", Not, Signature::Exactly(1)},
+    {"=", Equality, Signature::Numbers(0)},
+    {">", More, Signature::Numbers(0)},
+    {"<", Less, Signature::Numbers(0)},
+    {">=", MoreOrEqual, Signature::Numbers(0)},
+    {"<=", LessOrEqual, Signature::Numbers(0)},
+    {"min", Min, Signature::Numbers(1)},
+    {"max", Max, Signature::Numbers(1)},
+    {"abs", Abs, Signature::Numbers(1, 1)},
+    {"cons", Cons, Signature::Exactly(2)},
+    {"car", Car, Signature::Exactly(1)},
+    {"cdr", Cdr, Signature::Exactly(1)},
+    {"set-car!", SetCar, Signature::Exactly(2)},
+    {"set-cdr!", SetCdr, Signature::Exactly(2)},
+    {"list", List, Signature::AtLeast(0)},
+    {"list-ref", ListRef, Signature::Exactly(2)},
+    {"list-tail", ListTail, Signature::Exactly(2)},
+    {"length", Length, Signature::Exactly(1)},
+    {"append", Append, Signature::AtLeast(0)},
+    {"reverse", Reverse, Signature::Exactly(1)},
+    {"list-copy", ListCopy, Signature::Exactly(1)},
+    {"map", Map, Signature::AtLeast(2)},
+    {"for-each", ForEach, Signature::AtLeast(2)},
+    {"filter", Filter, Signature::Exactly(2)},
+    {"fold-left", FoldLeft, Signature::AtLeast(3)},
+    {"fold-right", FoldRight, Signature::AtLeast(3)},
+    {"reduce", Reduce, Signature::Exactly(3)},
+    {"assq", Assq, Signature::Exactly(2)},
+    {"assoc", Assoc, Signature::Exactly(2)},
+    {"member", Member, Signature::Exactly(2)},
+    {"sort", Sort, Signature::Exactly(2)},
+    {"list-sort", ListSort, Signature::Exactly(2)},
+    {"vector-sort!", VectorSort, Signature::Exactly(2)},
+    {"vector", MakeVectorOf, Signature::AtLeast(0)},
+    {"make-vector", MakeVector, Signature::Between(1, 2)},
+    {"vector-ref", VectorRef, Signature::Exactly(2)},
+    {"vector-set!", VectorSet, Signature::Exactly(3)},
+    {"vector-length", VectorLength, Signature::Exactly(1)},
+    {"vector->list", VectorToList, Signature::Exactly(1)},
+    {"list->vector", ListToVector, Signature::Exactly(1)},
+    {"vector-fill!", VectorFill, Signature::Exactly(2)},
+    {"exit", Exit, Signature::Exactly(0)},
+    {"call/cc", CallCC, Signature::Exactly(1)},
+    {"call-with-current-continuation", CallCC, Signature::Exactly(1)},
+    {"memoize", Memoize, Signature::Exactly(1)},
+    {"memo-stats", MemoStats, Signature::Exactly(1)},
+    {"gc-stats", GCStatistics, Signature::Exactly(0)},
+    {"dump-heap", DumpHeap, Signature::Exactly(1)},
+    {"make-weak-box", MakeWeakBox, Signature::Exactly(1)},
+    {"weak-box-value", WeakBoxValue, Signature::Between(1, 2)},
+    {"weak-box?", CheckWeakBox, Signature::Exactly(1)},
+    {"make-weak-hash-table", MakeWeakHashTable, Signature::Exactly(0)},
+    {"hash-table-set!", HashTableSet, Signature::Exactly(3)},
+    {"hash-table-ref", HashTableRef, Signature::Between(2, 3)},
+    {"hash-table-delete!", HashTableDelete, Signature::Exactly(2)},
+    {"hash-table-count", HashTableCount, Signature::Exactly(1)},
+};
+
+inline constexpr BuiltinForm kBuiltinForms[] = {
+    {"if", If},
+    {"quote", Quote},
+    {"and", And},
+    {"or", Or},
+    {"lambda", Lambda},
+    {"define", Define},
+    {"define-memoized", DefineMemoized},
+    {"set!", Set},
+    {"let", Let},
+    {"let*", LetStar},
+    {"letrec", Letrec},
+    {"do", Do},
+    {"define-syntax", DefineSyntax},
+};
+
+// The builtin named `name`, or nullptr; usable in constant expressions.
+constexpr const Builtin *FindBuiltin(std::string_view name) {
+  for (const auto &builtin : kBuiltins)
+    if (builtin.name == name)
+      return &builtin;
+  return nullptr;
+}
+
+constexpr bool ValidBuiltins() {
+  for (auto it = std::begin(kBuiltins); it != std::end(kBuiltins); ++it)
+    if (it->signature.min > it->signature.max || FindBuiltin(it->name) != it)
+      return false;
+  return true;
+}
+
+static_assert(ValidBuiltins(),
+              "a builtin is listed twice or accepts no number of arguments");
+
+// Binds every builtin and builtin special form in `scope`.
+void InstallBuiltins(Scope *scope);
+
+// A new function object for the builtin `name`, which must be listed.
+Function *CreateBuiltin(std::string_view name);
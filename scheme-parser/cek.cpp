@@ -0,0 +1,314 @@
+#include "cek.h"
+#include "create.h"
+#include "gc.h"
+#include "parser.h"
+#include "resolver.h"
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+MachineFrame::MachineFrame(Form *form, std::shared_ptr<Scope> scope,
+                           MachineFrame *next, size_t values)
+    : form_(form), scope_(std::move(scope)), next_(next), values_(values) {}
+
+// The copy is the resumed frame's own: it is not shared.
+MachineFrame::MachineFrame(const MachineFrame &other)
+    : Object(other), form_(other.form_), scope_(other.scope_),
+      next_(other.next_), step_(other.step_), values_(other.values_) {}
+
+void MachineFrame::Reset(Form *form, std::shared_ptr<Scope> scope,
+                         MachineFrame *next, size_t values) {
+  auto before = AllocatedBytes();
+  form_ = form;
+  scope_ = std::move(scope);
+  next_ = next;
+  step_ = 0;
+  values_.assign(values, nullptr);
+  GCManager::GetInstance().AccountResize(before, AllocatedBytes());
+}
+
+Form *MachineFrame::GetForm() const {
+  return static_cast<Form *>(static_cast<Object *>(form_));
+}
+
+MachineFrame *MachineFrame::Next() const {
+  return static_cast<MachineFrame *>(static_cast<Object *>(next_));
+}
+
+void MachineFrame::MarkOwn(GCMark mark) {
+  GetForm()->Mark(mark);
+  for (auto value : values_)
+    if (value)
+      value->Mark(mark);
+  for (auto frame = scope_.get(); frame; frame = frame->parent_.get())
+    for (auto obj : frame->slots_)
+      if (obj)
+        obj->Mark(mark);
+}
+
+void MachineFrame::MarkRelated(GCMark mark) {
+  // Set while a chain is marked: the frames reached meanwhile, from this
+  // chain or from the continuations it holds, are queued there instead of
+  // being marked recursively.
+  static std::vector<MachineFrame *> *pending = nullptr;
+  MarkOwn(mark);
+  if (!next_)
+    return;
+  if (pending) {
+    pending->push_back(Next());
+    return;
+  }
+  std::vector<MachineFrame *> frames{Next()};
+  pending = &frames;
+  while (!frames.empty()) {
+    auto frame = frames.back();
+    frames.pop_back();
+    frame->Mark(mark);
+  }
+  pending = nullptr;
+}
+
+void MachineFrame::VisitReferences(const ReferenceVisitor &visit) {
+  VisitRef(visit, form_, RefKind::Strong);
+  VisitRef(visit, next_, RefKind::Strong);
+  for (auto &value : values_)
+    visit(value, RefKind::Strong);
+  for (auto frame = scope_.get(); frame; frame = frame->parent_.get())
+    for (auto &obj : frame->slots_)
+      visit(obj, RefKind::Strong);
+}
+
+const char *MachineFrame::TypeName() const { return "machine-frame"; }
+
+size_t MachineFrame::AllocatedBytes() const {
+  return sizeof(MachineFrame) + OutOfLineBytes(values_);
+}
+
+Object *MachineFrame::MoveTo(void *where) {
+  auto moved = new (where) MachineFrame(std::move(*this));
+  moved->shared_ = shared_;
+  return moved;
+}
+
+void MachineFrame::PrintTo(std::ostream *) const {
+  throw RuntimeError("can't print machine frame");
+}
+
+void MachineFrame::PrintDebug(std::ostream *out) const {
+  *out << "#<machine-frame " << GetForm()->TypeName() << ">" << std::endl;
+}
+
+Object *MachineFrame::Eval(std::shared_ptr<Scope> &) {
+  throw RuntimeError("can't eval machine frame");
+}
+
+Continuation::Continuation(MachineFrame *frames, uint64_t run)
+    : Function("continuation", nullptr), frames_(frames), run_(run) {}
+
+void Continuation::MarkRelated(GCMark mark) {
+  if (frames_)
+    Frames()->Mark(mark);
+}
+
+void Continuation::VisitReferences(const ReferenceVisitor &visit) {
+  VisitRef(visit, frames_, RefKind::Strong);
+}
+
+const char *Continuation::TypeName() const { return "continuation"; }
+
+size_t Continuation::AllocatedBytes() const {
+  return sizeof(Continuation) + OutOfLineBytes(name);
+}
+
+Object *Continuation::MoveTo(void *where) {
+  return new (where) Continuation(std::move(*this));
+}
+
+MachineFrame *Continuation::Frames() const {
+  return static_cast<MachineFrame *>(static_cast<Object *>(frames_));
+}
+
+Object *Continuation::Apply(std::shared_ptr<Scope> &, ArgSpan args) {
+  CheckArgs(args, Kind::Allow, 1);
+  if (Machine::IsActive(run_))
+    throw Machine::Escape{run_, Frames(), args[0]};
+  Machine machine;
+  return machine.Continue(this, args[0]);
+}
+
+Machine::Machine()
+    : registers_(FrameArena::Current(), kRegisters), outer_(current_),
+      run_(++runs_) {
+  current_ = this;
+}
+
+Machine::~Machine() {
+  Unroot();
+  current_ = outer_;
+}
+
+Object *Machine::Run(LambdaForm *code, const std::shared_ptr<Scope> &scope) {
+  SetScope(scope);
+  code->Enter(this);
+  return Loop();
+}
+
+Object *Machine::Continue(Continuation *continuation, Object *value) {
+  registers_[kStack] = continuation->Frames();
+  Return(value);
+  return Loop();
+}
+
+Object *Machine::CallCC(Object *fn) {
+  try {
+    ApplyCC(fn);
+  } catch (const Escape &escape) {
+    Catch(escape);
+  }
+  return Loop();
+}
+
+void Machine::Eval(Object *form) { registers_[kForm] = form; }
+
+void Machine::Return(Object *value) {
+  registers_[kForm] = nullptr;
+  registers_[kValue] = value;
+}
+
+void Machine::Apply(Object *callee, ArgSpan args) {
+  auto fn = Is<Function>(callee);
+  if (!fn)
+    throw RuntimeError("First element of the list must be a function");
+  registers_[kForm] = nullptr;
+
+  // Within the run that captured it, a continuation replaces the current
+  // one: nothing unwinds.
+  if (auto continuation = Is<Continuation>(fn)) {
+    Function::CheckArgs(args, Kind::Allow, 1);
+    if (continuation->Run() != run_ && IsActive(continuation->Run()))
+      throw Escape{continuation->Run(), continuation->Frames(), args[0]};
+    registers_[kStack] = continuation->Frames();
+    return Return(args[0]);
+  }
+  if (fn->GetApplyMethod() == ::CallCC) {
+    fn->CheckSignature(args);
+    return ApplyCC(args[0]);
+  }
+
+  auto lambda = Is<LambdaFunction>(fn);
+  if (!lambda || !lambda->GetCode()->OnMachine())
+    return Return(fn->Apply(scope_, args));
+  auto code = lambda->GetCode();
+  Function::CheckArgs(args, Kind::Allow, code->ParamCount());
+  // SetScope roots the frame for as long as it is current; afterwards the
+  // continuations and closures that refer to it keep it alive.
+  auto scope = Scope::Create(lambda->GetScope(), code->FrameSize());
+  GCManager::GetInstance().RemoveRoot(scope.get());
+  std::copy(args.begin(), args.end(), scope->slots_.begin());
+  SetScope(std::move(scope));
+  code->Enter(this);
+}
+
+MachineFrame *Machine::Push(Form *form, size_t values) {
+  auto next = static_cast<MachineFrame *>(registers_[kStack]);
+  auto frame = static_cast<MachineFrame *>(registers_[kFree]);
+  if (frame) {
+    registers_[kFree] = nullptr;
+    frame->Reset(form, scope_, next, values);
+  } else {
+    frame = Create<MachineFrame>(form, scope_, next, values);
+  }
+  registers_[kStack] = frame;
+  return frame;
+}
+
+// The frame was popped last, so the frames under it are the current
+// continuation.
+void Machine::Keep(MachineFrame *frame) { registers_[kStack] = frame; }
+
+bool Machine::IsActive(uint64_t run) {
+  for (auto machine = current_; machine; machine = machine->outer_)
+    if (machine->run_ == run)
+      return true;
+  return false;
+}
+
+Object *Machine::Loop() {
+  while (true) {
+    try {
+      return Steps();
+    } catch (const Escape &escape) {
+      Catch(escape);
+    }
+  }
+}
+
+void Machine::Catch(const Escape &escape) {
+  if (escape.run != run_)
+    throw;
+  registers_[kForm] = nullptr;
+  registers_[kStack] = escape.frames;
+  registers_[kValue] = escape.value;
+}
+
+Object *Machine::Steps() {
+  while (true) {
+    // The form stays in its register while it steps, which keeps it alive
+    // even if nothing else refers to it, until it says what comes next.
+    if (auto form = registers_[kForm]) {
+      static_cast<Form *>(form)->Step(this, scope_);
+      continue;
+    }
+    auto frame = static_cast<MachineFrame *>(registers_[kStack]);
+    if (!frame)
+      return registers_[kValue];
+    registers_[kFrame] = frame;
+    registers_[kStack] = frame->Next();
+    if (frame->IsShared()) {
+      frame = Create<MachineFrame>(*frame);
+      registers_[kFrame] = frame;
+    }
+    SetScope(frame->GetScope());
+    frame->GetForm()->Resume(this, frame, registers_[kValue]);
+    // Unless the form kept it, the frame is garbage: no continuation holds
+    // a frame that is not shared.
+    if (registers_[kStack] != frame)
+      registers_[kFree] = frame;
+  }
+}
+
+void Machine::ApplyCC(Object *fn) {
+  registers_[kCallee] = fn;
+  // Frames below a shared one are shared already.
+  for (auto frame = static_cast<MachineFrame *>(registers_[kStack]);
+       frame && !frame->IsShared(); frame = frame->Next())
+    frame->Share();
+  registers_[kArg] = Create<Continuation>(
+      static_cast<MachineFrame *>(registers_[kStack]), run_);
+  Apply(registers_[kCallee], registers_.Span(kArg));
+}
+
+void Machine::SetScope(std::shared_ptr<Scope> scope) {
+  if (scope == scope_)
+    return;
+  Unroot();
+  auto &gc = GCManager::GetInstance();
+  for (auto frame = scope; frame; frame = frame->parent_)
+    if (!gc.IsRoot(frame.get())) {
+      gc.AddRoot(frame);
+      rooted_.push_back(frame);
+    }
+  scope_ = std::move(scope);
+}
+
+void Machine::Unroot() {
+  for (const auto &scope : rooted_)
+    GCManager::GetInstance().RemoveRoot(scope.get());
+  rooted_.clear();
+}
+
+Object *CallCC(ArgSpan args) {
+  Machine machine;
+  return machine.CallCC(args[0]);
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include "frame_arena.h"
+#include "parser.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class Form;
+
+// A stackless evaluator of resolved code (resolver.h), after the CEK
+// machine: the control is the form being evaluated, the environment the
+// Scope it runs in, and the continuation a chain of MachineFrames on the
+// heap, one for each form waiting for the value of another. Calls push no
+// native frames, so recursion is only limited by the heap, and `call/cc`
+// can capture the continuation and return through it any number of times.
+//
+// Lambdas resolved for the machine (Resolver::SetMachine) get a Scope per
+// call, as a continuation may return into a call after it has returned.
+// Builtins and the closures of other modes are called natively, and a
+// machine closure called natively, say by map, runs on a machine of its
+// own: a continuation captured there ends where that call returns.
+class MachineFrame : public Object {
+public:
+  MachineFrame(Form *form, std::shared_ptr<Scope> scope, MachineFrame *next,
+               size_t values);
+  MachineFrame(const MachineFrame &other);
+
+  // Marks the frames below iteratively, however long the chain is.
+  virtual void MarkRelated(GCMark mark = GCMark::Black) override;
+  // Besides the frame's own references, visits the slots of its scope and
+  // of the enclosing ones, which only the frame may keep alive.
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual void PrintTo(std::ostream *out) const override;
+  virtual void PrintDebug(std::ostream *out) const override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &) override;
+
+  // Makes the frame a new one, for a machine that reuses it.
+  void Reset(Form *form, std::shared_ptr<Scope> scope, MachineFrame *next,
+             size_t values);
+
+  Form *GetForm() const;
+  const std::shared_ptr<Scope> &GetScope() const { return scope_; }
+  MachineFrame *Next() const;
+
+  // How far the form got, and the values it has so far; both are the
+  // form's to use.
+  size_t Step() const { return step_; }
+  void SetStep(size_t step) { step_ = step; }
+  std::vector<Object *> &Values() { return values_; }
+
+  // Set once a continuation holds the frame: it is never changed again,
+  // and resuming it works on a copy.
+  bool IsShared() const { return shared_; }
+  void Share() { shared_ = true; }
+
+  // Reused by the machine that made it.
+  virtual bool Freezable() const override { return false; }
+
+private:
+  void MarkOwn(GCMark mark);
+
+  Ref<Object> form_;
+  std::shared_ptr<Scope> scope_;
+  Ref<Object> next_;
+  size_t step_ = 0;
+  std::vector<Object *> values_;
+  bool shared_ = false;
+};
+
+// The continuation of a call of `call/cc`: calling it with a value returns
+// the value from that call again.
+class Continuation : public Function {
+public:
+  Continuation(MachineFrame *frames, uint64_t run);
+
+  virtual void MarkRelated(GCMark mark = GCMark::Black) override;
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  // Called natively: escapes to the machine that captured it while that
+  // one runs, and otherwise runs the rest of the continuation on a new one.
+  Object *Apply(std::shared_ptr<Scope> &scope, ArgSpan args) override;
+
+  MachineFrame *Frames() const;
+  uint64_t Run() const { return run_; }
+
+private:
+  Ref<Object> frames_;
+  uint64_t run_;
+};
+
+// One run of the machine, from a native call to its return. The registers
+// are slots of the FrameArena, so they are roots; the scope the control
+// runs in is kept rooted while it is current.
+class Machine {
+public:
+  Machine();
+  ~Machine();
+
+  Machine(const Machine &) = delete;
+  Machine &operator=(const Machine &) = delete;
+
+  // The value of the body of `code` run in `scope`.
+  Object *Run(LambdaForm *code, const std::shared_ptr<Scope> &scope);
+
+  // The value the rest of `continuation` computes from `value`.
+  Object *Continue(Continuation *continuation, Object *value);
+
+  // The value of `fn` called with the continuation of this run, which
+  // returns from it.
+  Object *CallCC(Object *fn);
+
+  // What forms do in Form::Step and Form::Resume. Each ends with exactly
+  // one of Eval, Return or Apply.
+
+  // Evaluates `form` in the current scope; its value goes to the frame on
+  // top of the continuation.
+  void Eval(Object *form);
+  void Return(Object *value);
+  // Calls `fn` in place of the form: the call's value is the form's.
+  void Apply(Object *fn, ArgSpan args);
+
+  // Pushes a frame of `form` over the current scope, with `values` empty
+  // values; the form is resumed when the next form evaluated returns.
+  MachineFrame *Push(Form *form, size_t values);
+  // Pushes again the frame the form is resumed from.
+  void Keep(MachineFrame *frame);
+
+  // Thrown to a run that is still active but further out, past the native
+  // calls in between, when one of its continuations is called.
+  struct Escape {
+    uint64_t run;
+    MachineFrame *frames;
+    Object *value;
+  };
+
+  // Whether the run `run` has started and not returned yet.
+  static bool IsActive(uint64_t run);
+
+private:
+  // The continuation is the frame in kStack and those below it; kFrame
+  // holds the frame being resumed, and kFree one that nothing refers to
+  // any more, which the next Push reuses. kArg is last, so that it can be
+  // passed as a span.
+  enum Register {
+    kValue,
+    kForm,
+    kStack,
+    kFrame,
+    kFree,
+    kCallee,
+    kArg,
+    kRegisters
+  };
+
+  Object *Loop();
+  Object *Steps();
+  // Goes on with the continuation of an escape to this run; rethrows
+  // others.
+  void Catch(const Escape &escape);
+  // Calls `fn` with the current continuation.
+  void ApplyCC(Object *fn);
+  // Makes `scope` current, rooting what of its chain is not a root yet.
+  void SetScope(std::shared_ptr<Scope> scope);
+  void Unroot();
+
+  static inline Machine *current_ = nullptr;
+  static inline uint64_t runs_ = 0;
+
+  FrameArena::Args registers_;
+  std::shared_ptr<Scope> scope_;
+  std::vector<std::shared_ptr<Scope>> rooted_;
+  Machine *outer_;
+  uint64_t run_;
+};
+
+// `call/cc`. Called natively, from the other modes, it runs the function on
+// a machine of its own: the continuation escapes from the call while it runs,
+// and once it has returned just returns its argument.
+Object *CallCC(ArgSpan args);
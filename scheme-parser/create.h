@@ -5,7 +5,10 @@
 template <DerivedFromObject Derived, ConstTag Tag = void, typename... Args>
   requires Creatable<Derived, Tag>
 Derived *Create(Args &&...args) {
-  if constexpr (std::is_same_v<Tag, void>) {
+  if constexpr (std::is_same_v<Tag, void> &&
+                std::is_same_v<Derived, Number> && sizeof...(Args) == 1) {
+    return GCManager::GetInstance().GetNumber(std::forward<Args>(args)...);
+  } else if constexpr (std::is_same_v<Tag, void>) {
     auto obj = new Derived(std::forward<Args>(args)...);
     GCManager::GetInstance().RegisterObject(obj);
     return obj;
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+class Object;
+
+// LIFO stack of call frames for lambdas that create no closures, so that
+// nothing can refer to their frames once the call returns, and of the
+// arguments of calls. A frame is a run of slots at the top of one
+// contiguous array; slots are addressed relative to the base of the
+// innermost frame. The array is reserved once and never moves, so a view of
+// its slots stays valid while more are pushed. The live part of the array
+// is a GC root.
+class FrameArena {
+public:
+  FrameArena() {
+    slots_.reserve(kMaxSlots);
+    current_ = this;
+  }
+  ~FrameArena() { current_ = nullptr; }
+
+  FrameArena(const FrameArena &) = delete;
+  FrameArena &operator=(const FrameArena &) = delete;
+
+  // Pushes a frame of `size` empty slots for as long as it is in scope.
+  class Frame {
+  public:
+    Frame(FrameArena *arena, size_t size)
+        : arena_(arena), base_(arena->base_), top_(arena->top_) {
+      arena->Clear(top_, top_ + size);
+      arena->base_ = top_;
+      arena->top_ = top_ + size;
+    }
+
+    // Makes the frame `size` empty slots, for a call that runs in place of
+    // the one the frame was pushed for. It must be the innermost frame.
+    void Resize(size_t size) {
+      arena_->Clear(arena_->base_, arena_->base_ + size);
+      arena_->top_ = arena_->base_ + size;
+    }
+
+    ~Frame() {
+      arena_->base_ = base_;
+      arena_->top_ = top_;
+    }
+
+    Frame(const Frame &) = delete;
+    Frame &operator=(const Frame &) = delete;
+
+  private:
+    FrameArena *arena_;
+    size_t base_;
+    size_t top_;
+  };
+
+  // Pushes `size` empty slots for as long as it is in scope, without making
+  // them a frame: Slot() still addresses the innermost one. Calls evaluate
+  // their arguments into these, which keeps them rooted, and pass them on
+  // as a span.
+  class Args {
+  public:
+    Args(FrameArena *arena, size_t size) : arena_(arena), top_(arena->top_) {
+      arena->Clear(top_, top_ + size);
+      arena->top_ = top_ + size;
+    }
+
+    ~Args() { arena_->top_ = top_; }
+
+    Args(const Args &) = delete;
+    Args &operator=(const Args &) = delete;
+
+    Object *&operator[](size_t index) { return arena_->slots_[top_ + index]; }
+
+    // The slots from `first` on.
+    std::span<Object *const> Span(size_t first = 0) const {
+      return {arena_->slots_.data() + top_ + first,
+              arena_->top_ - top_ - first};
+    }
+
+  private:
+    FrameArena *arena_;
+    size_t top_;
+  };
+
+  // Slot `index` of the innermost frame.
+  Object *&Slot(size_t index) { return slots_[base_ + index]; }
+
+  // Slot 0 of the innermost frame, for compiled code.
+  Object **Base() { return slots_.data() + base_; }
+
+  // Slots of all frames pushed.
+  std::span<Object *> Live() { return {slots_.data(), top_}; }
+
+  // The process-wide arena, nullptr before it is created.
+  static FrameArena *Current() { return current_; }
+
+private:
+  // Far more than the native stack allows calls to nest. Only the slots
+  // used are touched, so the rest costs address space alone.
+  static constexpr size_t kMaxSlots = size_t(1) << 21;
+
+  // Empties the slots from `begin` to `end`, lengthening the array if it
+  // is shorter.
+  void Clear(size_t begin, size_t end) {
+    if (end > kMaxSlots)
+      Overflow();
+    if (end > slots_.size())
+      slots_.resize(end);
+    std::fill(slots_.begin() + begin, slots_.begin() + end, nullptr);
+  }
+
+  // Throws RuntimeError (parser.h).
+  [[noreturn]] static void Overflow();
+
+  static inline FrameArena *current_ = nullptr;
+
+  std::vector<Object *> slots_;
+  size_t base_ = 0;
+  size_t top_ = 0;
+};
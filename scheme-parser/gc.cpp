@@ -1,7 +1,491 @@
 #include "gc.h"
+#include "create.h"
+#include "heap_snapshot.h"
+#include "memo.h"
 #include "parser.h"
+#include <bit>
+#include <chrono>
 #include <cstdint>
+#include <fstream>
 #include <iostream>
+#include <map>
 #include <ostream>
 #include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
+
+void FrameArena::Overflow() {
+  throw RuntimeError("Stack overflow: calls nest too deeply");
+}
+
+void PauseHistogram::Record(std::chrono::nanoseconds pause) {
+  auto ns = static_cast<uint64_t>(std::max<int64_t>(pause.count(), 1));
+  ++buckets_[std::bit_width(ns) - 1];
+  ++count_;
+  max_ = std::max(max_, pause);
+}
+
+std::chrono::nanoseconds PauseHistogram::Percentile(double p) const {
+  if (count_ == 0)
+    return std::chrono::nanoseconds(0);
+  auto rank = static_cast<size_t>(p * static_cast<double>(count_ - 1)) + 1;
+  size_t seen = 0;
+  for (size_t ind = 0; ind < buckets_.size(); ++ind) {
+    seen += buckets_[ind];
+    if (seen >= rank) {
+      auto upper = std::chrono::nanoseconds(
+          ind + 1 < 63 ? (int64_t(1) << (ind + 1)) - 1 : INT64_MAX);
+      return std::min(upper, max_);
+    }
+  }
+  return max_;
+}
+
+double GCStats::PromotionRate() const {
+  auto examined = objects_survived + objects_freed;
+  return examined ? static_cast<double>(objects_survived) / examined : 0.0;
+}
+
+Number *GCManager::GetNumber(int64_t value) {
+  if (IsSmallInt(value))
+    return small_ints_[value - kSmallIntMin];
+  auto number = new Number(value);
+  RegisterObject(number);
+  return number;
+}
+
+void GCManager::CollectGarbage() {
+  auto heap_before = currentMemoryUsage_;
+  auto start = std::chrono::steady_clock::now();
+  MarkRoots();
+  ClearWeakReferences();
+  Sweep();
+  currentMemoryUsage_ = 0;
+  for (const auto &var : objects_)
+    currentMemoryUsage_ += var->AllocatedBytes();
+  for (const auto &scope : roots_)
+    currentMemoryUsage_ += scope->AllocatedBytes();
+  threshold_ = std::max(min_heap_, NextThreshold());
+  auto pause = std::chrono::steady_clock::now() - start;
+
+  ++stats_.collections;
+  stats_.pauses.Record(pause);
+  if (heap_.CommittedBytes() >= compaction_min_heap_ &&
+      heap_.Fragmentation() > compaction_threshold_)
+    compaction_pending_ = true;
+  if (log_)
+    LogCollection(heap_before, pause);
+}
+
+void GCManager::Compact() {
+  compaction_pending_ = false;
+  // Memo tables are caches: they are emptied first, so that what only they
+  // keep alive is collected, and refill as their functions are called.
+  for (auto obj : weak_objects_)
+    if (auto memo = Is<MemoizedFunction>(obj); memo)
+      memo->Evict();
+  CollectGarbage();
+
+  std::unordered_map<size_t, std::vector<Object *>> residents;
+  for (auto obj : objects_)
+    if (heap_.Contains(obj) && heap_.SlotSize(heap_.PageIndex(obj)))
+      residents[heap_.PageIndex(obj)].push_back(obj);
+  std::unordered_set<size_t> pinned;
+  auto pin = [&](const auto &objects) {
+    for (auto obj : objects)
+      if (heap_.Contains(obj))
+        pinned.insert(heap_.PageIndex(obj));
+  };
+  pin(return_);
+  pin(frozen_refs_);
+
+  // Per size class, evacuate the sparsest pages for as long as the free
+  // slots of the class (the page's own excluded) can take its objects. A
+  // page holding guarded or unmanaged objects stays where it is.
+  std::map<size_t, std::vector<Heap::PageInfo>> classes;
+  for (const auto &page : heap_.SmallPages())
+    classes[page.slot_size].push_back(page);
+  std::vector<size_t> evacuated;
+  for (auto &[_, pages] : classes) {
+    size_t free = 0;
+    for (const auto &page : pages)
+      free += page.capacity - page.used;
+    std::sort(pages.begin(), pages.end(), [](const auto &lhs, const auto &rhs) {
+      return lhs.used < rhs.used;
+    });
+    for (const auto &page : pages) {
+      auto it = residents.find(page.index);
+      if (pinned.contains(page.index) || it == residents.end() ||
+          it->second.size() != page.used)
+        continue;
+      if (free < page.capacity)
+        break;
+      free -= page.capacity;
+      evacuated.push_back(page.index);
+    }
+  }
+  if (evacuated.empty())
+    return;
+
+  std::unordered_map<Object *, Object *> forward;
+  for (auto index : evacuated)
+    heap_.SetEvacuating(index, true);
+  for (auto index : evacuated)
+    for (auto obj : residents[index])
+      forward[obj] = obj->MoveTo(heap_.Allocate(heap_.SlotSize(index)));
+
+  Relocate(forward);
+  for (auto index : evacuated)
+    heap_.SetEvacuating(index, false);
+
+  ++stats_.compactions;
+  stats_.objects_moved += forward.size();
+}
+
+void GCManager::MarkEphemerons() {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto obj : weak_objects_) {
+      auto table = Is<WeakTable>(obj);
+      if (!table || !table->isMarked())
+        continue;
+      for (auto [key, value] : table->GetEntries()) {
+        if (value && !value->isMarked() && IsLive(key)) {
+          value->Mark();
+          changed = true;
+        }
+      }
+    }
+  }
+}
+
+void GCManager::ClearWeakReferences() {
+  for (auto obj : weak_objects_) {
+    if (auto box = Is<WeakBox>(obj); box) {
+      if (!box->IsBroken() && !IsLive(box->GetValue()))
+        box->Break();
+    } else if (auto table = Is<WeakTable>(obj); table) {
+      auto before = table->AllocatedBytes();
+      std::erase_if(table->GetEntries(),
+                    [this](const auto &entry) { return !IsLive(entry.first); });
+      AccountResize(before, table->AllocatedBytes());
+    }
+  }
+}
+
+void GCManager::LogCollection(size_t heap_before,
+                              std::chrono::nanoseconds pause) {
+  auto now = std::chrono::steady_clock::now();
+  if (stats_.collections > 1 && now - last_log_ < log_interval_) {
+    ++suppressed_logs_;
+    return;
+  }
+  *log_ << "[gc] collection " << stats_.collections << ": heap "
+        << heap_before << " -> " << currentMemoryUsage_ << " bytes in "
+        << pause.count() << "ns";
+  if (suppressed_logs_)
+    *log_ << " (" << suppressed_logs_ << " collections not logged)";
+  *log_ << '\n';
+  last_log_ = now;
+  suppressed_logs_ = 0;
+}
+
+void GCManager::Freeze() {
+  CollectGarbage();
+
+  std::vector<Object *> order;
+  std::unordered_set<Object *> seen;
+  auto consider = [&](Object *obj) {
+    if (!obj || !heap_.Contains(obj) || heap_.IsFrozen(obj) ||
+        return_.contains(obj) || frozen_refs_.contains(obj) ||
+        !obj->Freezable() || !seen.insert(obj).second)
+      return;
+    order.push_back(obj);
+  };
+  for (const auto &scope : roots_) {
+    for (const auto &[_, obj] : scope->variables_)
+      consider(obj);
+    for (auto obj : scope->slots_)
+      consider(obj);
+  }
+  for (auto obj : arena_.Live())
+    consider(obj);
+  for (auto number : small_ints_)
+    consider(number);
+  consider(bools_.first);
+  consider(bools_.second);
+  for (auto [_, sym] : constant_symbols_)
+    consider(sym);
+  for (size_t ind = 0; ind < order.size(); ++ind)
+    order[ind]->VisitReferences([&](Object *&ref, Object::RefKind kind) {
+      if (kind == Object::RefKind::Strong)
+        consider(ref);
+    });
+
+  std::unordered_map<Object *, Object *> forward;
+  std::vector<Object *> moved;
+  for (auto obj : order) {
+    if (objects_.erase(obj))
+      currentMemoryUsage_ -=
+          std::min(currentMemoryUsage_, obj->AllocatedBytes());
+    auto copy = obj->MoveTo(heap_.AllocateFrozen(heap_.AllocationSize(obj)));
+    forward[obj] = copy;
+    moved.push_back(copy);
+  }
+  Relocate(forward, moved);
+
+  // Frozen closures are never traced, so the frames they were created in,
+  // which stay mutable, become roots.
+  for (auto obj : moved) {
+    if (auto fn = Is<LambdaFunction>(obj); fn) {
+      for (auto frame = fn->GetScope(); frame; frame = frame->parent_)
+        if (!roots_.contains(frame.get()))
+          AddRoot(frame);
+      continue;
+    }
+    obj->VisitReferences([this](Object *&ref, Object::RefKind) {
+      if (ref && !heap_.IsFrozen(ref))
+        frozen_refs_.insert(ref);
+    });
+  }
+  frozen_.insert(frozen_.end(), moved.begin(), moved.end());
+  heap_.Seal();
+}
+
+void GCManager::Relocate(const std::unordered_map<Object *, Object *> &forward,
+                         const std::vector<Object *> &moved) {
+  auto forwarded = [&forward](Object *obj) {
+    auto it = forward.find(obj);
+    return it == forward.end() ? obj : it->second;
+  };
+  // Only changed references are written, as frozen objects are visited too
+  // and their own fields never point to movable objects.
+  auto rewrite = [&forwarded](Object *&ref, Object::RefKind) {
+    if (auto to = forwarded(ref); to != ref)
+      ref = to;
+  };
+  auto remap = [&forwarded](auto *set) {
+    std::remove_pointer_t<decltype(set)> res;
+    res.reserve(set->size());
+    for (auto obj : *set)
+      res.insert(forwarded(obj));
+    *set = std::move(res);
+  };
+  remap(&objects_);
+  remap(&return_);
+  remap(&weak_objects_);
+  for (auto obj : objects_)
+    obj->VisitReferences(rewrite);
+  for (auto obj : moved)
+    obj->VisitReferences(rewrite);
+  // Frozen code keeps its bytecode caches out of line, where they can
+  // still point to objects that move.
+  for (auto obj : frozen_)
+    obj->VisitReferences(rewrite);
+  for (const auto &scope : roots_) {
+    for (auto &[_, obj] : scope->variables_)
+      obj = forwarded(obj);
+    for (auto &obj : scope->slots_)
+      obj = forwarded(obj);
+  }
+  for (auto &obj : arena_.Live())
+    obj = forwarded(obj);
+  for (auto &number : small_ints_)
+    number = static_cast<Number *>(forwarded(number));
+  bools_ = {static_cast<Boolean *>(forwarded(bools_.first)),
+            static_cast<Boolean *>(forwarded(bools_.second))};
+  for (auto &[_, sym] : constant_symbols_)
+    sym = static_cast<Symbol *>(forwarded(sym));
+
+  for (auto [old, _] : forward) {
+    old->~Object();
+    heap_.Free(old);
+  }
+}
+
+GCStats GCManager::GetStats() const {
+  GCStats stats = stats_;
+  stats.heap_size = currentMemoryUsage_;
+  stats.pages_released = heap_.ReleasedPages();
+  stats.committed_bytes = heap_.CommittedBytes();
+  stats.fragmentation = heap_.Fragmentation();
+  stats.frozen_bytes = heap_.FrozenBytes();
+  for (const auto &obj : objects_) {
+    ++stats.live_objects[obj->TypeName()];
+    stats.live_bytes[obj->TypeName()] += obj->AllocatedBytes();
+  }
+  for (const auto &scope : roots_) {
+    ++stats.live_objects["scope"];
+    stats.live_bytes["scope"] += scope->AllocatedBytes();
+  }
+  return stats;
+}
+
+size_t GCManager::DumpHeap(std::ostream *out) {
+  std::unordered_map<Object *, uint64_t> ids;
+  std::vector<Object *> nodes;
+  auto id_of = [&](Object *obj) {
+    auto [it, inserted] = ids.emplace(obj, nodes.size() + 1);
+    if (inserted)
+      nodes.push_back(obj);
+    return it->second;
+  };
+
+  std::vector<heap_snapshot::Root> roots;
+  for (const auto &scope : roots_) {
+    for (const auto &[name, obj] : scope->variables_)
+      if (obj)
+        roots.push_back({id_of(obj), (scope->parent_ ? "local " : "global ") +
+                                         name});
+    for (size_t ind = 0; ind < scope->slots_.size(); ++ind)
+      if (scope->slots_[ind])
+        roots.push_back(
+            {id_of(scope->slots_[ind]), "frame slot " + std::to_string(ind)});
+  }
+  auto arena = arena_.Live();
+  for (size_t ind = 0; ind < arena.size(); ++ind)
+    if (arena[ind])
+      roots.push_back({id_of(arena[ind]), "arena slot " + std::to_string(ind)});
+  for (auto obj : return_)
+    roots.push_back({id_of(obj), "<guarded>"});
+  for (auto obj : objects_)
+    id_of(obj);
+
+  // Edges may discover constants that are not managed, so `nodes` grows
+  // while it is being walked.
+  std::vector<std::vector<heap_snapshot::Edge>> edges;
+  for (size_t ind = 0; ind < nodes.size(); ++ind) {
+    std::vector<heap_snapshot::Edge> node_edges;
+    nodes[ind]->VisitReferences([&](Object *&ref, Object::RefKind kind) {
+      if (ref)
+        node_edges.push_back(
+            {id_of(ref), static_cast<uint8_t>(kind == Object::RefKind::Weak
+                                                  ? heap_snapshot::kWeak
+                                                  : 0)});
+    });
+    edges.push_back(std::move(node_edges));
+  }
+
+  std::vector<std::string> types;
+  std::unordered_map<std::string_view, uint32_t> type_index;
+  for (auto obj : nodes)
+    if (type_index.emplace(obj->TypeName(), types.size()).second)
+      types.emplace_back(obj->TypeName());
+
+  out->write(heap_snapshot::kMagic, sizeof(heap_snapshot::kMagic));
+  heap_snapshot::Write<uint32_t>(out, heap_snapshot::kVersion);
+  heap_snapshot::Write<uint32_t>(out, types.size());
+  for (const auto &type : types)
+    heap_snapshot::WriteString(out, type);
+
+  heap_snapshot::Write<uint64_t>(out, nodes.size());
+  for (size_t ind = 0; ind < nodes.size(); ++ind) {
+    auto obj = nodes[ind];
+    uint8_t flags = 0;
+    if (objects_.contains(obj))
+      flags |= heap_snapshot::kManaged;
+    if (return_.contains(obj))
+      flags |= heap_snapshot::kGuarded;
+    heap_snapshot::Write<uint64_t>(out, ind + 1);
+    heap_snapshot::Write<uint32_t>(out, type_index[obj->TypeName()]);
+    heap_snapshot::Write<uint64_t>(out, obj->AllocatedBytes());
+    heap_snapshot::Write<uint8_t>(out, flags);
+    heap_snapshot::Write<uint32_t>(out, edges[ind].size());
+    for (const auto &edge : edges[ind]) {
+      heap_snapshot::Write<uint64_t>(out, edge.target);
+      heap_snapshot::Write<uint8_t>(out, edge.flags);
+    }
+  }
+
+  heap_snapshot::Write<uint64_t>(out, roots.size());
+  for (const auto &root : roots) {
+    heap_snapshot::Write<uint64_t>(out, root.target);
+    heap_snapshot::WriteString(out, root.label);
+  }
+  return nodes.size();
+}
+
+namespace {
+
+// Prepends (name . value) to the association list rooted in `lock`.
+Object *PushStat(GCManager::SafeLock *lock, Object *alist, const char *name,
+                 Object *value) {
+  if (value)
+    lock->Lock(value);
+  auto key = Create<Symbol>(name);
+  lock->Lock(key);
+  auto entry = Create<Cell>(key, value);
+  lock->Lock(entry);
+  auto res = Create<Cell>(entry, alist);
+  lock->Lock(res);
+  return res;
+}
+
+Object *PushStat(GCManager::SafeLock *lock, Object *alist, const char *name,
+                 int64_t value) {
+  auto number = Create<Number>(value);
+  return PushStat(lock, alist, name, number);
+}
+
+} // namespace
+
+Object *GCStatistics(ArgSpan) {
+  auto stats = GCManager::GetInstance().GetStats();
+  GCManager::SafeLock lock;
+  Object *live = nullptr;
+  for (auto it = stats.live_objects.rbegin(); it != stats.live_objects.rend();
+       ++it)
+    live = PushStat(&lock, live, it->first.c_str(),
+                    static_cast<int64_t>(it->second));
+  Object *live_bytes = nullptr;
+  for (auto it = stats.live_bytes.rbegin(); it != stats.live_bytes.rend(); ++it)
+    live_bytes = PushStat(&lock, live_bytes, it->first.c_str(),
+                          static_cast<int64_t>(it->second));
+
+  Object *res = PushStat(&lock, nullptr, "live-bytes", live_bytes);
+  res = PushStat(&lock, res, "live-objects", live);
+  res = PushStat(&lock, res, "promotion-rate-percent",
+                 static_cast<int64_t>(stats.PromotionRate() * 100));
+  res = PushStat(&lock, res, "pause-max-ns", stats.pauses.Max().count());
+  res = PushStat(&lock, res, "pause-p99-ns",
+                 stats.pauses.Percentile(0.99).count());
+  res = PushStat(&lock, res, "pause-p50-ns",
+                 stats.pauses.Percentile(0.50).count());
+  res = PushStat(&lock, res, "frozen-bytes",
+                 static_cast<int64_t>(stats.frozen_bytes));
+  res = PushStat(&lock, res, "fragmentation-percent",
+                 static_cast<int64_t>(stats.fragmentation * 100));
+  res = PushStat(&lock, res, "committed-bytes",
+                 static_cast<int64_t>(stats.committed_bytes));
+  res = PushStat(&lock, res, "pages-released",
+                 static_cast<int64_t>(stats.pages_released));
+  res = PushStat(&lock, res, "objects-moved",
+                 static_cast<int64_t>(stats.objects_moved));
+  res = PushStat(&lock, res, "compactions",
+                 static_cast<int64_t>(stats.compactions));
+  res = PushStat(&lock, res, "heap-size",
+                 static_cast<int64_t>(stats.heap_size));
+  res = PushStat(&lock, res, "bytes-freed",
+                 static_cast<int64_t>(stats.bytes_freed));
+  res = PushStat(&lock, res, "bytes-allocated",
+                 static_cast<int64_t>(stats.bytes_allocated));
+  return PushStat(&lock, res, "collections",
+                  static_cast<int64_t>(stats.collections));
+}
+
+Object *DumpHeap(ArgSpan args) {
+  if (!IsString(args[0]))
+    throw RuntimeError("dump-heap: argument must be a file name string");
+  std::ofstream out(AsString(args[0])->GetValue(), std::ios::binary);
+  if (!out)
+    throw RuntimeError("dump-heap: cannot open " +
+                       AsString(args[0])->GetValue());
+  auto nodes = GCManager::GetInstance().DumpHeap(&out);
+  out.close();
+  if (!out)
+    throw RuntimeError("dump-heap: failed to write " +
+                       AsString(args[0])->GetValue());
+  return Create<Number>(static_cast<int64_t>(nodes));
+}
@@ -1,9 +1,14 @@
 #pragma once
 
+#include "frame_arena.h"
+#include "heap.h"
 #include "parser.h"
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <cstdint>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <ostream>
 #include <string>
@@ -15,6 +20,47 @@
 
 enum class Phase { Read, Eval };
 
+// Log2-bucketed histogram of collection pauses: bucket i counts pauses in
+// [2^i, 2^(i+1)) nanoseconds, so percentiles are reported as bucket upper
+// bounds clamped to the exact maximum.
+class PauseHistogram {
+public:
+  void Record(std::chrono::nanoseconds pause);
+
+  std::chrono::nanoseconds Percentile(double p) const;
+
+  std::chrono::nanoseconds Max() const { return max_; }
+
+  size_t Count() const { return count_; }
+
+private:
+  std::array<size_t, 64> buckets_{};
+  size_t count_ = 0;
+  std::chrono::nanoseconds max_{0};
+};
+
+struct GCStats {
+  size_t collections = 0;
+  size_t bytes_allocated = 0;
+  size_t bytes_freed = 0;
+  size_t objects_allocated = 0;
+  size_t objects_freed = 0;
+  size_t objects_survived = 0;
+  size_t heap_size = 0;
+  size_t compactions = 0;
+  size_t objects_moved = 0;
+  size_t pages_released = 0;
+  size_t committed_bytes = 0;
+  double fragmentation = 0.0;
+  size_t frozen_bytes = 0;
+  PauseHistogram pauses;
+  std::map<std::string, size_t> live_objects;
+  std::map<std::string, size_t> live_bytes;
+
+  // Fraction of the objects examined by the sweeps that survived them.
+  double PromotionRate() const;
+};
+
 class GCManager {
 public:
   static GCManager &GetInstance() {
@@ -22,7 +68,11 @@ public:
     return instance;
   }
 
-  std::unordered_set<Object *> *Guarded() { return &return_; }
+  std::unordered_multiset<Object *> *Guarded() { return &return_; }
+
+  Heap *GetHeap() { return &heap_; }
+
+  FrameArena *GetFrameArena() { return &arena_; }
 
   class SafeLock {
   public:
@@ -33,13 +83,19 @@ public:
     }
 
     void Lock(Object *obj) {
+      if (!obj)
+        return;
       GCManager::GetInstance().Guarded()->insert(obj);
       current_.push_back(obj);
     }
 
+    // Only this lock's entries are dropped: the same object may also be
+    // guarded further up the stack, for instance by an enclosing call.
     ~SafeLock() {
+      auto guarded = GCManager::GetInstance().Guarded();
       for (auto obj : current_)
-        GCManager::GetInstance().Guarded()->erase(obj);
+        if (auto it = guarded->find(obj); it != guarded->end())
+          guarded->erase(it);
     }
 
   private:
@@ -47,27 +103,48 @@ public:
   };
 
   const Boolean *GetBool(bool kind) {
-    return kind ? &bools_.first : &bools_.second;
+    return kind ? bools_.first : bools_.second;
   }
 
   void RegisterObject(Object *obj) {
     objects_.insert(obj);
-    currentMemoryUsage_ += sizeof(*obj);
-    if (currentMemoryUsage_ >= threshold_ && phase_ != Phase::Read) {
+    auto bytes = obj->AllocatedBytes();
+    currentMemoryUsage_ += bytes;
+    stats_.bytes_allocated += bytes;
+    ++stats_.objects_allocated;
+    if (phase_ == Phase::Read)
+      return;
+    if (currentMemoryUsage_ >= threshold_) {
       obj->Mark();
-      std::cout << "Memory usage is " << currentMemoryUsage_
-                << ". Collecting garbage!" << std::endl;
-      auto memus = currentMemoryUsage_;
       CollectGarbage();
-      obj->Unmark();
-      std::cout << "Garbage collected! Freed " << memus - currentMemoryUsage_
-                << " bytes of memory. New heap size is " << currentMemoryUsage_
-                << std::endl;
     }
+    // Marking does not trace what a marked object refers to, so an object
+    // left marked until the next collection would not keep its references
+    // alive.
+    obj->Unmark();
   }
 
-  std::unordered_map<int64_t, Number *> *GetNumReg() {
-    return &constant_numbers_;
+  static constexpr int64_t kSmallIntMin = -1024;
+  static constexpr int64_t kSmallIntMax = 1023;
+
+  static bool IsSmallInt(int64_t value) {
+    return kSmallIntMin <= value && value <= kSmallIntMax;
+  }
+
+  // Numbers in [kSmallIntMin, kSmallIntMax] come from a preallocated table
+  // and cost no allocation; others are ordinary collected objects.
+  Number *GetNumber(int64_t value);
+
+  // Records that a managed object or scope changed size from `before` to
+  // `after` bytes.
+  void AccountResize(size_t before, size_t after) {
+    if (after > before)
+      stats_.bytes_allocated += after - before;
+    else
+      stats_.bytes_freed += before - after;
+    currentMemoryUsage_ = currentMemoryUsage_ + after >= before
+                              ? currentMemoryUsage_ + after - before
+                              : 0;
   }
 
   std::unordered_map<std::string_view, Symbol *> *GetSymReg() {
@@ -75,25 +152,37 @@ public:
   }
 
   template <NumberOrSymbol T> T *GetConstant(T::ValueType val) {
-    auto registry = T::GetConstantRegistry();
-    auto it = registry->find(val);
-    if (it == registry->end())
-      it = registry->emplace(val, new T(val)).first;
-    return it->second;
+    if constexpr (std::is_same_v<T, Number>) {
+      return GetNumber(val);
+    } else {
+      auto registry = T::GetConstantRegistry();
+      auto it = registry->find(val);
+      if (it == registry->end())
+        it = registry->emplace(val, new T(val)).first;
+      return it->second;
+    }
   }
 
   /*
 void  UnregisterObject(Object *obj) {
   objects_.erase(obj);
-  currentMemoryUsage_ -= sizeof(*obj);
+  currentMemoryUsage_ -= obj->AllocatedBytes();
 }
 */
 
   void AddRoot(const std::shared_ptr<Scope> &scope) {
     roots_.insert(scope.get());
+    AccountResize(0, scope->AllocatedBytes());
+  }
+
+  void RemoveRoot(Scope *scope) {
+    if (roots_.erase(scope))
+      AccountResize(scope->AllocatedBytes(), 0);
   }
 
-  void RemoveRoot(Scope *scope) { roots_.erase(scope); }
+  bool IsRoot(const Scope *scope) const {
+    return roots_.contains(const_cast<Scope *>(scope));
+  }
   /*
   void  Sweep() {
     for (auto it = objects_.begin(); it != objects_.end();) {
@@ -110,15 +199,15 @@ void  UnregisterObject(Object *obj) {
 
   void Sweep() {
     // auto temp = std::move(objects_);
-    auto cleaner = [](auto const &obj) {
+    auto cleaner = [this](auto const &obj) {
       if (!obj->isMarked()) {
-        if (auto fn = Is<LambdaFunction>(obj); fn) {
-          fn->Release();
-        }
+        stats_.bytes_freed += obj->AllocatedBytes();
+        ++stats_.objects_freed;
         delete obj;
         return true;
       } else {
         obj->Unmark();
+        ++stats_.objects_survived;
         return false;
       }
     };
@@ -127,22 +216,65 @@ void  UnregisterObject(Object *obj) {
   }
 
   void MarkRoots() {
-    for (const auto &scopes : roots_)
+    for (const auto &scopes : roots_) {
       for (auto [_, obj] : scopes->variables_)
+        if (obj)
+          obj->Mark();
+      for (auto obj : scopes->slots_)
+        if (obj)
+          obj->Mark();
+    }
+    for (auto obj : arena_.Live())
+      if (obj)
         obj->Mark();
 
     for (auto ret : return_)
       ret->Mark();
+
+    for (auto obj : frozen_refs_)
+      obj->Mark();
+
+    MarkEphemerons();
   }
 
-  void CollectGarbage() {
-    MarkRoots();
-    Sweep();
-    currentMemoryUsage_ = 0;
-    for (const auto &var : objects_)
-      currentMemoryUsage_ += sizeof(*var);
+  void RegisterWeak(Object *obj) { weak_objects_.insert(obj); }
+
+  void UnregisterWeak(Object *obj) { weak_objects_.erase(obj); }
+
+  // An object survives the current collection if it is marked or is not
+  // managed by the collector at all (constants, booleans).
+  bool IsLive(Object *obj) const {
+    return !obj || obj->isMarked() || !objects_.contains(obj);
+  }
+
+  void CollectGarbage();
+
+  // Marks the values of reachable weak tables whose keys are reachable,
+  // until no new object gets marked.
+  void MarkEphemerons();
+
+  // Breaks weak boxes and drops weak table entries that refer to objects
+  // about to be swept. Runs between marking and sweeping.
+  void ClearWeakReferences();
+
+  // Snapshot of the collector counters, with the live objects of the current
+  // heap broken down by Object::TypeName().
+  GCStats GetStats() const;
+
+  // Collection log lines go to `out` (nullptr disables logging, the default),
+  // at most one line per `interval`; suppressed collections are counted in
+  // the next line written.
+  void SetLog(std::ostream *out,
+              std::chrono::milliseconds interval = std::chrono::seconds(1)) {
+    log_ = out;
+    log_interval_ = interval;
   }
 
+  // Writes a binary snapshot of the heap (see heap_snapshot.h): every managed
+  // object and every constant reachable from one, with its outgoing edges,
+  // plus the root set. Returns the number of nodes written.
+  size_t DumpHeap(std::ostream *out);
+
   void PrintObjectsDebug(std::ostream *out) const {
     for (const auto &obj : objects_)
       obj->PrintDebug(out);
@@ -160,31 +292,121 @@ void  UnregisterObject(Object *obj) {
 
   void SetPhase(Phase phase) { phase_ = phase; }
 
+  // Runs a full collection, then evacuates the sparsest unpinned heap pages
+  // into free slots of denser pages of the same size class and rewrites
+  // every reference to the moved objects. Pages left empty are returned to
+  // the OS. Only the collector's own references are updated, so this must
+  // not run while C++ code holds unguarded object pointers; see Safepoint.
+  void Compact();
+
+  // Called between top-level forms. Compacts if a collection found the heap
+  // fragmented since the last compaction.
+  void Safepoint() {
+    if (compaction_pending_)
+      Compact();
+  }
+
+  // Moves every object reachable from the roots, and the constants, to
+  // frozen pages and makes them read-only: the builtins, the interned
+  // symbols and whatever code was loaded so far. Frozen objects are never
+  // collected, moved or written again, so processes forked afterwards share
+  // their pages. Objects that are not Freezable stay mutable, and so do
+  // guarded objects. Like Compact, runs at a safepoint only.
+  void Freeze();
+
+  // A compaction is requested once the committed heap is at least
+  // `min_heap_bytes` and more than `fragmentation` of its small-object pages
+  // is unused.
+  void SetCompactionPolicy(double fragmentation, size_t min_heap_bytes) {
+    compaction_threshold_ = fragmentation;
+    compaction_min_heap_ = min_heap_bytes;
+  }
+
+  // An allocation collects once the heap is `growth` times what the last
+  // collection left, and at least `min_heap_bytes`, so that the work of
+  // collecting stays proportional to the work of allocating however much
+  // is live, a deep continuation say. A growth of 0 and no minimum collect
+  // on every allocation, which shows a missing root at once.
+  static constexpr double kDefaultHeapGrowth = 2.0;
+  static constexpr size_t kDefaultMinHeap = size_t(1) << 20;
+  void SetCollectionPolicy(double growth, size_t min_heap_bytes) {
+    heap_growth_ = growth;
+    min_heap_ = min_heap_bytes;
+    threshold_ = std::max(min_heap_, NextThreshold());
+  }
+
 private:
+  void LogCollection(size_t heap_before, std::chrono::nanoseconds pause);
+
+  size_t NextThreshold() const {
+    return static_cast<size_t>(static_cast<double>(currentMemoryUsage_) *
+                               heap_growth_);
+  }
+
+  // Rewrites the references to the keys of `forward` held by managed objects,
+  // roots and constants, then destroys the originals. Objects in `moved` are
+  // visited too.
+  void Relocate(const std::unordered_map<Object *, Object *> &forward,
+                const std::vector<Object *> &moved = {});
+
+  Heap heap_;
+  FrameArena arena_;
   Phase phase_ = Phase::Read;
+  GCStats stats_;
+  std::ostream *log_ = nullptr;
+  std::chrono::milliseconds log_interval_{0};
+  std::chrono::steady_clock::time_point last_log_{};
+  size_t suppressed_logs_ = 0;
   std::unordered_set<Object *> objects_;
   std::unordered_set<Scope *> roots_;
-  std::unordered_set<Object *> return_;
-  const size_t threshold_ = 32;
+  std::unordered_multiset<Object *> return_;
+  std::unordered_set<Object *> weak_objects_;
+  std::vector<Object *> frozen_;
+  // Objects outside the frozen pages that frozen objects refer to. They are
+  // roots and never move.
+  std::unordered_set<Object *> frozen_refs_;
+  double heap_growth_ = kDefaultHeapGrowth;
+  size_t min_heap_ = kDefaultMinHeap;
+  size_t threshold_ = kDefaultMinHeap;
+  double compaction_threshold_ = 0.5;
+  size_t compaction_min_heap_ = 16 * Heap::kPageSize;
+  bool compaction_pending_ = false;
   size_t currentMemoryUsage_ = 0;
-  std::unordered_map<int64_t, Number *> constant_numbers_;
-  const std::pair<Boolean, Boolean> bools_ = {Boolean(true), Boolean(false)};
+  // Allocated from the heap like every other object, so that compressed
+  // references can point to them.
+  std::array<Number *, kSmallIntMax - kSmallIntMin + 1> small_ints_;
+  std::pair<Boolean *, Boolean *> bools_;
   std::unordered_map<std::string_view, Symbol *> constant_symbols_;
 
-  GCManager() {}
+  GCManager() {
+    // Object::operator new goes through GetInstance(), which is not usable
+    // until this constructor returns, so the slots are taken directly. They
+    // are never freed and go away with the heap.
+    for (size_t ind = 0; ind < small_ints_.size(); ++ind)
+      small_ints_[ind] = new (heap_.Allocate(sizeof(Number)))
+          Number(kSmallIntMin + static_cast<int64_t>(ind));
+    bools_ = {new (heap_.Allocate(sizeof(Boolean))) Boolean(true),
+              new (heap_.Allocate(sizeof(Boolean))) Boolean(false)};
+  }
   ~GCManager() {
     // auto temp = std::move(objects_);
     // objects_.clear();
 
     for (auto obj : objects_)
       delete obj;
-    for (auto [_, num] : constant_numbers_)
-      delete num;
     for (auto [_, sym] : constant_symbols_)
-      delete sym;
+      if (!heap_.IsFrozen(sym))
+        delete sym;
     for (auto ret : return_)
       delete ret;
+    heap_.Unseal();
+    for (auto obj : frozen_)
+      obj->~Object();
   }
   GCManager(const GCManager &) = delete;
   GCManager &operator=(const GCManager &) = delete;
 };
+
+Object *GCStatistics(ArgSpan args);
+
+Object *DumpHeap(ArgSpan args);
@@ -0,0 +1,213 @@
+#include "heap.h"
+#include <new>
+#include <sys/mman.h>
+
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#define HEAP_POISON(addr, size) ASAN_POISON_MEMORY_REGION(addr, size)
+#define HEAP_UNPOISON(addr, size) ASAN_UNPOISON_MEMORY_REGION(addr, size)
+#else
+#define HEAP_POISON(addr, size) ((void)(addr), (void)(size))
+#define HEAP_UNPOISON(addr, size) ((void)(addr), (void)(size))
+#endif
+
+Heap::Heap() : available_(SizeClass(kMaxSmallSize) + 1) {
+  void *base = mmap(nullptr, kReservedBytes, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED)
+    throw std::bad_alloc();
+  base_ = reinterpret_cast<uintptr_t>(base);
+  ref_base_ = base_;
+  current_ = this;
+}
+
+Heap::~Heap() {
+  munmap(reinterpret_cast<void *>(base_), kReservedBytes);
+  current_ = nullptr;
+}
+
+void *Heap::Allocate(size_t size) {
+  if (size == 0)
+    size = 1;
+  if (size > kMaxSmallSize)
+    return AllocateLarge(size);
+  return AllocateSmall(SizeClass(size));
+}
+
+void Heap::Free(void *ptr) {
+  auto index = PageIndex(ptr);
+  auto &page = pages_[index];
+  if (page.state == State::Large) {
+    used_bytes_ -= page.run * kPageSize;
+    ReleasePages(index, page.run);
+    return;
+  }
+
+  *static_cast<void **>(ptr) = page.free_list;
+  page.free_list = ptr;
+  HEAP_POISON(ptr, page.slot_size);
+  --page.used;
+  used_bytes_ -= page.slot_size;
+  small_used_bytes_ -= page.slot_size;
+  if (page.used == 0) {
+    --small_pages_;
+    ReleasePages(index, 1);
+  } else if (!page.evacuating) {
+    MakeAvailable(index);
+  }
+}
+
+void Heap::MakeAvailable(size_t index) {
+  auto &page = pages_[index];
+  if (page.listed)
+    return;
+  page.listed = true;
+  available_[SizeClass(page.slot_size)].push_back(index);
+}
+
+size_t Heap::AllocationSize(const void *ptr) const {
+  const auto &page = pages_[PageIndex(ptr)];
+  return page.state == State::Large ? page.run * kPageSize : page.slot_size;
+}
+
+void *Heap::AllocateFrozen(size_t size) {
+  size = SizeClass(size) * kGranule;
+  if (static_cast<size_t>(frozen_end_ - frozen_bump_) < size) {
+    auto count = (size + kPageSize - 1) / kPageSize;
+    auto index = CommitPages(count);
+    for (size_t ind = index; ind < index + count; ++ind)
+      pages_[ind].state = State::Frozen;
+    frozen_runs_.emplace_back(index, count);
+    frozen_bump_ = PageAddress(index);
+    frozen_end_ = frozen_bump_ + count * kPageSize;
+  }
+  auto slot = frozen_bump_;
+  frozen_bump_ += size;
+  frozen_bytes_ += size;
+  return slot;
+}
+
+void Heap::Seal() {
+  for (auto [index, count] : frozen_runs_)
+    mprotect(PageAddress(index), count * kPageSize, PROT_READ);
+  frozen_bump_ = frozen_end_ = nullptr;
+}
+
+void Heap::Unseal() {
+  for (auto [index, count] : frozen_runs_)
+    mprotect(PageAddress(index), count * kPageSize, PROT_READ | PROT_WRITE);
+}
+
+size_t Heap::SlotSize(size_t index) const {
+  if (index >= pages_.size() || pages_[index].state != State::Small)
+    return 0;
+  return pages_[index].slot_size;
+}
+
+std::vector<Heap::PageInfo> Heap::SmallPages() const {
+  std::vector<PageInfo> pages;
+  for (size_t ind = 0; ind < pages_.size(); ++ind)
+    if (pages_[ind].state == State::Small)
+      pages.push_back({ind, pages_[ind].slot_size, pages_[ind].used,
+                       kPageSize / pages_[ind].slot_size});
+  return pages;
+}
+
+void Heap::SetEvacuating(size_t index, bool evacuating) {
+  auto &page = pages_[index];
+  page.evacuating = evacuating;
+  if (!evacuating && page.state == State::Small)
+    MakeAvailable(index);
+}
+
+double Heap::Fragmentation() const {
+  if (small_pages_ == 0)
+    return 0.0;
+  return 1.0 - static_cast<double>(small_used_bytes_) /
+                   static_cast<double>(small_pages_ * kPageSize);
+}
+
+size_t Heap::CommitPages(size_t count) {
+  size_t index;
+  if (count == 1 && !free_pages_.empty()) {
+    index = free_pages_.back();
+    free_pages_.pop_back();
+  } else {
+    index = pages_.size();
+    if ((index + count) * kPageSize > kReservedBytes)
+      throw std::bad_alloc();
+    pages_.resize(index + count);
+  }
+  if (mprotect(PageAddress(index), count * kPageSize, PROT_READ | PROT_WRITE))
+    throw std::bad_alloc();
+  committed_pages_ += count;
+  return index;
+}
+
+void Heap::ReleasePages(size_t index, size_t count) {
+  auto addr = PageAddress(index);
+  HEAP_UNPOISON(addr, count * kPageSize);
+  madvise(addr, count * kPageSize, MADV_DONTNEED);
+  mprotect(addr, count * kPageSize, PROT_NONE);
+  for (size_t ind = index; ind < index + count; ++ind) {
+    pages_[ind] = Page();
+    free_pages_.push_back(ind);
+  }
+  committed_pages_ -= count;
+  released_pages_ += count;
+}
+
+void *Heap::AllocateSmall(size_t size_class) {
+  auto slot_size = size_class * kGranule;
+  auto &available = available_[size_class];
+  while (!available.empty()) {
+    auto index = available.back();
+    auto &page = pages_[index];
+    bool has_room = page.free_list || page.bump + slot_size <= kPageSize;
+    if (page.state != State::Small || page.slot_size != slot_size ||
+        page.evacuating || !has_room) {
+      page.listed = false;
+      available.pop_back();
+      continue;
+    }
+
+    void *slot;
+    if (page.free_list) {
+      slot = page.free_list;
+      HEAP_UNPOISON(slot, slot_size);
+      page.free_list = *static_cast<void **>(slot);
+    } else {
+      slot = PageAddress(index) + page.bump;
+      HEAP_UNPOISON(slot, slot_size);
+      page.bump += slot_size;
+    }
+    page.marks[(static_cast<char *>(slot) - PageAddress(index)) / slot_size] =
+        0;
+    ++page.used;
+    used_bytes_ += slot_size;
+    small_used_bytes_ += slot_size;
+    return slot;
+  }
+
+  auto index = CommitPages(1);
+  auto &page = pages_[index];
+  page.state = State::Small;
+  page.slot_size = slot_size;
+  page.marks.assign(kPageSize / slot_size, 0);
+  HEAP_POISON(PageAddress(index), kPageSize);
+  ++small_pages_;
+  MakeAvailable(index);
+  return AllocateSmall(size_class);
+}
+
+void *Heap::AllocateLarge(size_t size) {
+  auto count = (size + kPageSize - 1) / kPageSize;
+  auto index = CommitPages(count);
+  pages_[index].state = State::Large;
+  pages_[index].run = count;
+  pages_[index].marks.assign(1, 0);
+  for (size_t ind = index + 1; ind < index + count; ++ind)
+    pages_[ind].state = State::LargeTail;
+  used_bytes_ += count * kPageSize;
+  return PageAddress(index);
+}
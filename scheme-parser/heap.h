@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Page-based allocator backing every heap Object. A single contiguous range
+// of address space is reserved up front and committed page by page. Small
+// objects are rounded up to a size class and each page holds slots of one
+// class; bigger objects get a run of whole pages. Pages that become empty
+// are decommitted, which returns their memory to the OS.
+//
+// Mark bytes live in per-page side tables rather than in the objects, and
+// frozen pages hold immortal objects that are made read-only once sealed,
+// so the collector never writes to them and forked processes keep sharing
+// them.
+class Heap {
+public:
+  static constexpr size_t kPageSize = size_t(64) << 10;
+  static constexpr size_t kGranule = 8;
+  static constexpr size_t kMaxSmallSize = 512;
+  static constexpr size_t kReservedBytes = size_t(4) << 30;
+
+  struct PageInfo {
+    size_t index;
+    size_t slot_size;
+    size_t used;
+    size_t capacity;
+  };
+
+  Heap();
+  ~Heap();
+
+  Heap(const Heap &) = delete;
+  Heap &operator=(const Heap &) = delete;
+
+  void *Allocate(size_t size);
+  void Free(void *ptr);
+
+  // Bytes available at `ptr`, which was returned by Allocate.
+  size_t AllocationSize(const void *ptr) const;
+
+  // Mark byte of the object at `ptr`, or nullptr for frozen objects and
+  // objects outside the heap, which are never collected. Fresh slots start
+  // at 0.
+  uint8_t *MarkOf(const void *ptr) {
+    if (!Contains(ptr))
+      return nullptr;
+    auto &page = pages_[PageIndex(ptr)];
+    if (page.state == State::Small)
+      return &page.marks[(reinterpret_cast<uintptr_t>(ptr) - base_) %
+                         kPageSize / page.slot_size];
+    if (page.state == State::Large)
+      return &page.marks[0];
+    return nullptr;
+  }
+
+  // Frozen objects are bump-allocated on pages of their own, never freed
+  // and never moved. Seal makes the frozen pages read-only; later frozen
+  // allocations start on new pages. Unseal is for teardown only.
+  void *AllocateFrozen(size_t size);
+  void Seal();
+  void Unseal();
+
+  bool IsFrozen(const void *ptr) const {
+    return Contains(ptr) && PageIndex(ptr) < pages_.size() &&
+           pages_[PageIndex(ptr)].state == State::Frozen;
+  }
+
+  size_t FrozenBytes() const { return frozen_bytes_; }
+
+  bool Contains(const void *ptr) const {
+    auto addr = reinterpret_cast<uintptr_t>(ptr);
+    return addr >= base_ && addr < base_ + kReservedBytes;
+  }
+
+  uintptr_t Base() const { return base_; }
+
+  // Base of the process-wide heap, for decoding compressed references.
+  static uintptr_t RefBase() { return ref_base_; }
+
+  // The process-wide heap, nullptr before it is created.
+  static Heap *Current() { return current_; }
+
+  size_t PageIndex(const void *ptr) const {
+    return (reinterpret_cast<uintptr_t>(ptr) - base_) / kPageSize;
+  }
+
+  // Slot size of the small-object page `index`, 0 for other pages.
+  size_t SlotSize(size_t index) const;
+
+  // All committed small-object pages.
+  std::vector<PageInfo> SmallPages() const;
+
+  // Evacuating pages are skipped when looking for free slots, so objects
+  // moved out of them are not allocated back in.
+  void SetEvacuating(size_t index, bool evacuating);
+
+  size_t CommittedBytes() const { return committed_pages_ * kPageSize; }
+
+  // Bytes handed out in slots and large runs.
+  size_t UsedBytes() const { return used_bytes_; }
+
+  size_t ReleasedPages() const { return released_pages_; }
+
+  // Share of the committed small-object pages not occupied by objects.
+  double Fragmentation() const;
+
+private:
+  enum class State : uint8_t { Free, Small, Large, LargeTail, Frozen };
+
+  struct Page {
+    State state = State::Free;
+    bool evacuating = false;
+    bool listed = false;
+    uint32_t slot_size = 0;
+    uint32_t used = 0;
+    uint32_t bump = 0;
+    uint32_t run = 0;
+    void *free_list = nullptr;
+    std::vector<uint8_t> marks;
+  };
+
+  static size_t SizeClass(size_t size) {
+    return (size + kGranule - 1) / kGranule;
+  }
+
+  char *PageAddress(size_t index) const {
+    return reinterpret_cast<char *>(base_ + index * kPageSize);
+  }
+
+  size_t CommitPages(size_t count);
+  void ReleasePages(size_t index, size_t count);
+  void *AllocateSmall(size_t size_class);
+  void *AllocateLarge(size_t size);
+  void MakeAvailable(size_t index);
+
+  static inline uintptr_t ref_base_ = 0;
+  static inline Heap *current_ = nullptr;
+
+  uintptr_t base_ = 0;
+  std::vector<Page> pages_;
+  std::vector<size_t> free_pages_;
+  std::vector<std::vector<size_t>> available_;
+  size_t committed_pages_ = 0;
+  size_t small_pages_ = 0;
+  size_t small_used_bytes_ = 0;
+  size_t used_bytes_ = 0;
+  size_t released_pages_ = 0;
+  std::vector<std::pair<size_t, size_t>> frozen_runs_;
+  char *frozen_bump_ = nullptr;
+  char *frozen_end_ = nullptr;
+  size_t frozen_bytes_ = 0;
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Binary heap snapshot written by GCManager::DumpHeap. All integers are
+// little-endian.
+//
+//   magic      "SCMHEAP\0"
+//   u32        version
+//   u32        type count,  then per type:  string name
+//   u64        node count,  then per node:
+//                u64 id, u32 type index, u64 size, u8 flags,
+//                u32 edge count, then per edge: u64 target id, u8 edge flags
+//   u64        root count,  then per root:  u64 target id, string label
+//
+// Strings are a u32 length followed by the bytes. Node ids start at 1.
+namespace heap_snapshot {
+
+inline constexpr char kMagic[8] = {'S', 'C', 'M', 'H', 'E', 'A', 'P', '\0'};
+inline constexpr uint32_t kVersion = 1;
+
+// Node flags.
+inline constexpr uint8_t kManaged = 1; // owned by the collector
+inline constexpr uint8_t kGuarded = 2; // pinned by a GCManager::SafeLock
+
+// Edge flags.
+inline constexpr uint8_t kWeak = 1;
+
+struct Edge {
+  uint64_t target;
+  uint8_t flags;
+};
+
+struct Node {
+  uint64_t id;
+  uint32_t type;
+  uint64_t size;
+  uint8_t flags;
+  std::vector<Edge> edges;
+};
+
+struct Root {
+  uint64_t target;
+  std::string label;
+};
+
+struct Snapshot {
+  std::vector<std::string> types;
+  std::vector<Node> nodes;
+  std::vector<Root> roots;
+};
+
+template <typename T> void Write(std::ostream *out, T value) {
+  for (size_t ind = 0; ind < sizeof(T); ++ind)
+    out->put(static_cast<char>((static_cast<uint64_t>(value) >> (8 * ind)) &
+                               0xff));
+}
+
+inline void WriteString(std::ostream *out, const std::string &value) {
+  Write<uint32_t>(out, value.size());
+  out->write(value.data(), value.size());
+}
+
+template <typename T> T Read(std::istream *in) {
+  uint64_t value = 0;
+  for (size_t ind = 0; ind < sizeof(T); ++ind) {
+    auto byte = in->get();
+    if (byte == EOF)
+      throw std::runtime_error("truncated heap snapshot");
+    value |= static_cast<uint64_t>(byte) << (8 * ind);
+  }
+  return static_cast<T>(value);
+}
+
+inline std::string ReadString(std::istream *in) {
+  std::string value(Read<uint32_t>(in), '\0');
+  if (!in->read(value.data(), value.size()))
+    throw std::runtime_error("truncated heap snapshot");
+  return value;
+}
+
+inline Snapshot ReadSnapshot(std::istream *in) {
+  char magic[sizeof(kMagic)];
+  if (!in->read(magic, sizeof(magic)) ||
+      !std::equal(magic, magic + sizeof(magic), kMagic))
+    throw std::runtime_error("not a heap snapshot");
+  if (Read<uint32_t>(in) != kVersion)
+    throw std::runtime_error("unsupported heap snapshot version");
+
+  Snapshot snapshot;
+  snapshot.types.resize(Read<uint32_t>(in));
+  for (auto &type : snapshot.types)
+    type = ReadString(in);
+
+  snapshot.nodes.resize(Read<uint64_t>(in));
+  for (auto &node : snapshot.nodes) {
+    node.id = Read<uint64_t>(in);
+    node.type = Read<uint32_t>(in);
+    node.size = Read<uint64_t>(in);
+    node.flags = Read<uint8_t>(in);
+    node.edges.resize(Read<uint32_t>(in));
+    for (auto &edge : node.edges) {
+      edge.target = Read<uint64_t>(in);
+      edge.flags = Read<uint8_t>(in);
+    }
+  }
+
+  snapshot.roots.resize(Read<uint64_t>(in));
+  for (auto &root : snapshot.roots) {
+    root.target = Read<uint64_t>(in);
+    root.label = ReadString(in);
+  }
+  return snapshot;
+}
+
+} // namespace heap_snapshot
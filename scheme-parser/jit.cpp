@@ -0,0 +1,1092 @@
+#include "jit.h"
+#include "create.h"
+#include "frame_arena.h"
+#include "gc.h"
+#include "parser.h"
+#include "resolver.h"
+#include "vm.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <iomanip>
+#include <new>
+#include <sys/mman.h>
+#include <typeinfo>
+#include <unistd.h>
+#include <utility>
+
+#if defined(SCHEME_JIT) && defined(__x86_64__) &&                             \
+    !defined(SCHEME_COMPRESSED_REFS)
+#define SCHEME_JIT_X86_64
+#endif
+
+NativeCode::NativeCode(const std::vector<uint8_t> &code,
+                       std::vector<uint32_t> offsets)
+    : size_(code.size()), offsets_(std::move(offsets)) {
+  auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  mapped_ = (size_ + page - 1) / page * page;
+  pages_ = mmap(nullptr, mapped_, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (pages_ == MAP_FAILED)
+    throw std::bad_alloc();
+  std::memcpy(pages_, code.data(), size_);
+  if (mprotect(pages_, mapped_, PROT_READ | PROT_EXEC) != 0) {
+    munmap(pages_, mapped_);
+    throw std::bad_alloc();
+  }
+}
+
+NativeCode::~NativeCode() { munmap(pages_, mapped_); }
+
+void NativeCode::Dump(const Bytecode &bytecode, std::ostream *out) const {
+  auto bytes = static_cast<const uint8_t *>(pages_);
+  auto fill = out->fill();
+  auto hex = [&](size_t begin, size_t end) {
+    if (begin == end)
+      return;
+    *out << ' ';
+    for (auto ind = begin; ind < end; ++ind)
+      *out << ' ' << std::hex << std::setw(2) << std::setfill('0')
+           << static_cast<int>(bytes[ind]) << std::dec;
+    *out << '\n';
+  };
+  *out << "entry:\n";
+  hex(0, offsets_[0]);
+  for (size_t pc = 0; pc < bytecode.code.size();) {
+    auto next = pc + bytecode.Length(pc);
+    bytecode.PrintInstruction(pc, out);
+    hex(offsets_[pc], offsets_[next]);
+    pc = next;
+  }
+  *out << "exit:\n";
+  hex(offsets_.back(), size_);
+  out->fill(fill);
+}
+
+#ifdef SCHEME_JIT_X86_64
+
+namespace {
+
+// What the machine code works with, at fixed offsets from r12.
+struct JitFrame {
+  Object **slots; // FrameArena::Base()
+  Bytecode *bytecode;
+  std::shared_ptr<Scope> *scope;
+  std::exception_ptr *error;
+  Object *true_value;
+  Object *false_value;
+  // Where the VM takes over after kBailout.
+  uint64_t resume_pc;
+  uint64_t resume_depth;
+};
+
+// Returned by runtime calls that threw; the exception is in the frame.
+Object *const kFailed = reinterpret_cast<Object *>(1);
+// Returned by code that cannot go on: what it assumed of the slots does not
+// hold.
+Object *const kBailout = reinterpret_cast<Object *>(2);
+
+template <typename T> T *As(const Ref<Object> &ref) {
+  return static_cast<T *>(static_cast<Object *>(ref));
+}
+
+template <typename Body> Object *Guarded(JitFrame *frame, Body &&body) {
+  try {
+    return body();
+  } catch (...) {
+    *frame->error = std::current_exception();
+    return kFailed;
+  }
+}
+
+Object *&ScopeSlot(JitFrame *frame, uint32_t depth, uint32_t index) {
+  auto scope = frame->scope->get();
+  for (; depth; --depth)
+    scope = scope->parent_.get();
+  return scope->slots_[index];
+}
+
+// Calls `fn` on `argc` values from slot `first` on, which stay there, and so
+// rooted, until it returns.
+Object *Invoke(JitFrame *frame, Function *fn, uint32_t first, uint32_t argc) {
+  auto result = fn->Apply(*frame->scope, ArgSpan(frame->slots + first, argc));
+  std::fill_n(frame->slots + first, argc, nullptr);
+  return result;
+}
+
+// The runtime calls of the machine code. Slot numbers are from
+// FrameArena::Base(); operands the instruction does not have are 0.
+using Helper = Object *(*)(JitFrame *, uint32_t, uint32_t, uint32_t,
+                           uint32_t);
+
+Object *ScopeRefHelper(JitFrame *frame, uint32_t depth, uint32_t index,
+                       uint32_t dst, uint32_t) {
+  frame->slots[dst] = ScopeSlot(frame, depth, index);
+  return nullptr;
+}
+
+Object *GlobalRefHelper(JitFrame *frame, uint32_t constant, uint32_t dst,
+                        uint32_t, uint32_t) {
+  return Guarded(frame, [&]() -> Object * {
+    auto global = As<GlobalRef>(frame->bytecode->constants[constant]);
+    frame->slots[dst] = global->Binding();
+    return nullptr;
+  });
+}
+
+Object *SetScopeHelper(JitFrame *frame, uint32_t depth, uint32_t index,
+                       uint32_t top, uint32_t) {
+  ScopeSlot(frame, depth, index) = frame->slots[top];
+  frame->slots[top] = nullptr;
+  return nullptr;
+}
+
+Object *SetGlobalHelper(JitFrame *frame, uint32_t constant, uint32_t top,
+                        uint32_t, uint32_t) {
+  return Guarded(frame, [&]() -> Object * {
+    As<GlobalRef>(frame->bytecode->constants[constant])
+        ->Store(frame->slots[top]);
+    frame->slots[top] = nullptr;
+    return nullptr;
+  });
+}
+
+Object *DefineGlobalHelper(JitFrame *frame, uint32_t constant, uint32_t top,
+                           uint32_t, uint32_t) {
+  return Guarded(frame, [&]() -> Object * {
+    As<GlobalDefine>(frame->bytecode->constants[constant])
+        ->Define(frame->slots[top]);
+    frame->slots[top] = nullptr;
+    return nullptr;
+  });
+}
+
+Object *ClosureHelper(JitFrame *frame, uint32_t constant, uint32_t dst,
+                      uint32_t, uint32_t) {
+  auto form = As<LambdaForm>(frame->bytecode->constants[constant]);
+  frame->slots[dst] = Create<LambdaFunction>(*frame->scope, form);
+  return nullptr;
+}
+
+Object *CallHelper(JitFrame *frame, uint32_t callee, uint32_t argc, uint32_t,
+                   uint32_t) {
+  return Guarded(frame, [&]() -> Object * {
+    auto fn = AsFunction(frame->slots[callee]);
+    if (!fn)
+      throw RuntimeError("First element of the list must be a function");
+    auto result = Invoke(frame, fn, callee + 1, argc);
+    frame->slots[callee] = result;
+    return nullptr;
+  });
+}
+
+Function *GlobalCallee(JitFrame *frame, uint32_t constant,
+                       uint32_t cache_index) {
+  auto global = As<GlobalRef>(frame->bytecode->constants[constant]);
+  auto &cache = frame->bytecode->caches[cache_index];
+  if (cache.function && cache.version == global->Version())
+    return As<Function>(cache.function);
+  auto fn = AsFunction(global->Binding());
+  if (!fn)
+    throw RuntimeError("First element of the list must be a function");
+  cache.function = fn;
+  cache.version = global->Version();
+  return fn;
+}
+
+Object *CallGlobalHelper(JitFrame *frame, uint32_t constant, uint32_t argc,
+                         uint32_t cache_index, uint32_t first) {
+  return Guarded(frame, [&]() -> Object * {
+    auto fn = GlobalCallee(frame, constant, cache_index);
+    auto result = Invoke(frame, fn, first, argc);
+    frame->slots[first] = result;
+    return nullptr;
+  });
+}
+
+// Tail calls return the value of the code: the result of a builtin, or
+// nullptr with the call of a closure left pending.
+Object *TailInvoke(JitFrame *frame, Function *fn, uint32_t first,
+                   uint32_t argc) {
+  auto lambda = Is<LambdaFunction>(fn);
+  if (!lambda)
+    return Invoke(frame, fn, first, argc);
+  auto &pending = LambdaFunction::PendingTailCall();
+  pending.args.assign(frame->slots + first, frame->slots + first + argc);
+  std::fill_n(frame->slots + first, argc, nullptr);
+  pending.fn = lambda;
+  return nullptr;
+}
+
+Object *TailCallHelper(JitFrame *frame, uint32_t head, uint32_t argc,
+                       uint32_t, uint32_t) {
+  return Guarded(frame, [&]() -> Object * {
+    auto fn = AsFunction(frame->slots[head]);
+    if (!fn)
+      throw RuntimeError("First element of the list must be a function");
+    return TailInvoke(frame, fn, head + 1, argc);
+  });
+}
+
+Object *TailCallGlobalHelper(JitFrame *frame, uint32_t constant,
+                             uint32_t argc, uint32_t cache_index,
+                             uint32_t first) {
+  return Guarded(frame, [&]() -> Object * {
+    return TailInvoke(frame, GlobalCallee(frame, constant, cache_index), first,
+                      argc);
+  });
+}
+
+// Boxes the result of inline arithmetic.
+Object *NumberHelper(JitFrame *frame, int64_t value, uint32_t dst) {
+  frame->slots[dst] = GCManager::GetInstance().GetNumber(value);
+  return nullptr;
+}
+
+uint64_t IsFalseHelper(Object *obj) { return obj->IsFalse(); }
+
+enum Reg : uint8_t {
+  rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+  r8, r9, r10, r11, r12, r13, r14, r15,
+};
+
+enum Cond : uint8_t {
+  kOverflow = 0x0,
+  kEqual = 0x4,
+  kNotEqual = 0x5,
+  kLess = 0xC,
+  kGreaterEqual = 0xD,
+  kLessEqual = 0xE,
+  kGreater = 0xF,
+};
+
+Cond Negate(Cond cond) { return static_cast<Cond>(cond ^ 1); }
+
+// The few x86-64 instructions the translation uses, all with 64-bit
+// operands. Memory operands are always [base + disp32].
+class Assembler {
+public:
+  size_t Size() const { return code_.size(); }
+  const std::vector<uint8_t> &Code() const { return code_; }
+
+  void Push(Reg reg) {
+    if (reg >= 8)
+      Byte(0x41);
+    Byte(0x50 + (reg & 7));
+  }
+  void Pop(Reg reg) {
+    if (reg >= 8)
+      Byte(0x41);
+    Byte(0x58 + (reg & 7));
+  }
+  void Ret() { Byte(0xC3); }
+
+  void MovImm(Reg dst, uint64_t imm) {
+    if (imm <= UINT32_MAX) {
+      if (dst >= 8)
+        Byte(0x41);
+      Byte(0xB8 + (dst & 7));
+      Bytes(imm, 4);
+    } else {
+      Rex(0, dst);
+      Byte(0xB8 + (dst & 7));
+      Bytes(imm, 8);
+    }
+  }
+  void MovImm(Reg dst, const void *ptr) {
+    MovImm(dst, reinterpret_cast<uint64_t>(ptr));
+  }
+
+  void Mov(Reg dst, Reg src) { Op(0x89, src, dst); }
+  void Load(Reg dst, Reg base, int32_t disp) { Op(0x8B, dst, base, disp); }
+  void Store(Reg base, int32_t disp, Reg src) { Op(0x89, src, base, disp); }
+  void StoreNull(Reg base, int32_t disp) {
+    Op(0xC7, rax, base, disp);
+    Bytes(0, 4);
+  }
+
+  void Add(Reg dst, Reg src) { Op(0x01, src, dst); }
+  void Sub(Reg dst, Reg src) { Op(0x29, src, dst); }
+  void Imul(Reg dst, Reg src) {
+    Rex(dst, src);
+    Byte(0x0F);
+    Byte(0xAF);
+    Direct(dst, src);
+  }
+  // Flags of `a - b`.
+  void Cmp(Reg a, Reg b) { Op(0x39, b, a); }
+  void Cmp(Reg a, Reg base, int32_t disp) { Op(0x3B, a, base, disp); }
+  void Cmp(Reg a, int8_t imm) {
+    Op(0x83, static_cast<Reg>(7), a);
+    Byte(imm);
+  }
+  void Test(Reg reg) { Op(0x85, reg, reg); }
+
+  void Call(Reg target) {
+    if (target >= 8)
+      Byte(0x41);
+    Byte(0xFF);
+    Direct(2, target);
+  }
+
+  // Jumps return where their displacement ends, for Bind.
+  size_t Jump() {
+    Byte(0xE9);
+    Bytes(0, 4);
+    return Size();
+  }
+  size_t JumpIf(Cond cond) {
+    Byte(0x0F);
+    Byte(0x80 | cond);
+    Bytes(0, 4);
+    return Size();
+  }
+  void Bind(size_t jump, size_t target) {
+    auto displacement = static_cast<int32_t>(target - jump);
+    std::memcpy(&code_[jump - 4], &displacement, 4);
+  }
+  void Bind(size_t jump) { Bind(jump, Size()); }
+
+private:
+  void Byte(uint8_t byte) { code_.push_back(byte); }
+  void Bytes(uint64_t value, size_t count) {
+    for (size_t ind = 0; ind < count; ++ind)
+      Byte(value >> (8 * ind));
+  }
+  void Rex(unsigned reg, unsigned rm) {
+    Byte(0x48 | ((reg >> 3) << 2) | (rm >> 3));
+  }
+  void Direct(unsigned reg, unsigned rm) {
+    Byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+  }
+  void Op(uint8_t opcode, Reg reg, Reg rm) {
+    Rex(reg, rm);
+    Byte(opcode);
+    Direct(reg, rm);
+  }
+  void Op(uint8_t opcode, Reg reg, Reg base, int32_t disp) {
+    Rex(reg, base);
+    Byte(opcode);
+    Byte(0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == rsp)
+      Byte(0x24);
+    Bytes(static_cast<uint32_t>(disp), 4);
+  }
+
+  std::vector<uint8_t> code_;
+};
+
+// Builtins done inline on two numbers.
+struct Primitive {
+  Function::ApplyMethod apply;
+  enum Kind { kAdd, kSubtract, kMultiply, kCompare } kind;
+  Cond holds = kEqual;
+};
+
+const Primitive kPrimitives[] = {
+    {Plus, Primitive::kAdd},
+    {Minus, Primitive::kSubtract},
+    {Multiply, Primitive::kMultiply},
+    {Less, Primitive::kCompare, kLess},
+    {More, Primitive::kCompare, kGreater},
+    {Equality, Primitive::kCompare, kEqual},
+    {LessOrEqual, Primitive::kCompare, kLessEqual},
+    {MoreOrEqual, Primitive::kCompare, kGreaterEqual},
+};
+
+const void *VtableOf(const Object *obj) {
+  return *reinterpret_cast<const void *const *>(obj);
+}
+
+// Operand stack depth before each instruction, -1 where unreachable.
+std::vector<int> StackDepths(const Bytecode &bytecode) {
+  const auto &code = bytecode.code;
+  std::vector<int> depths(code.size(), -1);
+  std::vector<std::pair<size_t, int>> work{{0, 0}};
+  while (!work.empty()) {
+    auto [pc, depth] = work.back();
+    work.pop_back();
+    while (pc < code.size() && depths[pc] < 0) {
+      depths[pc] = depth;
+      auto operands = &code[pc + 1];
+      auto next = pc + bytecode.Length(pc);
+      switch (code[pc]) {
+      case Bytecode::kConst:
+      case Bytecode::kArenaRef:
+      case Bytecode::kScopeRef:
+      case Bytecode::kGlobalRef:
+      case Bytecode::kClosure:
+        ++depth;
+        break;
+      case Bytecode::kPop:
+        --depth;
+        break;
+      case Bytecode::kJump:
+        work.emplace_back(operands[0], depth);
+        next = code.size();
+        break;
+      case Bytecode::kJumpIfFalse:
+        --depth;
+        work.emplace_back(operands[0], depth);
+        break;
+      case Bytecode::kJumpIfFalseKeep:
+      case Bytecode::kJumpIfTrueKeep:
+        work.emplace_back(operands[0], depth);
+        --depth;
+        break;
+      case Bytecode::kGuard:
+        work.emplace_back(operands[0], depth);
+        break;
+      case Bytecode::kCall:
+        depth -= operands[0];
+        break;
+      case Bytecode::kCallGlobal:
+        depth -= static_cast<int>(operands[1]) - 1;
+        break;
+      case Bytecode::kTailCall:
+      case Bytecode::kTailCallGlobal:
+      case Bytecode::kReturn:
+        next = code.size();
+        break;
+      default:
+        break;
+      }
+      pc = next;
+    }
+  }
+  return depths;
+}
+
+// What is known of the arena slots before an instruction: which hold
+// numbers, and which operand stack slots hold what a local held when it was
+// pushed (-1 for none).
+struct SlotTypes {
+  bool reached = false;
+  std::vector<bool> number;
+  std::vector<int> origin;
+
+  bool IsNumber(size_t slot) const {
+    return number[slot] || (origin[slot] >= 0 && number[origin[slot]]);
+  }
+};
+
+// Slot types before each instruction of code whose calls at pc are done
+// inline with `primitives[pc]`. The operands of such a call are numbers
+// after it: the fast path checks them, and the slow one checks the locals
+// they came from once the call returns (see Translator::VerifyNumbers).
+// Callees cannot reach the arena locals of this code, so what is known of
+// them only changes when they are assigned. Passes in order are repeated
+// until nothing changes: a backward jump, from a loop, may take away what
+// was known at its target.
+std::vector<SlotTypes>
+InferTypes(const Bytecode &bytecode, size_t stack_base,
+           const std::vector<int> &depths,
+           const std::vector<const Primitive *> &primitives) {
+  const auto &code = bytecode.code;
+  SlotTypes unknown{true, std::vector<bool>(stack_base + bytecode.max_stack),
+                    std::vector<int>(stack_base + bytecode.max_stack, -1)};
+  std::vector<SlotTypes> types(code.size());
+  bool changed = true;
+
+  auto flow = [&](size_t target, const SlotTypes &from) {
+    auto &to = types[target];
+    if (!to.reached) {
+      to = from;
+      changed = true;
+      return;
+    }
+    for (size_t slot = 0; slot < to.number.size(); ++slot) {
+      if (to.number[slot] && !from.number[slot]) {
+        to.number[slot] = false;
+        changed = true;
+      }
+      if (to.origin[slot] != from.origin[slot] && to.origin[slot] >= 0) {
+        to.origin[slot] = -1;
+        changed = true;
+      }
+    }
+  };
+
+  types[0] = unknown;
+  while (changed) {
+    changed = false;
+    for (size_t pc = 0; pc < code.size(); pc += bytecode.Length(pc)) {
+      if (!types[pc].reached || depths[pc] < 0)
+        continue;
+      auto state = types[pc];
+      auto operands = &code[pc + 1];
+      size_t top = stack_base + depths[pc];
+      auto set = [&](size_t slot, bool number, int origin) {
+        state.number[slot] = number;
+        state.origin[slot] = origin;
+      };
+      bool falls_through = true;
+      switch (code[pc]) {
+      case Bytecode::kConst:
+        set(top, IsNumber(bytecode.constants[operands[0]]), -1);
+        break;
+      case Bytecode::kArenaRef:
+        set(top, state.number[operands[0]], static_cast<int>(operands[0]));
+        break;
+      case Bytecode::kScopeRef:
+      case Bytecode::kGlobalRef:
+      case Bytecode::kClosure:
+        set(top, false, -1);
+        break;
+      case Bytecode::kSetArena: {
+        bool number = state.IsNumber(top - 1);
+        for (auto &origin : state.origin)
+          if (origin == static_cast<int>(operands[0]))
+            origin = -1;
+        state.number[operands[0]] = number;
+        set(top - 1, false, -1);
+        break;
+      }
+      case Bytecode::kSetScope:
+      case Bytecode::kSetGlobal:
+      case Bytecode::kDefineGlobal:
+      case Bytecode::kPop:
+        set(top - 1, false, -1);
+        break;
+      case Bytecode::kJump:
+        flow(operands[0], state);
+        falls_through = false;
+        break;
+      case Bytecode::kJumpIfFalse:
+        set(top - 1, false, -1);
+        flow(operands[0], state);
+        break;
+      case Bytecode::kJumpIfFalseKeep:
+      case Bytecode::kJumpIfTrueKeep:
+        flow(operands[0], state);
+        set(top - 1, false, -1);
+        break;
+      case Bytecode::kGuard:
+        flow(operands[0], state);
+        break;
+      case Bytecode::kCall:
+        for (size_t slot = top - operands[0] - 1; slot < top; ++slot)
+          set(slot, false, -1);
+        break;
+      case Bytecode::kCallGlobal: {
+        auto first = top - operands[1];
+        if (auto primitive = primitives[pc]) {
+          for (auto slot : {top - 2, top - 1})
+            if (state.origin[slot] >= 0)
+              state.number[state.origin[slot]] = true;
+          set(top - 1, false, -1);
+          set(top - 2, primitive->kind != Primitive::kCompare, -1);
+          break;
+        }
+        for (auto slot = first; slot < top; ++slot)
+          set(slot, false, -1);
+        break;
+      }
+      case Bytecode::kTailCall:
+      case Bytecode::kTailCallGlobal:
+      case Bytecode::kReturn:
+        falls_through = false;
+        break;
+      default:
+        break;
+      }
+      auto next = pc + bytecode.Length(pc);
+      if (falls_through && next < code.size())
+        flow(next, state);
+    }
+  }
+  return types;
+}
+
+// Translates one Bytecode. rbx holds FrameArena::Base() and r12 the
+// JitFrame; nothing else lives in registers across instructions, and no
+// object across a runtime call.
+class Translator {
+public:
+  Translator(const Bytecode &bytecode, size_t stack_base)
+      : bytecode_(bytecode), stack_base_(stack_base),
+        depths_(StackDepths(bytecode)),
+        offsets_(bytecode.code.size() + 1, 0),
+        targets_(bytecode.code.size(), false) {
+    const auto &code = bytecode.code;
+    primitives_.resize(code.size());
+    for (size_t pc = 0; pc < code.size(); pc += bytecode.Length(pc)) {
+      if (code[pc] >= Bytecode::kJump && code[pc] <= Bytecode::kGuard)
+        targets_[code[pc + 1]] = true;
+      Object **cell;
+      const Function *fn;
+      if ((code[pc] == Bytecode::kCallGlobal ||
+           code[pc] == Bytecode::kTailCallGlobal) &&
+          code[pc + 2] == 2 && depths_[pc] >= 0)
+        primitives_[pc] = MatchPrimitive(
+            As<GlobalRef>(bytecode.constants[code[pc + 1]]), &cell, &fn);
+    }
+    types_ = InferTypes(bytecode, stack_base, depths_, primitives_);
+
+    auto &gc = GCManager::GetInstance();
+    auto number = gc.GetNumber(0);
+    number_vtable_ = VtableOf(number);
+    number_value_ = reinterpret_cast<const char *>(&number->SetValue()) -
+                    reinterpret_cast<const char *>(number);
+    boolean_vtable_ = VtableOf(gc.GetBool(false));
+  }
+
+  std::unique_ptr<NativeCode> Translate() {
+    asm_.Push(rbp);
+    asm_.Mov(rbp, rsp);
+    asm_.Push(rbx);
+    asm_.Push(r12);
+    asm_.Mov(r12, rdi);
+    asm_.Load(rbx, r12, offsetof(JitFrame, slots));
+
+    const auto &code = bytecode_.code;
+    for (size_t pc = 0; pc < code.size();) {
+      offsets_[pc] = asm_.Size();
+      pc = depths_[pc] < 0 ? pc + bytecode_.Length(pc) : Emit(pc);
+    }
+
+    offsets_.back() = asm_.Size();
+    for (const auto &bailout : bailouts_) {
+      for (auto jump : bailout.jumps)
+        asm_.Bind(jump);
+      asm_.MovImm(rax, bailout.pc);
+      asm_.Store(r12, offsetof(JitFrame, resume_pc), rax);
+      asm_.MovImm(rax, bailout.depth);
+      asm_.Store(r12, offsetof(JitFrame, resume_depth), rax);
+      asm_.MovImm(rax, kBailout);
+      returns_.push_back(asm_.Jump());
+    }
+    for (auto jump : failures_)
+      asm_.Bind(jump);
+    asm_.MovImm(rax, kFailed);
+    for (auto jump : returns_)
+      asm_.Bind(jump);
+    asm_.Pop(r12);
+    asm_.Pop(rbx);
+    asm_.Pop(rbp);
+    asm_.Ret();
+
+    for (auto [jump, target] : branches_)
+      asm_.Bind(jump, offsets_[target]);
+    return std::make_unique<NativeCode>(asm_.Code(), std::move(offsets_));
+  }
+
+private:
+  // Displacement from rbx of the operand stack slot `index`.
+  int32_t StackSlot(int index) const {
+    return static_cast<int32_t>(8 * (stack_base_ + index));
+  }
+  uint32_t StackIndex(int index) const { return stack_base_ + index; }
+
+  void Branch(size_t jump, uint32_t target) {
+    branches_.emplace_back(jump, target);
+  }
+
+  void CallRuntime(Helper helper, uint32_t a, uint32_t b = 0, uint32_t c = 0,
+                   uint32_t d = 0) {
+    asm_.Mov(rdi, r12);
+    asm_.MovImm(rsi, a);
+    asm_.MovImm(rdx, b);
+    asm_.MovImm(rcx, c);
+    asm_.MovImm(r8, d);
+    asm_.MovImm(rax, reinterpret_cast<const void *>(helper));
+    asm_.Call(rax);
+    asm_.Cmp(rax, static_cast<int8_t>(1));
+    failures_.push_back(asm_.JumpIf(kEqual));
+  }
+
+  // Tests rax, and returns the jumps taken if it is false; falls through
+  // if it is true.
+  std::vector<size_t> JumpsIfFalse() {
+    asm_.Test(rax);
+    auto null = asm_.JumpIf(kEqual);
+    asm_.Load(rcx, rax, 0);
+    asm_.MovImm(rdx, boolean_vtable_);
+    asm_.Cmp(rcx, rdx);
+    auto other = asm_.JumpIf(kNotEqual);
+    asm_.Cmp(rax, r12, offsetof(JitFrame, false_value));
+    std::vector<size_t> jumps{asm_.JumpIf(kEqual)};
+    asm_.Mov(rdi, rax);
+    asm_.MovImm(rax, reinterpret_cast<const void *>(IsFalseHelper));
+    asm_.Call(rax);
+    asm_.Test(rax);
+    jumps.push_back(asm_.JumpIf(kNotEqual));
+    asm_.Bind(null);
+    asm_.Bind(other);
+    return jumps;
+  }
+
+  void JumpIfFalse(int depth, uint32_t target) {
+    asm_.Load(rax, rbx, StackSlot(depth - 1));
+    asm_.StoreNull(rbx, StackSlot(depth - 1));
+    for (auto jump : JumpsIfFalse())
+      Branch(jump, target);
+  }
+
+  // The builtin a call through `global` finds there now, if it is one done
+  // inline.
+  const Primitive *MatchPrimitive(GlobalRef *global, Object ***cell,
+                                  const Function **fn) {
+    try {
+      *cell = &global->Binding();
+    } catch (const NameError &) {
+      return nullptr;
+    }
+    auto value = **cell;
+    if (!value || typeid(*value) != typeid(Function))
+      return nullptr;
+    *fn = static_cast<const Function *>(value);
+    for (const auto &primitive : kPrimitives)
+      if (primitive.apply == (*fn)->GetApplyMethod())
+        return &primitive;
+    return nullptr;
+  }
+
+  // A call of a builtin on two numbers, done inline while the global still
+  // holds that builtin and the operands are numbers. A comparison followed
+  // by a conditional jump jumps on the flags; then the jump is emitted here
+  // too, after the slow path. A tail call returns the result. Returns the pc
+  // to continue at.
+  size_t EmitPrimitive(size_t pc, int depth, const Primitive &primitive,
+                       Object **cell, const Function *fn) {
+    const auto &code = bytecode_.code;
+    auto next = pc + bytecode_.Length(pc);
+    bool tail = code[pc] == Bytecode::kTailCallGlobal;
+    bool fused = !tail && primitive.kind == Primitive::kCompare &&
+                 next < code.size() && code[next] == Bytecode::kJumpIfFalse &&
+                 !targets_[next];
+    std::vector<size_t> slow, done;
+
+    asm_.MovImm(rax, cell);
+    asm_.Load(rax, rax, 0);
+    asm_.Test(rax);
+    slow.push_back(asm_.JumpIf(kEqual));
+    asm_.Load(rcx, rax, 0);
+    asm_.MovImm(rdx, VtableOf(fn));
+    asm_.Cmp(rcx, rdx);
+    slow.push_back(asm_.JumpIf(kNotEqual));
+    asm_.Load(rcx, rax, static_cast<int32_t>(fn->ApplyMethodOffset()));
+    asm_.MovImm(rdx, reinterpret_cast<const void *>(primitive.apply));
+    asm_.Cmp(rcx, rdx);
+    slow.push_back(asm_.JumpIf(kNotEqual));
+
+    asm_.MovImm(rdx, number_vtable_);
+    for (auto [reg, index] :
+         {std::pair{rax, depth - 2}, std::pair{rsi, depth - 1}}) {
+      asm_.Load(reg, rbx, StackSlot(index));
+      if (types_[pc].IsNumber(StackIndex(index)))
+        continue;
+      asm_.Test(reg);
+      slow.push_back(asm_.JumpIf(kEqual));
+      asm_.Load(rcx, reg, 0);
+      asm_.Cmp(rcx, rdx);
+      slow.push_back(asm_.JumpIf(kNotEqual));
+    }
+    asm_.Load(rax, rax, number_value_);
+    asm_.Load(rsi, rsi, number_value_);
+
+    switch (primitive.kind) {
+    case Primitive::kAdd:
+      asm_.Add(rax, rsi);
+      break;
+    case Primitive::kSubtract:
+      // The builtin rejects a first operand of 0.
+      asm_.Test(rax);
+      slow.push_back(asm_.JumpIf(kEqual));
+      asm_.Sub(rax, rsi);
+      break;
+    case Primitive::kMultiply:
+      asm_.Imul(rax, rsi);
+      break;
+    case Primitive::kCompare:
+      asm_.Cmp(rax, rsi);
+      asm_.StoreNull(rbx, StackSlot(depth - 2));
+      asm_.StoreNull(rbx, StackSlot(depth - 1));
+      if (fused) {
+        Branch(asm_.JumpIf(Negate(primitive.holds)), code[next + 1]);
+        done.push_back(asm_.Jump());
+      } else {
+        auto otherwise = asm_.JumpIf(Negate(primitive.holds));
+        asm_.Load(rax, r12, offsetof(JitFrame, true_value));
+        auto store = asm_.Jump();
+        asm_.Bind(otherwise);
+        asm_.Load(rax, r12, offsetof(JitFrame, false_value));
+        asm_.Bind(store);
+        asm_.Store(rbx, StackSlot(depth - 2), rax);
+        done.push_back(asm_.Jump());
+      }
+      break;
+    }
+    if (primitive.kind != Primitive::kCompare) {
+      slow.push_back(asm_.JumpIf(kOverflow));
+      asm_.StoreNull(rbx, StackSlot(depth - 1));
+      asm_.Mov(rsi, rax);
+      asm_.Mov(rdi, r12);
+      asm_.MovImm(rdx, StackIndex(depth - 2));
+      asm_.MovImm(rax, reinterpret_cast<const void *>(NumberHelper));
+      asm_.Call(rax);
+      done.push_back(asm_.Jump());
+    }
+
+    for (auto jump : slow)
+      asm_.Bind(jump);
+    if (tail) {
+      CallRuntime(TailCallGlobalHelper, code[pc + 1], 2, code[pc + 3],
+                  StackIndex(depth - 2));
+      returns_.push_back(asm_.Jump());
+      for (auto jump : done)
+        asm_.Bind(jump);
+      asm_.Load(rax, rbx, StackSlot(depth - 2));
+      returns_.push_back(asm_.Jump());
+      return next;
+    }
+    CallRuntime(CallGlobalHelper, code[pc + 1], 2, code[pc + 3],
+                StackIndex(depth - 2));
+    VerifyNumbers(pc, depth, primitive);
+    if (fused) {
+      offsets_[next] = asm_.Size();
+      JumpIfFalse(depth - 1, code[next + 1]);
+      next += bytecode_.Length(next);
+    }
+    for (auto jump : done)
+      asm_.Bind(jump);
+    return next;
+  }
+
+  // After the generic call in place of a builtin done inline, checks what
+  // the fast path would have, and InferTypes takes for granted from here
+  // on: that the locals the operands came from, and the result of
+  // arithmetic, are numbers. The builtin throws otherwise; a function a
+  // global holds now in its place may not, and then the VM runs the rest of
+  // the code.
+  void VerifyNumbers(size_t pc, int depth, const Primitive &primitive) {
+    const auto &types = types_[pc];
+    std::vector<size_t> slots;
+    for (auto index : {depth - 2, depth - 1}) {
+      auto slot = StackIndex(index);
+      auto origin = types.origin[slot];
+      if (!types.IsNumber(slot) && origin >= 0 &&
+          std::find(slots.begin(), slots.end(), origin) == slots.end())
+        slots.push_back(origin);
+    }
+    if (primitive.kind != Primitive::kCompare)
+      slots.push_back(StackIndex(depth - 2));
+    if (slots.empty())
+      return;
+    auto &bailout = bailouts_.emplace_back();
+    bailout.pc = pc + bytecode_.Length(pc);
+    bailout.depth = depth - 1;
+    asm_.MovImm(rdx, number_vtable_);
+    for (auto slot : slots) {
+      asm_.Load(rax, rbx, static_cast<int32_t>(8 * slot));
+      asm_.Test(rax);
+      bailout.jumps.push_back(asm_.JumpIf(kEqual));
+      asm_.Load(rcx, rax, 0);
+      asm_.Cmp(rcx, rdx);
+      bailout.jumps.push_back(asm_.JumpIf(kNotEqual));
+    }
+  }
+
+  // Emits the instruction at `pc` and returns the pc to continue at.
+  size_t Emit(size_t pc) {
+    const auto &code = bytecode_.code;
+    auto operands = &code[pc + 1];
+    auto depth = depths_[pc];
+    switch (code[pc]) {
+    case Bytecode::kConst:
+      asm_.MovImm(rax, &bytecode_.constants[operands[0]]);
+      asm_.Load(rax, rax, 0);
+      asm_.Store(rbx, StackSlot(depth), rax);
+      break;
+    case Bytecode::kArenaRef:
+      asm_.Load(rax, rbx, 8 * operands[0]);
+      asm_.Store(rbx, StackSlot(depth), rax);
+      break;
+    case Bytecode::kScopeRef:
+      CallRuntime(ScopeRefHelper, operands[0], operands[1], StackIndex(depth));
+      break;
+    case Bytecode::kGlobalRef:
+      CallRuntime(GlobalRefHelper, operands[0], StackIndex(depth));
+      break;
+    case Bytecode::kSetArena:
+      asm_.Load(rax, rbx, StackSlot(depth - 1));
+      asm_.Store(rbx, 8 * operands[0], rax);
+      asm_.StoreNull(rbx, StackSlot(depth - 1));
+      break;
+    case Bytecode::kSetScope:
+      CallRuntime(SetScopeHelper, operands[0], operands[1],
+                  StackIndex(depth - 1));
+      break;
+    case Bytecode::kSetGlobal:
+      CallRuntime(SetGlobalHelper, operands[0], StackIndex(depth - 1));
+      break;
+    case Bytecode::kDefineGlobal:
+      CallRuntime(DefineGlobalHelper, operands[0], StackIndex(depth - 1));
+      break;
+    case Bytecode::kPop:
+      asm_.StoreNull(rbx, StackSlot(depth - 1));
+      break;
+    case Bytecode::kJump:
+      Branch(asm_.Jump(), operands[0]);
+      break;
+    case Bytecode::kJumpIfFalse:
+      JumpIfFalse(depth, operands[0]);
+      break;
+    case Bytecode::kJumpIfFalseKeep:
+      asm_.Load(rax, rbx, StackSlot(depth - 1));
+      for (auto jump : JumpsIfFalse())
+        Branch(jump, operands[0]);
+      asm_.StoreNull(rbx, StackSlot(depth - 1));
+      break;
+    case Bytecode::kJumpIfTrueKeep: {
+      asm_.Load(rax, rbx, StackSlot(depth - 1));
+      auto otherwise = JumpsIfFalse();
+      Branch(asm_.Jump(), operands[0]);
+      for (auto jump : otherwise)
+        asm_.Bind(jump);
+      asm_.StoreNull(rbx, StackSlot(depth - 1));
+      break;
+    }
+    case Bytecode::kGuard: {
+      // Globals in guards are defined, and their cells never move.
+      auto global = As<GlobalRef>(bytecode_.constants[operands[1]]);
+      asm_.MovImm(rax, &global->Binding());
+      asm_.Load(rax, rax, 0);
+      asm_.MovImm(rcx, &bytecode_.constants[operands[2]]);
+      asm_.Load(rcx, rcx, 0);
+      asm_.Cmp(rax, rcx);
+      Branch(asm_.JumpIf(kNotEqual), operands[0]);
+      break;
+    }
+    case Bytecode::kClosure:
+      CallRuntime(ClosureHelper, operands[0], StackIndex(depth));
+      break;
+    case Bytecode::kCall:
+      CallRuntime(CallHelper, StackIndex(depth - operands[0] - 1),
+                  operands[0]);
+      break;
+    case Bytecode::kCallGlobal:
+    case Bytecode::kTailCallGlobal: {
+      auto argc = operands[1];
+      Object **cell;
+      const Function *fn;
+      auto global = As<GlobalRef>(bytecode_.constants[operands[0]]);
+      const Primitive *primitive =
+          argc == 2 ? MatchPrimitive(global, &cell, &fn) : nullptr;
+      if (primitive)
+        return EmitPrimitive(pc, depth, *primitive, cell, fn);
+      if (code[pc] == Bytecode::kCallGlobal) {
+        CallRuntime(CallGlobalHelper, operands[0], argc, operands[2],
+                    StackIndex(depth - argc));
+        break;
+      }
+      CallRuntime(TailCallGlobalHelper, operands[0], argc, operands[2],
+                  StackIndex(depth - argc));
+      returns_.push_back(asm_.Jump());
+      break;
+    }
+    case Bytecode::kTailCall:
+      CallRuntime(TailCallHelper, StackIndex(depth - operands[0] - 1),
+                  operands[0]);
+      returns_.push_back(asm_.Jump());
+      break;
+    case Bytecode::kReturn:
+      asm_.Load(rax, rbx, StackSlot(depth - 1));
+      returns_.push_back(asm_.Jump());
+      break;
+    }
+    return pc + bytecode_.Length(pc);
+  }
+
+  const Bytecode &bytecode_;
+  size_t stack_base_;
+  std::vector<int> depths_;
+  std::vector<uint32_t> offsets_;
+  std::vector<bool> targets_;
+  Assembler asm_;
+  // Jumps to the pc of a bytecode instruction, bound once all are emitted.
+  std::vector<std::pair<size_t, uint32_t>> branches_;
+  std::vector<size_t> failures_;
+  std::vector<size_t> returns_;
+  // Jumps out to the VM, which resumes at `pc` with `depth` values on the
+  // stack.
+  struct Bailout {
+    std::vector<size_t> jumps;
+    uint32_t pc;
+    uint32_t depth;
+  };
+  std::vector<Bailout> bailouts_;
+  std::vector<const Primitive *> primitives_;
+  std::vector<SlotTypes> types_;
+
+  const void *number_vtable_;
+  int32_t number_value_;
+  const void *boolean_vtable_;
+};
+
+} // namespace
+
+bool Jit::Available() { return true; }
+
+std::unique_ptr<NativeCode> Jit::Compile(const Bytecode &bytecode,
+                                         size_t stack_base) {
+  std::unique_ptr<NativeCode> native;
+  try {
+    native = Translator(bytecode, stack_base).Translate();
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+  ++compiled_;
+  if (dump_) {
+    *dump_ << "; " << native->Size() << " bytes\n";
+    native->Dump(bytecode, dump_);
+  }
+  return native;
+}
+
+Object *Jit::Run(Bytecode *bytecode, std::shared_ptr<Scope> &scope,
+                 size_t stack_base) {
+  if (!enabled_)
+    return Execute(bytecode, scope, stack_base);
+  if (!bytecode->native && bytecode->calls < threshold_ &&
+      ++bytecode->calls == threshold_)
+    bytecode->native = Compile(*bytecode, stack_base);
+  if (!bytecode->native)
+    return Execute(bytecode, scope, stack_base);
+
+  auto &gc = GCManager::GetInstance();
+  std::exception_ptr error;
+  JitFrame frame{FrameArena::Current()->Base(),
+                 bytecode,
+                 &scope,
+                 &error,
+                 const_cast<Boolean *>(gc.GetBool(true)),
+                 const_cast<Boolean *>(gc.GetBool(false)),
+                 0,
+                 0};
+  auto entry = reinterpret_cast<Object *(*)(JitFrame *)>(
+      const_cast<void *>(bytecode->native->Entry()));
+  auto result = entry(&frame);
+  if (result == kFailed)
+    std::rethrow_exception(error);
+  if (result == kBailout)
+    return Execute(bytecode, scope, stack_base, frame.resume_pc,
+                   frame.resume_depth);
+  return result;
+}
+
+#else
+
+bool Jit::Available() { return false; }
+
+std::unique_ptr<NativeCode> Jit::Compile(const Bytecode &, size_t) {
+  return nullptr;
+}
+
+Object *Jit::Run(Bytecode *bytecode, std::shared_ptr<Scope> &scope,
+                 size_t stack_base) {
+  return Execute(bytecode, scope, stack_base);
+}
+
+#endif
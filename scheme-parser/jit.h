@@ -0,0 +1,93 @@
+#pragma once
+
+#include "parser.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+struct Bytecode;
+
+// Machine code of one Bytecode, in pages mapped for it alone. The pages are
+// writable while the code is copied in and executable afterwards, never
+// both.
+class NativeCode {
+public:
+  // `offsets[pc]` is where the code of the instruction at `pc` starts.
+  NativeCode(const std::vector<uint8_t> &code, std::vector<uint32_t> offsets);
+  ~NativeCode();
+
+  NativeCode(const NativeCode &) = delete;
+  NativeCode &operator=(const NativeCode &) = delete;
+
+  const void *Entry() const { return pages_; }
+  size_t Size() const { return size_; }
+
+  // Writes each instruction of `bytecode` followed by its machine code in
+  // hex, for `objdump -D -b binary -mi386:x86-64` and the like.
+  void Dump(const Bytecode &bytecode, std::ostream *out) const;
+
+private:
+  void *pages_;
+  size_t mapped_;
+  size_t size_;
+  std::vector<uint32_t> offsets_;
+};
+
+// Second tier of the bytecode VM. A lambda whose bytecode has run
+// Threshold() times is compiled to x86-64 code: operand stack slots become
+// fixed addresses in the arena frame, jumps become native jumps, and calls
+// of the builtin arithmetic and comparisons on two numbers are done inline,
+// behind guards that fall back to the generic call. Operands the code has
+// already seen to be numbers, constants and locals it has done arithmetic
+// on, are not checked again. Everything else calls back into the runtime.
+// Errors in the runtime are carried out of the machine code and rethrown;
+// where a generic call leaves a local that was taken for a number holding
+// something else, the VM runs the rest of the code.
+//
+// Only built for x86-64 with the pointer layout of references (see ref.h),
+// and unless the SCHEME_JIT option is off; elsewhere Run always interprets.
+class Jit {
+public:
+  static Jit &GetInstance() {
+    static Jit instance;
+    return instance;
+  }
+
+  // Whether this build has the compiler.
+  static bool Available();
+
+  // Off by default. When off, code compiled before keeps its machine code
+  // but runs in the VM.
+  void SetEnabled(bool enabled) { enabled_ = enabled; }
+  bool Enabled() const { return enabled_; }
+
+  void SetThreshold(uint32_t calls) { threshold_ = calls; }
+  uint32_t Threshold() const { return threshold_; }
+
+  // Code compiled from now on is dumped to `out`, or not if it is nullptr.
+  void SetDump(std::ostream *out) { dump_ = out; }
+
+  // Lambdas compiled so far.
+  size_t CompiledCount() const { return compiled_; }
+
+  // Runs `bytecode` like Execute (vm.h), compiling it first if it has
+  // become hot.
+  Object *Run(Bytecode *bytecode, std::shared_ptr<Scope> &scope,
+              size_t stack_base);
+
+  static constexpr uint32_t kDefaultThreshold = 100;
+
+private:
+  Jit() = default;
+
+  // nullptr if the code cannot be compiled.
+  std::unique_ptr<NativeCode> Compile(const Bytecode &bytecode,
+                                      size_t stack_base);
+
+  bool enabled_ = false;
+  uint32_t threshold_ = kDefaultThreshold;
+  std::ostream *dump_ = nullptr;
+  size_t compiled_ = 0;
+};
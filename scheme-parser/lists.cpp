@@ -0,0 +1,272 @@
+#include "lists.h"
+#include "create.h"
+#include "frame_arena.h"
+#include "gc.h"
+#include "parser.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <typeinfo>
+
+namespace {
+
+bool IsTrue(const Object *obj) { return !obj || !obj->IsFalse(); }
+
+// Builds a list front to back. The first cell is rooted in the arena, and
+// each cell is linked before the next one is allocated, so the whole list
+// stays alive through one slot.
+class ListBuilder {
+public:
+  ListBuilder() : head_(FrameArena::Current(), 1) {}
+
+  Cell *Append(Object *value) {
+    auto cell = Create<Cell>(value, nullptr);
+    if (last_)
+      last_->SetSecond(cell);
+    else
+      head_[0] = cell;
+    last_ = cell;
+    return cell;
+  }
+
+  Object *Finish(Object *tail = nullptr) {
+    if (!last_)
+      return tail;
+    last_->SetSecond(tail);
+    return head_[0];
+  }
+
+private:
+  FrameArena::Args head_;
+  Cell *last_ = nullptr;
+};
+
+// Moves `cursor` past the next element, which it stores in `value`, unless
+// the list has ended.
+bool Next(Object *&cursor, Object *&value, const char *who) {
+  if (!cursor)
+    return false;
+  if (!IsCell(cursor))
+    throw RuntimeError(std::string(who) + ": argument must be a list");
+  auto cell = AsCell(cursor);
+  value = cell->GetFirst();
+  cursor = cell->GetSecond();
+  return true;
+}
+
+Function *AsCallable(Object *obj, const char *who) {
+  if (!IsFunction(obj))
+    throw RuntimeError(std::string(who) +
+                       ": first argument must be a function");
+  return AsFunction(obj);
+}
+
+// Stores the next element of each list in `values`, from `first` on, unless
+// one of the lists has ended.
+bool NextOfEach(FrameArena::Args &cursors, size_t count,
+                FrameArena::Args &values, size_t first, const char *who) {
+  for (size_t ind = 0; ind < count; ++ind)
+    if (!Next(cursors[ind], values[first + ind], who))
+      return false;
+  return true;
+}
+
+using Equivalence = bool (*)(const Object *, const Object *);
+
+// The first entry of an association list whose key is `same` as `key`.
+Object *Find(Object *list, Object *key, Equivalence same, const char *who) {
+  for (Object *entry; Next(list, entry, who);) {
+    if (!IsCell(entry))
+      throw RuntimeError(std::string(who) +
+                         ": argument must be an association list");
+    if (same(AsCell(entry)->GetFirst(), key))
+      return entry;
+  }
+  return Create<Boolean>(false);
+}
+
+} // namespace
+
+bool IsEqv(const Object *lhs, const Object *rhs) {
+  if (lhs == rhs)
+    return true;
+  if (!lhs || !rhs || typeid(*lhs) != typeid(*rhs))
+    return false;
+  if (IsNumber(lhs))
+    return AsNumber(lhs)->GetValue() == AsNumber(rhs)->GetValue();
+  if (IsSymbol(lhs))
+    return AsSymbol(lhs)->GetName() == AsSymbol(rhs)->GetName();
+  return false;
+}
+
+bool IsEqual(const Object *lhs, const Object *rhs) {
+  for (; IsCell(lhs) && IsCell(rhs);
+       lhs = AsCell(lhs)->GetSecond(), rhs = AsCell(rhs)->GetSecond()) {
+    if (lhs == rhs)
+      return true;
+    if (!IsEqual(AsCell(lhs)->GetFirst(), AsCell(rhs)->GetFirst()))
+      return false;
+  }
+  if (IsString(lhs) && IsString(rhs))
+    return AsString(lhs)->GetValue() == AsString(rhs)->GetValue();
+  if (IsVector(lhs) && IsVector(rhs) && lhs != rhs) {
+    auto left = AsVector(lhs), right = AsVector(rhs);
+    if (left->Size() != right->Size())
+      return false;
+    for (size_t ind = 0; ind < left->Size(); ++ind)
+      if (!IsEqual(left->Get(ind), right->Get(ind)))
+        return false;
+    return true;
+  }
+  return IsEqv(lhs, rhs);
+}
+
+Object *Length(ArgSpan args) {
+  int64_t length = 0;
+  for (Object *list = args[0], *value; Next(list, value, "length");)
+    ++length;
+  return Create<Number>(length);
+}
+
+Object *Append(ArgSpan args) {
+  if (args.empty())
+    return nullptr;
+  ListBuilder res;
+  for (size_t ind = 0; ind + 1 < args.size(); ++ind)
+    for (Object *list = args[ind], *value; Next(list, value, "append");)
+      res.Append(value);
+  return res.Finish(args.back());
+}
+
+Object *Reverse(ArgSpan args) {
+  FrameArena::Args res(FrameArena::Current(), 1);
+  for (Object *list = args[0], *value; Next(list, value, "reverse");)
+    res[0] = Create<Cell>(value, res[0]);
+  return res[0];
+}
+
+// An improper list is copied up to its last pair, which keeps its tail.
+Object *ListCopy(ArgSpan args) {
+  ListBuilder res;
+  auto list = args[0];
+  for (; IsCell(list); list = AsCell(list)->GetSecond())
+    res.Append(AsCell(list)->GetFirst());
+  return res.Finish(list);
+}
+
+// The callback may change the lists, so the cursors are rooted too. The
+// block of arguments is pushed last: its span ends at the arena top.
+Object *Map(ArgSpan args) {
+  auto fn = AsCallable(args[0], "map");
+  auto lists = args.subspan(1);
+  ListBuilder res;
+  FrameArena::Args cursors(FrameArena::Current(), lists.size());
+  std::copy(lists.begin(), lists.end(), &cursors[0]);
+  FrameArena::Args values(FrameArena::Current(), lists.size());
+  std::shared_ptr<Scope> nullscope = nullptr;
+  while (NextOfEach(cursors, lists.size(), values, 0, "map")) {
+    auto cell = res.Append(nullptr);
+    cell->SetFirst(fn->Apply(nullscope, values.Span()));
+  }
+  return res.Finish();
+}
+
+Object *ForEach(ArgSpan args) {
+  auto fn = AsCallable(args[0], "for-each");
+  auto lists = args.subspan(1);
+  FrameArena::Args cursors(FrameArena::Current(), lists.size());
+  std::copy(lists.begin(), lists.end(), &cursors[0]);
+  FrameArena::Args values(FrameArena::Current(), lists.size());
+  std::shared_ptr<Scope> nullscope = nullptr;
+  while (NextOfEach(cursors, lists.size(), values, 0, "for-each"))
+    fn->Apply(nullscope, values.Span());
+  return nullptr;
+}
+
+Object *Filter(ArgSpan args) {
+  auto fn = AsCallable(args[0], "filter");
+  ListBuilder res;
+  FrameArena::Args cursor(FrameArena::Current(), 1);
+  cursor[0] = args[1];
+  FrameArena::Args value(FrameArena::Current(), 1);
+  std::shared_ptr<Scope> nullscope = nullptr;
+  while (Next(cursor[0], value[0], "filter"))
+    if (IsTrue(fn->Apply(nullscope, value.Span())))
+      res.Append(value[0]);
+  return res.Finish();
+}
+
+// The accumulator is the first argument of each call, in the slot before
+// the elements.
+Object *FoldLeft(ArgSpan args) {
+  auto fn = AsCallable(args[0], "fold-left");
+  auto lists = args.subspan(2);
+  FrameArena::Args cursors(FrameArena::Current(), lists.size());
+  std::copy(lists.begin(), lists.end(), &cursors[0]);
+  FrameArena::Args values(FrameArena::Current(), lists.size() + 1);
+  values[0] = args[1];
+  std::shared_ptr<Scope> nullscope = nullptr;
+  while (NextOfEach(cursors, lists.size(), values, 1, "fold-left"))
+    values[0] = fn->Apply(nullscope, values.Span());
+  return values[0];
+}
+
+// The elements are gathered into the arena first, so that the calls can
+// run from the last ones back without recursing; the accumulator is the
+// last argument of each call.
+Object *FoldRight(ArgSpan args) {
+  auto fn = AsCallable(args[0], "fold-right");
+  auto lists = args.subspan(2);
+  size_t count = SIZE_MAX;
+  for (auto list : lists) {
+    size_t length = 0;
+    for (Object *value; Next(list, value, "fold-right");)
+      ++length;
+    count = std::min(count, length);
+  }
+  FrameArena::Args elements(FrameArena::Current(), count * lists.size());
+  for (size_t list = 0; list < lists.size(); ++list) {
+    auto cell = lists[list];
+    for (size_t ind = 0; ind < count; ++ind, cell = AsCell(cell)->GetSecond())
+      elements[ind * lists.size() + list] = AsCell(cell)->GetFirst();
+  }
+  FrameArena::Args values(FrameArena::Current(), lists.size() + 1);
+  values[lists.size()] = args[1];
+  std::shared_ptr<Scope> nullscope = nullptr;
+  for (size_t ind = count; ind-- > 0;) {
+    for (size_t list = 0; list < lists.size(); ++list)
+      values[list] = elements[ind * lists.size() + list];
+    values[lists.size()] = fn->Apply(nullscope, values.Span());
+  }
+  return values[lists.size()];
+}
+
+Object *Reduce(ArgSpan args) {
+  auto fn = AsCallable(args[0], "reduce");
+  FrameArena::Args cursor(FrameArena::Current(), 1);
+  cursor[0] = args[2];
+  FrameArena::Args values(FrameArena::Current(), 2);
+  if (!Next(cursor[0], values[1], "reduce"))
+    return args[1];
+  std::shared_ptr<Scope> nullscope = nullptr;
+  while (Next(cursor[0], values[0], "reduce"))
+    values[1] = fn->Apply(nullscope, values.Span());
+  return values[1];
+}
+
+Object *Assq(ArgSpan args) { return Find(args[1], args[0], IsEqv, "assq"); }
+
+Object *Assoc(ArgSpan args) {
+  return Find(args[1], args[0], IsEqual, "assoc");
+}
+
+Object *Member(ArgSpan args) {
+  for (Object *list = args[1], *value; list;) {
+    auto tail = list;
+    Next(list, value, "member");
+    if (IsEqual(value, args[0]))
+      return tail;
+  }
+  return Create<Boolean>(false);
+}
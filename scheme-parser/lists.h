@@ -0,0 +1,54 @@
+#pragma once
+
+#include "parser.h"
+
+// The list library, after SRFI-1. Each builtin is one loop over its lists:
+// the list being built is rooted once, through its first cell, and the
+// values passed to a function given as an argument wait in slots of the
+// FrameArena, so nothing but the cells of the result is allocated.
+//
+// A function given as an argument is called with the arguments in order,
+// and a builtin of several lists stops at the end of the shortest one.
+
+// `eqv?`: numbers by value, symbols by name, anything else by identity.
+bool IsEqv(const Object *lhs, const Object *rhs);
+
+// `equal?`: as IsEqv, with strings by value and pairs and vectors element
+// by element.
+bool IsEqual(const Object *lhs, const Object *rhs);
+
+Object *Length(ArgSpan args);
+
+// `(append list ... tail)`: the elements of the lists, then `tail`, which
+// is shared rather than copied.
+Object *Append(ArgSpan args);
+
+Object *Reverse(ArgSpan args);
+
+Object *ListCopy(ArgSpan args);
+
+// `(map fn list ...)`: the values of `fn` on the first elements of the
+// lists, then on the second ones, and so on.
+Object *Map(ArgSpan args);
+
+// `(for-each fn list ...)`: as map, for the effects of `fn`.
+Object *ForEach(ArgSpan args);
+
+Object *Filter(ArgSpan args);
+
+// `(fold-left fn init list ...)`: (fn (fn init a1 b1) a2 b2) ...
+Object *FoldLeft(ArgSpan args);
+
+// `(fold-right fn init list ...)`: (fn a1 b1 (fn a2 b2 ... init)).
+Object *FoldRight(ArgSpan args);
+
+// `(reduce fn init list)`: (fn an ... (fn a2 a1)), or `init` for '().
+Object *Reduce(ArgSpan args);
+
+// The first pair of an association list whose car is the key, or #f; assq
+// compares with eqv?, assoc with equal?.
+Object *Assq(ArgSpan args);
+Object *Assoc(ArgSpan args);
+
+// The first tail of a list whose car is equal? to the value, or #f.
+Object *Member(ArgSpan args);
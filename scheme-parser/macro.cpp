@@ -0,0 +1,309 @@
+#include "macro.h"
+#include "create.h"
+#include "gc.h"
+#include "parser.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+bool IsEllipsis(const Object *obj) {
+  return IsSymbol(obj) && AsSymbol(obj)->GetName() == "...";
+}
+
+// Symbols in patterns and templates, as opposed to the booleans.
+bool IsName(Object *obj) { return IsSymbol(obj) && !Is<Boolean>(obj); }
+
+// What a pattern variable matched: a form, or, for a variable under an
+// ellipsis, one binding per repetition.
+struct Binding {
+  Object *form = nullptr;
+  bool repeated = false;
+  std::vector<Binding> items;
+};
+using Bindings = std::unordered_map<std::string, Binding>;
+
+class Matcher {
+public:
+  explicit Matcher(const std::vector<Ref<Object>> &literals)
+      : literals_(literals) {}
+
+  bool Match(Object *pattern, Object *form, Bindings *bindings) const {
+    if (IsName(pattern)) {
+      auto symbol = AsSymbol(pattern);
+      if (IsLiteral(symbol))
+        return IsSymbol(form) &&
+               Unrenamed(AsSymbol(form)->GetName()) == symbol->GetName();
+      (*bindings)[symbol->GetName()] = Binding{form, false, {}};
+      return true;
+    }
+    if (!IsCell(pattern))
+      return SameAtom(pattern, form);
+
+    auto cell = AsCell(pattern);
+    auto rest = cell->GetSecond();
+    if (!IsCell(rest) || !IsEllipsis(AsCell(rest)->GetFirst())) {
+      if (!IsCell(form))
+        return false;
+      return Match(cell->GetFirst(), AsCell(form)->GetFirst(), bindings) &&
+             Match(rest, AsCell(form)->GetSecond(), bindings);
+    }
+
+    // The element before the ellipsis takes every form but those the rest
+    // of the pattern needs.
+    auto after = AsCell(rest)->GetSecond();
+    size_t needed = 0, available = 0;
+    for (auto ptr = after; IsCell(ptr); ptr = AsCell(ptr)->GetSecond())
+      ++needed;
+    for (auto ptr = form; IsCell(ptr); ptr = AsCell(ptr)->GetSecond())
+      ++available;
+    if (available < needed)
+      return false;
+    std::vector<std::string> names;
+    Variables(cell->GetFirst(), &names);
+    for (const auto &name : names)
+      (*bindings)[name] = Binding{nullptr, true, {}};
+    for (; available > needed; --available) {
+      Bindings item;
+      if (!Match(cell->GetFirst(), AsCell(form)->GetFirst(), &item))
+        return false;
+      for (const auto &name : names)
+        (*bindings)[name].items.push_back(std::move(item[name]));
+      form = AsCell(form)->GetSecond();
+    }
+    return Match(after, form, bindings);
+  }
+
+  void Variables(Object *pattern, std::vector<std::string> *names) const {
+    if (IsCell(pattern)) {
+      Variables(AsCell(pattern)->GetFirst(), names);
+      Variables(AsCell(pattern)->GetSecond(), names);
+    } else if (IsName(pattern) && !IsEllipsis(pattern) &&
+               !IsLiteral(AsSymbol(pattern))) {
+      names->push_back(AsSymbol(pattern)->GetName());
+    }
+  }
+
+private:
+  bool IsLiteral(const Symbol *symbol) const {
+    return std::ranges::any_of(literals_, [&](Object *literal) {
+      return AsSymbol(literal)->GetName() == symbol->GetName();
+    });
+  }
+
+  static bool SameAtom(Object *pattern, Object *form) {
+    if (IsNumber(pattern))
+      return IsNumber(form) &&
+             AsNumber(pattern)->GetValue() == AsNumber(form)->GetValue();
+    if (IsString(pattern))
+      return IsString(form) &&
+             AsString(pattern)->GetValue() == AsString(form)->GetValue();
+    if (Is<Boolean>(pattern))
+      return Is<Boolean>(form) && pattern->IsFalse() == form->IsFalse();
+    return pattern == form;
+  }
+
+  const std::vector<Ref<Object>> &literals_;
+};
+
+uint64_t next_expansion = 0;
+
+// Instantiates the template of one expansion.
+class Expander {
+public:
+  explicit Expander(GCManager::SafeLock *lock)
+      : lock_(lock), serial_(++next_expansion) {}
+
+  // Symbols under `quote` are data: they are not renamed.
+  Object *Instantiate(Object *tmpl, const Bindings &bindings, bool quoted) {
+    if (IsName(tmpl)) {
+      const auto &name = AsSymbol(tmpl)->GetName();
+      if (auto it = bindings.find(name); it != bindings.end()) {
+        if (it->second.repeated)
+          throw SyntaxError(name + " is used without its ellipsis");
+        return it->second.form;
+      }
+      return quoted ? tmpl : Rename(name);
+    }
+    if (!IsCell(tmpl))
+      return tmpl;
+
+    std::vector<Object *> items;
+    auto ptr = tmpl;
+    for (; IsCell(ptr); ptr = AsCell(ptr)->GetSecond()) {
+      auto element = AsCell(ptr)->GetFirst();
+      auto next = AsCell(ptr)->GetSecond();
+      if (IsCell(next) && IsEllipsis(AsCell(next)->GetFirst())) {
+        Repeat(element, bindings, quoted, &items);
+        ptr = next;
+        continue;
+      }
+      if (ptr == tmpl && IsName(element) &&
+          AsSymbol(element)->GetName() == "quote" &&
+          !bindings.contains("quote")) {
+        items.push_back(element);
+        quoted = true;
+        continue;
+      }
+      items.push_back(Instantiate(element, bindings, quoted));
+    }
+    auto list = ptr ? Instantiate(ptr, bindings, quoted) : nullptr;
+    for (auto it = items.rbegin(); it != items.rend(); ++it)
+      list = Keep(Create<Cell>(*it, list));
+    return list;
+  }
+
+private:
+  void Repeat(Object *element, const Bindings &bindings, bool quoted,
+              std::vector<Object *> *items) {
+    std::vector<std::string> names;
+    Variables(element, bindings, &names);
+    if (names.empty())
+      throw SyntaxError("no pattern variable before the ellipsis");
+    auto count = bindings.at(names[0]).items.size();
+    for (const auto &name : names)
+      if (bindings.at(name).items.size() != count)
+        throw SyntaxError("pattern variables under one ellipsis matched "
+                          "different numbers of forms");
+    for (size_t ind = 0; ind < count; ++ind) {
+      auto inner = bindings;
+      for (const auto &name : names)
+        inner[name] = bindings.at(name).items[ind];
+      items->push_back(Instantiate(element, inner, quoted));
+    }
+  }
+
+  // The repeated pattern variables `tmpl` uses.
+  static void Variables(Object *tmpl, const Bindings &bindings,
+                        std::vector<std::string> *names) {
+    if (IsCell(tmpl)) {
+      Variables(AsCell(tmpl)->GetFirst(), bindings, names);
+      Variables(AsCell(tmpl)->GetSecond(), bindings, names);
+      return;
+    }
+    if (!IsName(tmpl))
+      return;
+    const auto &name = AsSymbol(tmpl)->GetName();
+    auto it = bindings.find(name);
+    if (it != bindings.end() && it->second.repeated &&
+        std::ranges::find(*names, name) == names->end())
+      names->push_back(name);
+  }
+
+  Symbol *Rename(const std::string &name) {
+    auto &renamed = renamed_[name];
+    if (!renamed)
+      renamed = Keep(Create<Symbol>(name + '%' + std::to_string(serial_)));
+    return renamed;
+  }
+
+  template <typename T> T *Keep(T *obj) {
+    lock_->Lock(obj);
+    return obj;
+  }
+
+  GCManager::SafeLock *lock_;
+  uint64_t serial_;
+  std::unordered_map<std::string, Symbol *> renamed_;
+};
+
+} // namespace
+
+Macro::Macro(std::string name, std::vector<Object *> literals,
+             std::vector<Object *> patterns, std::vector<Object *> templates)
+    : name_(std::move(name)), literals_(literals.begin(), literals.end()),
+      patterns_(patterns.begin(), patterns.end()),
+      templates_(templates.begin(), templates.end()) {}
+
+void Macro::MarkRelated(GCMark mark) {
+  VisitReferences([mark](Object *&ref, RefKind) {
+    if (ref)
+      ref->Mark(mark);
+  });
+}
+
+void Macro::VisitReferences(const ReferenceVisitor &visit) {
+  for (auto &literal : literals_)
+    VisitRef(visit, literal, RefKind::Strong);
+  for (auto &pattern : patterns_)
+    VisitRef(visit, pattern, RefKind::Strong);
+  for (auto &tmpl : templates_)
+    VisitRef(visit, tmpl, RefKind::Strong);
+}
+
+const char *Macro::TypeName() const { return "macro"; }
+
+size_t Macro::AllocatedBytes() const {
+  return sizeof(Macro) + OutOfLineBytes(name_) + OutOfLineBytes(literals_) +
+         OutOfLineBytes(patterns_) + OutOfLineBytes(templates_);
+}
+
+Object *Macro::MoveTo(void *where) {
+  return new (where) Macro(std::move(*this));
+}
+
+void Macro::PrintTo(std::ostream *) const {
+  throw RuntimeError("can't print macro");
+}
+
+void Macro::PrintDebug(std::ostream *out) const {
+  *out << "#<macro " << name_ << ">" << std::endl;
+}
+
+Object *Macro::Eval(std::shared_ptr<Scope> &) {
+  throw RuntimeError("can't eval macro");
+}
+
+Object *Macro::Expand(Cell *form, GCManager::SafeLock *lock) {
+  Matcher matcher(literals_);
+  for (size_t ind = 0; ind < patterns_.size(); ++ind) {
+    // The keyword in the pattern is ignored.
+    Bindings bindings;
+    if (!matcher.Match(AsCell(patterns_[ind])->GetSecond(), form->GetSecond(),
+                       &bindings))
+      continue;
+    return Expander(lock).Instantiate(templates_[ind], bindings, false);
+  }
+  throw SyntaxError("no syntax rule of " + name_ + " matches");
+}
+
+Macro *SyntaxRules(Symbol *name, Object *spec) {
+  if (!IsCell(spec) || !IsSymbol(AsCell(spec)->GetFirst()) ||
+      AsSymbol(AsCell(spec)->GetFirst())->GetName() != "syntax-rules")
+    throw SyntaxError("define-syntax expects syntax-rules");
+  auto parts = ToVector(AsCell(spec)->GetSecond());
+  if (parts.empty() || (parts[0] && !IsCell(parts[0])))
+    throw SyntaxError("syntax-rules expects a list of literals");
+  auto literals = ToVector(parts[0]);
+  for (auto literal : literals)
+    if (!IsName(literal))
+      throw SyntaxError("syntax-rules literals must be symbols");
+  std::vector<Object *> patterns, templates;
+  for (size_t ind = 1; ind < parts.size(); ++ind) {
+    auto rule = ToVector(parts[ind]);
+    if (rule.size() != 2 || !IsCell(rule[0]))
+      throw SyntaxError("bad syntax rule");
+    patterns.push_back(rule[0]);
+    templates.push_back(rule[1]);
+  }
+  return Create<Macro>(name->GetName(), std::move(literals),
+                       std::move(patterns), std::move(templates));
+}
+
+std::string_view Unrenamed(const std::string &name) {
+  return std::string_view(name).substr(0, name.find('%'));
+}
+
+Object *DefineSyntax(std::shared_ptr<Scope> &scope, ArgSpan args) {
+  SpecialForm::CheckArgs(args, Kind::Allow, 2);
+  if (!IsSymbol(args[0]))
+    throw SyntaxError("wrong macro name");
+  if (scope->parent_)
+    throw SyntaxError("define-syntax is only allowed at top level");
+  scope->Assign(AsSymbol(args[0]), SyntaxRules(AsSymbol(args[0]), args[1]));
+  return nullptr;
+}
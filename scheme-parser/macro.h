@@ -0,0 +1,62 @@
+#pragma once
+
+#include "gc.h"
+#include "parser.h"
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A `syntax-rules` macro. Uses are expanded by the resolver (resolver.h)
+// when the code around them is translated, so a use in a lambda body is
+// expanded once, however often the lambda runs.
+//
+// Expansion is hygienic by renaming: each symbol a template introduces is
+// renamed apart as `name%N`, with N fresh for every expansion, so binders
+// in the template cannot capture the variables of the use site. A renamed
+// symbol that nothing in the expansion binds stands for the variable or
+// special form of that name in the global scope, where macros are defined,
+// even if the use site shadows it. Parsed symbols never contain '%'.
+class Macro : public Object {
+public:
+  Macro(std::string name, std::vector<Object *> literals,
+        std::vector<Object *> patterns, std::vector<Object *> templates);
+
+  virtual void MarkRelated(GCMark mark = GCMark::Black) override;
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  void PrintTo(std::ostream *out) const override;
+  virtual void PrintDebug(std::ostream *out) const override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &scope) override;
+
+  // The expansion of the use `form` by the first rule whose pattern
+  // matches it. Every object created is locked in `lock`.
+  Object *Expand(Cell *form, GCManager::SafeLock *lock);
+
+  const std::string &GetName() const { return name_; }
+
+private:
+  std::string name_;
+  std::vector<Ref<Object>> literals_;
+  std::vector<Ref<Object>> patterns_;
+  std::vector<Ref<Object>> templates_;
+};
+
+// The macro `(syntax-rules (literal ...) (pattern template) ...)` describes.
+Macro *SyntaxRules(Symbol *name, Object *spec);
+
+// The name `name` had before it was renamed by an expansion.
+std::string_view Unrenamed(const std::string &name);
+
+inline bool IsRenamed(const std::string &name) {
+  return name.find('%') != std::string::npos;
+}
+
+Object *DefineSyntax(std::shared_ptr<Scope> &scope, ArgSpan args);
@@ -0,0 +1,189 @@
+#include "memo.h"
+#include "create.h"
+#include "gc.h"
+#include "lists.h"
+#include "parser.h"
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+size_t Combine(size_t seed, size_t hash) {
+  return seed ^ (hash + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+// Equal objects hash alike, and the hash does not depend on where objects
+// are, so entries stay put when the collector moves their keys.
+size_t Hash(const Object *obj) {
+  size_t hash = 0;
+  for (; IsCell(obj); obj = AsCell(obj)->GetSecond())
+    hash = Combine(hash, Hash(AsCell(obj)->GetFirst()));
+  if (!obj)
+    return Combine(hash, 0);
+  if (IsNumber(obj))
+    return Combine(hash, std::hash<int64_t>()(AsNumber(obj)->GetValue()));
+  if (IsString(obj))
+    return Combine(hash, std::hash<std::string>()(AsString(obj)->GetValue()));
+  if (IsSymbol(obj))
+    return Combine(hash, std::hash<std::string>()(AsSymbol(obj)->GetName()));
+  if (IsVector(obj)) {
+    for (size_t ind = 0; ind < AsVector(obj)->Size(); ++ind)
+      hash = Combine(hash, Hash(AsVector(obj)->Get(ind)));
+    return Combine(hash, AsVector(obj)->Size());
+  }
+  return Combine(hash, std::hash<std::string>()(obj->TypeName()));
+}
+
+MemoizedFunction *AsMemoized(Object *obj, const char *who) {
+  auto fn = Is<MemoizedFunction>(obj);
+  if (!fn)
+    throw RuntimeError(std::string(who) +
+                       ": argument must be a memoized function");
+  return fn;
+}
+
+} // namespace
+
+// Registered with the weak objects, which is how Compact finds the tables
+// it evicts.
+MemoizedFunction::MemoizedFunction(Function *fn)
+    : Function("memoized", nullptr), fn_(fn), slots_(8) {
+  GCManager::GetInstance().RegisterWeak(this);
+}
+
+MemoizedFunction::~MemoizedFunction() {
+  GCManager::GetInstance().UnregisterWeak(this);
+}
+
+Function *MemoizedFunction::GetFunction() const {
+  return static_cast<Function *>(static_cast<Object *>(fn_));
+}
+
+void MemoizedFunction::MarkRelated(GCMark mark) {
+  VisitReferences([mark](Object *&ref, RefKind) {
+    if (ref)
+      ref->Mark(mark);
+  });
+}
+
+void MemoizedFunction::VisitReferences(const ReferenceVisitor &visit) {
+  VisitRef(visit, fn_, RefKind::Strong);
+  for (auto &arg : args_)
+    VisitRef(visit, arg, RefKind::Strong);
+  for (auto &slot : slots_)
+    if (slot.used)
+      VisitRef(visit, slot.value, RefKind::Strong);
+}
+
+const char *MemoizedFunction::TypeName() const { return "memoized"; }
+
+size_t MemoizedFunction::AllocatedBytes() const {
+  return sizeof(MemoizedFunction) + OutOfLineBytes(name) +
+         OutOfLineBytes(slots_) + OutOfLineBytes(args_);
+}
+
+Object *MemoizedFunction::MoveTo(void *where) {
+  return new (where) MemoizedFunction(std::move(*this));
+}
+
+Object *MemoizedFunction::Apply(std::shared_ptr<Scope> &scope, ArgSpan args) {
+  auto hash = Hash(nullptr);
+  for (auto arg : args)
+    hash = Combine(hash, Hash(arg));
+  if (auto slot = Find(args, hash); slot->used) {
+    ++hits_;
+    return slot->value;
+  }
+  ++misses_;
+  // The call may add entries of its own, recursive calls included, so the
+  // slot is looked for again afterwards.
+  auto value = GetFunction()->Apply(scope, args);
+  Insert(args, hash, value);
+  return value;
+}
+
+MemoizedFunction::Slot *MemoizedFunction::Find(ArgSpan args, size_t hash) {
+  auto mask = slots_.size() - 1;
+  for (auto ind = hash & mask;; ind = (ind + 1) & mask) {
+    auto &slot = slots_[ind];
+    if (!slot.used)
+      return &slot;
+    if (slot.hash != hash || slot.count != args.size())
+      continue;
+    bool same = true;
+    for (size_t arg = 0; arg < args.size() && same; ++arg)
+      same = IsEqual(args_[slot.first + arg], args[arg]);
+    if (same)
+      return &slot;
+  }
+}
+
+void MemoizedFunction::Insert(ArgSpan args, size_t hash, Object *value) {
+  auto before = AllocatedBytes();
+  if (2 * (size_ + 1) > slots_.size())
+    Grow();
+  auto slot = Find(args, hash);
+  if (!slot->used) {
+    slot->used = true;
+    slot->hash = hash;
+    slot->first = static_cast<uint32_t>(args_.size());
+    slot->count = static_cast<uint32_t>(args.size());
+    args_.insert(args_.end(), args.begin(), args.end());
+    ++size_;
+  }
+  slot->value = value;
+  GCManager::GetInstance().AccountResize(before, AllocatedBytes());
+}
+
+void MemoizedFunction::Grow() {
+  std::vector<Slot> slots(slots_.size() * 2);
+  std::swap(slots, slots_);
+  auto mask = slots_.size() - 1;
+  for (const auto &slot : slots) {
+    if (!slot.used)
+      continue;
+    auto ind = slot.hash & mask;
+    while (slots_[ind].used)
+      ind = (ind + 1) & mask;
+    slots_[ind] = slot;
+  }
+}
+
+void MemoizedFunction::Evict() {
+  auto before = AllocatedBytes();
+  slots_.assign(8, Slot{});
+  slots_.shrink_to_fit();
+  args_.clear();
+  args_.shrink_to_fit();
+  size_ = 0;
+  GCManager::GetInstance().AccountResize(before, AllocatedBytes());
+}
+
+Object *Memoize(ArgSpan args) {
+  if (!IsFunction(args[0]))
+    throw RuntimeError("memoize: argument must be a function");
+  return Create<MemoizedFunction>(AsFunction(args[0]));
+}
+
+Object *MemoStats(ArgSpan args) {
+  auto fn = AsMemoized(args[0], "memo-stats");
+  std::pair<const char *, uint64_t> stats[] = {
+      {"hits", fn->Hits()}, {"misses", fn->Misses()}, {"entries", fn->Size()}};
+  GCManager::SafeLock lock;
+  Object *res = nullptr;
+  for (auto it = std::rbegin(stats); it != std::rend(stats); ++it) {
+    auto key = Create<Symbol>(it->first);
+    lock.Lock(key);
+    auto value = Create<Number>(static_cast<int64_t>(it->second));
+    lock.Lock(value);
+    auto entry = Create<Cell>(key, value);
+    lock.Lock(entry);
+    res = Create<Cell>(entry, res);
+    lock.Lock(res);
+  }
+  return res;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "parser.h"
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+// A function that remembers its results: `define-memoized` and `memoize`.
+// The results are kept in an open-addressing table keyed by the argument
+// tuple, hashed and compared structurally, as equal? does (IsEqual in
+// lists.h): numbers, strings and symbols by value, pairs and vectors
+// element by element and everything else by identity. The
+// arguments are kept as they are, not copied, so a pair changed after the
+// call no longer finds its result.
+//
+// The table holds its keys and results strongly, but the collector may
+// evict it: a compaction (GCManager::Compact) empties every table first, so
+// that results only the table keeps alive are freed with the rest.
+class MemoizedFunction : public Function {
+public:
+  explicit MemoizedFunction(Function *fn);
+  MemoizedFunction(MemoizedFunction &&) = default;
+  ~MemoizedFunction() override;
+
+  virtual void MarkRelated(GCMark mark = GCMark::Black) override;
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  // The remembered result for `args`, or that of calling the function,
+  // which is remembered unless the call throws.
+  Object *Apply(std::shared_ptr<Scope> &scope, ArgSpan args) override;
+
+  // Drops every entry.
+  void Evict();
+
+  Function *GetFunction() const;
+  uint64_t Hits() const { return hits_; }
+  uint64_t Misses() const { return misses_; }
+  size_t Size() const { return size_; }
+
+  // Fills its table as it is called.
+  virtual bool Freezable() const override { return false; }
+
+private:
+  // The arguments of an entry are `count` elements of args_ from `first`.
+  struct Slot {
+    size_t hash = 0;
+    uint32_t first = 0;
+    uint32_t count = 0;
+    bool used = false;
+    Ref<Object> value = nullptr;
+  };
+
+  // The slot of the entry for `args`, or the free slot where it goes.
+  Slot *Find(ArgSpan args, size_t hash);
+  void Insert(ArgSpan args, size_t hash, Object *value);
+  // Doubles the slots, which only keeps them at most half full.
+  void Grow();
+
+  Ref<Object> fn_;
+  std::vector<Slot> slots_;
+  std::vector<Ref<Object>> args_;
+  size_t size_ = 0;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+};
+
+// `(memoize fn)`: a memoized function that calls `fn`.
+Object *Memoize(ArgSpan args);
+
+// `(memo-stats fn)`: ((hits . n) (misses . n) (entries . n)).
+Object *MemoStats(ArgSpan args);
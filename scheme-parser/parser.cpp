@@ -1,7 +1,10 @@
 #include "parser.h"
 #include "create.h"
 #include "gc.h"
+#include "macro.h"
+#include "resolver.h"
 #include "tokenizer.h"
+#include <algorithm>
 #include <cstdint>
 #include <iostream>
 #include <memory>
@@ -12,11 +15,6 @@
 
 Scope::~Scope() { GCManager::GetInstance().RemoveRoot(this); }
 
-void Scope::Release() {
-  for (auto &[_, obj] : variables_)
-    obj->Unmark();
-}
-
 std::shared_ptr<Scope> Scope::Create() {
   std::shared_ptr<Scope> newScope = std::make_shared<Scope>();
   GCManager::GetInstance().AddRoot(newScope);
@@ -29,6 +27,15 @@ std::shared_ptr<Scope> Scope::Create(std::shared_ptr<Scope> &parent) {
   return newScope;
 }
 
+std::shared_ptr<Scope> Scope::Create(const std::shared_ptr<Scope> &parent,
+                                     size_t slots) {
+  auto newScope = std::make_shared<Scope>();
+  newScope->parent_ = parent;
+  newScope->slots_.resize(slots);
+  GCManager::GetInstance().AddRoot(newScope);
+  return newScope;
+}
+
 std::pair<Object *, std::shared_ptr<Scope>>
 Scope::Lookup(const std::string &name) {
   auto it = variables_.find(name);
@@ -42,35 +49,96 @@ Scope::Lookup(const std::string &name) {
 }
 
 Object *&Scope::operator[](Symbol *symbol) {
-  return variables_[symbol->GetName()];
+  auto it = variables_.find(symbol->GetName());
+  if (it != variables_.end())
+    return it->second;
+
+  auto before = AllocatedBytes();
+  auto &slot = variables_[symbol->GetName()];
+  GCManager::GetInstance().AccountResize(before, AllocatedBytes());
+  return slot;
+}
+
+void Scope::Assign(Symbol *symbol, Object *value) {
+  (*this)[symbol] = value;
+  ++version_;
+}
+
+size_t Scope::AllocatedBytes() const {
+  size_t bytes =
+      sizeof(Scope) + OutOfLineBytes(variables_) + OutOfLineBytes(slots_);
+  for (const auto &[name, _] : variables_)
+    bytes += OutOfLineBytes(name);
+  return bytes;
+}
+
+Object::Object() {
+  if (auto mark = MarkByte(); mark)
+    *mark = static_cast<uint8_t>(GCMark::Black);
+}
+
+Object::Object(const Object &other) {
+  auto source = other.MarkByte();
+  if (auto mark = MarkByte(); mark)
+    *mark = source ? *source : static_cast<uint8_t>(GCMark::Black);
 }
 
 Object::~Object() {}
 
+void *Object::operator new(size_t size) {
+  return GCManager::GetInstance().GetHeap()->Allocate(size);
+}
+
+void Object::operator delete(void *ptr) {
+  GCManager::GetInstance().GetHeap()->Free(ptr);
+}
+
+uint8_t *Object::MarkByte() const {
+  auto heap = Heap::Current();
+  return heap ? heap->MarkOf(this) : nullptr;
+}
+
 void Object::Mark(GCMark mark) {
-  if (marked_ < mark) {
-    marked_ = mark;
+  auto marked = MarkByte();
+  if (marked && *marked < static_cast<uint8_t>(mark)) {
+    *marked = static_cast<uint8_t>(mark);
     MarkRelated(mark);
   }
 }
 
 void Object::Unmark(GCMark mark) {
-  if (!(mark < marked_)) {
-    marked_ = GCMark::White;
-  }
+  auto marked = MarkByte();
+  if (marked && !(static_cast<uint8_t>(mark) < *marked))
+    *marked = static_cast<uint8_t>(GCMark::White);
 }
 
 void Object::MarkRelated(GCMark mark) {}
 void Object::UnmarkRelated(GCMark mark) {}
+void Object::VisitReferences(const ReferenceVisitor &) {}
 
-bool Object::isMarked() const { return marked_ != GCMark::White; }
+bool Object::isMarked() const {
+  auto marked = MarkByte();
+  return !marked || *marked != static_cast<uint8_t>(GCMark::White);
+}
 
 Types Object::ID() const { return Types::tType; }
 
+const char *Object::TypeName() const { return "object"; }
+
 bool Object::IsFalse() const { return false; }
 
+bool Object::Freezable() const { return true; }
+
 Types BuiltInObject::ID() const { throw RuntimeError("Not a builtin type!"); }
 
+const char *BuiltInObject::TypeName() const { return "builtin"; }
+
+size_t BuiltInObject::AllocatedBytes() const { return sizeof(BuiltInObject); }
+
+Object *BuiltInObject::MoveTo(void *where) {
+  return new (where) BuiltInObject(std::move(*this));
+}
+
 void BuiltInObject::PrintTo(std::ostream *) const {
   throw RuntimeError("Cannot print builtin object!");
 }
@@ -81,54 +149,38 @@ Object *BuiltInObject::Eval(std::shared_ptr<Scope> &) {
   throw RuntimeError("Cannot eval builtin object!");
 }
 
-template <typename... Sizes>
-void SpecialForm::CheckArgs(const std::vector<Object *> &args, Kind kind,
-                            Sizes... sizes) {
-  std::vector<size_t> allowedSizes = {static_cast<unsigned long>(sizes)...};
-  if (kind == Kind::Allow && std::find(allowedSizes.begin(), allowedSizes.end(),
-                                       args.size()) == allowedSizes.end()) {
-    throw SyntaxError("Wrong number of arguments!");
-  }
-  if (kind == Kind::Disallow &&
-      std::find(allowedSizes.begin(), allowedSizes.end(), args.size()) !=
-          allowedSizes.end()) {
-    throw SyntaxError("Wrong number of arguments!");
-  }
-  return;
-}
-
-template <typename... Sizes>
-void Function::CheckArgs(const std::vector<Object *> &args, Kind kind,
-                         Sizes... sizes) {
-  std::vector<size_t> allowedSizes = {static_cast<unsigned long>(sizes)...};
-  if (kind == Kind::Allow && std::find(allowedSizes.begin(), allowedSizes.end(),
-                                       args.size()) == allowedSizes.end()) {
-    throw RuntimeError("Wrong number of arguments!");
-  }
-  if (kind == Kind::Disallow &&
-      std::find(allowedSizes.begin(), allowedSizes.end(), args.size()) !=
-          allowedSizes.end()) {
-    throw RuntimeError("Wrong number of arguments!");
-  }
-  return;
-}
-
 SpecialForm::SpecialForm(const std::string &&name, ApplyMethod &&apply_method)
     : name(name), apply_method(apply_method) {}
 
-Function::Function(const std::string &&name, ApplyMethod &&apply_method)
-    : name(name), apply_method(apply_method) {}
+Function::Function(const std::string &&name, ApplyMethod &&apply_method,
+                   Signature signature)
+    : name(name), apply_method(apply_method), signature(signature) {}
 
-Object *SpecialForm::Apply(std::shared_ptr<Scope> &scope,
-                           const std::vector<Object *> &args) {
+Object *SpecialForm::Apply(std::shared_ptr<Scope> &scope, ArgSpan args) {
   return (this->apply_method)(scope, args);
 }
 
-Object *Function::Apply(std::shared_ptr<Scope> &,
-                        const std::vector<Object *> &args) {
+Object *Function::Apply(std::shared_ptr<Scope> &, ArgSpan args) {
+  CheckSignature(args);
   return (this->apply_method)(args);
 }
 
+void Function::CheckSignature(ArgSpan args) const {
+  if (args.size() < signature.min || args.size() > signature.max)
+    throw RuntimeError("Wrong number of arguments!");
+  if (signature.type == Signature::Type::Number)
+    for (auto arg : args)
+      if (!IsNumber(arg))
+        throw RuntimeError(name + " arguments must be numbers");
+}
+
+// Lambdas are resolved against the global scope, the outermost one.
+static Scope *GlobalScope(Scope *scope) {
+  while (scope->parent_)
+    scope = scope->parent_.get();
+  return scope;
+}
+
 Cell::Cell() : head_(nullptr), tail_(nullptr) {}
 
 Cell::Cell(Object *head, Object *tail) : head_(head), tail_(tail) {}
@@ -147,8 +199,21 @@ void Cell::UnmarkRelated(GCMark mark) {
     tail_->Unmark(mark);
 }
 
+void Cell::VisitReferences(const ReferenceVisitor &visit) {
+  VisitRef(visit, head_, RefKind::Strong);
+  VisitRef(visit, tail_, RefKind::Strong);
+}
+
 Types Cell::ID() const { return Types::cellType; }
 
+const char *Cell::TypeName() const { return "cell"; }
+
+size_t Cell::AllocatedBytes() const { return sizeof(Cell); }
+
+Object *Cell::MoveTo(void *where) {
+  return new (where) Cell(std::move(*this));
+}
+
 void Cell::PrintTo(std::ostream *out) const {
   *out << '(';
   ::PrintTo(head_, out);
@@ -178,33 +243,60 @@ void Cell::PrintDebug(std::ostream *out) const {
 }
 
 Object *Cell::Eval(std::shared_ptr<Scope> &scope) {
-  auto lock = GCManager::SafeLock(this);
   if (head_ == nullptr)
     throw RuntimeError("First element of the list is not a function");
 
+  size_t argc = 0;
+  for (auto arg = AsCell(tail_); arg; arg = AsCell(arg->GetSecond())) {
+    if (arg->GetSecond() && !IsCell(arg->GetSecond()))
+      throw std::runtime_error("wrong argument list");
+    ++argc;
+  }
+  // The form, the function and the arguments stay rooted on the arena
+  // until the call returns.
+  FrameArena::Args slots(FrameArena::Current(), argc + 2);
+  slots[0] = this;
+
   auto ptr = head_->Eval(scope);
+  // A macro use is translated as the body of a lambda would be, which
+  // expands it.
+  if (Is<Macro>(ptr)) {
+    Resolver resolver(GlobalScope(scope.get()));
+    return resolver.ResolveTopLevel(this)->Run(scope);
+  }
   auto fn = AsFunction(ptr);
   auto sf = dynamic_cast<SpecialForm *>(ptr);
   if (!fn && !sf)
     throw RuntimeError("First element of the list must be a function");
+  slots[1] = ptr;
 
-  std::vector<Object *> args = ToVector(tail_);
-  if (fn)
-    for (auto &arg : args) {
-      arg = arg->Eval(scope);
-      lock.Lock(arg);
-    }
+  size_t ind = 2;
+  for (auto arg = AsCell(tail_); arg; arg = AsCell(arg->GetSecond()))
+    slots[ind++] = fn ? arg->GetFirst()->Eval(scope) : arg->GetFirst();
 
+  auto args = slots.Span(2);
   return fn ? fn->Apply(scope, args) : sf->Apply(scope, args);
 }
 
 Object *Cell::GetFirst() const { return head_; }
 
-void Cell::SetFirst(Object *object) { head_ = object; }
+void Cell::SetFirst(Object *object) {
+  CheckMutable();
+  head_ = object;
+}
 
 Object *Cell::GetSecond() const { return tail_; }
 
-void Cell::SetSecond(Object *object) { tail_ = object; }
+void Cell::SetSecond(Object *object) {
+  CheckMutable();
+  tail_ = object;
+}
+
+void Cell::CheckMutable() const {
+  auto heap = Heap::Current();
+  if (heap && heap->IsFrozen(this))
+    throw RuntimeError("Cannot modify a frozen pair");
+}
 
 Number::Number() : value_(0) {}
 
@@ -212,6 +304,14 @@ Number::Number(int64_t value) : value_(value) {}
 
 Types Number::ID() const { return Types::numberType; }
 
+const char *Number::TypeName() const { return "number"; }
+
+size_t Number::AllocatedBytes() const { return sizeof(Number); }
+
+Object *Number::MoveTo(void *where) {
+  return new (where) Number(std::move(*this));
+}
+
 void Number::PrintTo(std::ostream *out) const { *out << value_; }
 void Number::PrintDebug(std::ostream *out) const {
   PrintTo(out);
@@ -224,16 +324,22 @@ int64_t Number::GetValue() const { return value_; }
 
 int64_t &Number::SetValue() { return value_; }
 
-std::unordered_map<int64_t, Number *> *Number::GetConstantRegistry() {
-  return GCManager::GetInstance().GetNumReg();
-}
-
 Symbol::Symbol() : name_("") {}
 
 Symbol::Symbol(std::string name) : name_(name) {}
 
 Types Symbol::ID() const { return Types::symbolType; }
 
+const char *Symbol::TypeName() const { return "symbol"; }
+
+size_t Symbol::AllocatedBytes() const {
+  return sizeof(Symbol) + OutOfLineBytes(name_);
+}
+
+Object *Symbol::MoveTo(void *where) {
+  return new (where) Symbol(std::move(*this));
+}
+
 void Symbol::PrintTo(std::ostream *out) const { *out << name_; }
 void Symbol::PrintDebug(std::ostream *out) const {
   PrintTo(out);
@@ -252,7 +358,7 @@ std::unordered_map<std::string_view, Symbol *> *Symbol::GetConstantRegistry() {
   return GCManager::GetInstance().GetSymReg();
 }
 
-Object *Quote(std::shared_ptr<Scope> &, const std::vector<Object *> &args) {
+Object *Quote(std::shared_ptr<Scope> &, ArgSpan args) {
   SpecialForm::CheckArgs(args, Kind::Allow, 1);
   return args[0];
 }
@@ -265,6 +371,16 @@ Object *Boolean::Eval(std::shared_ptr<Scope> &) { return this; }
 
 bool Boolean::IsFalse() const { return this->GetName() == "#f"; }
 
+const char *Boolean::TypeName() const { return "boolean"; }
+
+size_t Boolean::AllocatedBytes() const {
+  return sizeof(Boolean) + OutOfLineBytes(name_);
+}
+
+Object *Boolean::MoveTo(void *where) {
+  return new (where) Boolean(std::move(*this));
+}
+
 void Function::PrintTo(std::ostream *) const {
   throw RuntimeError("can't print function");
 }
@@ -283,64 +399,160 @@ void SpecialForm::PrintDebug(std::ostream *out) const {
 
 Object *Function::Eval(std::shared_ptr<Scope> &) { return this; }
 
+const char *Function::TypeName() const { return "function"; }
+
+size_t Function::AllocatedBytes() const {
+  return sizeof(Function) + OutOfLineBytes(name);
+}
+
+Object *Function::MoveTo(void *where) {
+  return new (where) Function(std::move(*this));
+}
+
 Object *SpecialForm::Eval(std::shared_ptr<Scope> &) {
   throw RuntimeError("can't eval function");
 }
 
-Object *Plus(const std::vector<Object *> &args) {
-  int64_t value = 0;
-  for (const auto &arg : args) {
-    auto number = dynamic_cast<Number *>(arg);
-    if (!number)
-      throw RuntimeError("+ arguments must be numbers");
+const char *SpecialForm::TypeName() const { return "special-form"; }
+
+size_t SpecialForm::AllocatedBytes() const {
+  return sizeof(SpecialForm) + OutOfLineBytes(name);
+}
+
+Object *SpecialForm::MoveTo(void *where) {
+  return new (where) SpecialForm(std::move(*this));
+}
+
+String::String(std::string value) : value_(std::move(value)) {}
+
+Types String::ID() const { return Types::stringType; }
+
+const char *String::TypeName() const { return "string"; }
+
+size_t String::AllocatedBytes() const {
+  return sizeof(String) + OutOfLineBytes(value_);
+}
+
+Object *String::MoveTo(void *where) {
+  return new (where) String(std::move(*this));
+}
+
+void String::PrintTo(std::ostream *out) const {
+  *out << '"';
+  for (auto c : value_) {
+    if (c == '"' || c == '\\')
+      *out << '\\' << c;
+    else if (c == '\n')
+      *out << "\\n";
+    else
+      *out << c;
+  }
+  *out << '"';
+}
+
+void String::PrintDebug(std::ostream *out) const {
+  PrintTo(out);
+  *out << std::endl;
+}
+
+Object *String::Eval(std::shared_ptr<Scope> &) { return this; }
+
+const std::string &String::GetValue() const { return value_; }
+
+Vector::Vector(size_t size, Object *fill) : elements_(size, fill) {}
+
+void Vector::MarkRelated(GCMark mark) {
+  for (Object *element : elements_)
+    if (element)
+      element->Mark(mark);
+}
+
+void Vector::UnmarkRelated(GCMark mark) {
+  for (Object *element : elements_)
+    if (element)
+      element->Unmark(mark);
+}
 
-    value += number->GetValue();
+void Vector::VisitReferences(const ReferenceVisitor &visit) {
+  for (auto &element : elements_)
+    VisitRef(visit, element, RefKind::Strong);
+}
+
+Types Vector::ID() const { return Types::vectorType; }
+
+const char *Vector::TypeName() const { return "vector"; }
+
+size_t Vector::AllocatedBytes() const {
+  return sizeof(Vector) + OutOfLineBytes(elements_);
+}
+
+Object *Vector::MoveTo(void *where) {
+  return new (where) Vector(std::move(*this));
+}
+
+void Vector::PrintTo(std::ostream *out) const {
+  *out << "#(";
+  for (size_t ind = 0; ind < elements_.size(); ++ind) {
+    if (ind)
+      *out << ' ';
+    ::PrintTo(elements_[ind], out);
   }
+  *out << ')';
+}
+
+void Vector::PrintDebug(std::ostream *out) const {
+  PrintTo(out);
+  *out << std::endl;
+}
+
+Object *Vector::Eval(std::shared_ptr<Scope> &) { return this; }
+
+void Vector::Set(size_t index, Object *object) {
+  CheckMutable();
+  elements_[index] = object;
+}
+
+void Vector::CheckMutable() const {
+  auto heap = Heap::Current();
+  if (heap && heap->IsFrozen(this))
+    throw RuntimeError("Cannot modify a frozen vector");
+}
+
+Object *Plus(ArgSpan args) {
+  int64_t value = 0;
+  for (const auto &arg : args)
+    value += AsNumber(arg)->GetValue();
   return Create<Number>(value);
 }
 
-Object *Minus(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Disallow, 0);
-  int64_t value = dynamic_cast<Number *>(args[0])->GetValue();
+Object *Minus(ArgSpan args) {
+  int64_t value = AsNumber(args[0])->GetValue();
   if (!value)
     throw RuntimeError("- arguments must be numbers");
 
-  for (size_t i = 1; i < args.size(); ++i) {
-    auto number = dynamic_cast<Number *>(args[i]);
-    if (!number)
-      throw RuntimeError("- arguments must be numbers");
-    value -= number->GetValue();
-  }
+  for (size_t i = 1; i < args.size(); ++i)
+    value -= AsNumber(args[i])->GetValue();
   return Create<Number>(value);
 }
 
-Object *Divide(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Disallow, 0);
-  int64_t value = dynamic_cast<Number *>(args[0])->GetValue();
+Object *Divide(ArgSpan args) {
+  int64_t value = AsNumber(args[0])->GetValue();
   if (!value)
     throw RuntimeError("/ arguments must be numbers");
 
-  for (size_t i = 1; i < args.size(); ++i) {
-    auto number = dynamic_cast<Number *>(args[i]);
-    if (!number)
-      throw RuntimeError("/ arguments must be numbers");
-    value /= number->GetValue();
-  }
+  for (size_t i = 1; i < args.size(); ++i)
+    value /= AsNumber(args[i])->GetValue();
   return Create<Number>(value);
 }
 
-Object *Multiply(const std::vector<Object *> &args) {
+Object *Multiply(ArgSpan args) {
   int64_t value = 1;
-  for (const auto &arg : args) {
-    auto number = dynamic_cast<Number *>(arg);
-    if (!number)
-      throw RuntimeError("* arguments must be numbers");
-    value *= number->GetValue();
-  }
+  for (const auto &arg : args)
+    value *= AsNumber(arg)->GetValue();
   return Create<Number>(value);
 }
 
-Object *If(std::shared_ptr<Scope> &scope, const std::vector<Object *> &args) {
+Object *If(std::shared_ptr<Scope> &scope, ArgSpan args) {
   SpecialForm::CheckArgs(args, Kind::Allow, 2, 3);
 
   auto result = args[0]->Eval(scope);
@@ -350,35 +562,29 @@ Object *If(std::shared_ptr<Scope> &scope, const std::vector<Object *> &args) {
     return args.size() == 2 ? nullptr : args[2]->Eval(scope);
 }
 
-Object *CheckNull(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 1);
+Object *CheckNull(ArgSpan args) {
   return Create<Boolean>(args[0] == nullptr);
 }
 
-Object *CheckPair(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 1);
+Object *CheckPair(ArgSpan args) {
   return Create<Boolean>(IsCell(args[0]));
 }
 
-Object *CheckNumber(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 1);
+Object *CheckNumber(ArgSpan args) {
   return Create<Boolean>(IsNumber(args[0]));
 }
 
-Object *CheckBoolean(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 1);
+Object *CheckBoolean(ArgSpan args) {
   return Create<Boolean>(IsSymbol(args[0]) &&
                          (AsSymbol(args[0])->GetName() == "#f" ||
                           AsSymbol(args[0])->GetName() == "#t"));
 }
 
-Object *CheckSymbol(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 1);
+Object *CheckSymbol(ArgSpan args) {
   return Create<Boolean>(IsSymbol(args[0]));
 }
 
-Object *CheckList(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 1);
+Object *CheckList(ArgSpan args) {
   for (auto checker = args[0]; checker;
        checker = AsCell(checker)->GetSecond()) {
     if (!IsCell(checker))
@@ -387,115 +593,73 @@ Object *CheckList(const std::vector<Object *> &args) {
   return Create<Boolean>(true);
 }
 
+Object *CheckString(ArgSpan args) {
+  return Create<Boolean>(IsString(args[0]));
+}
+
 // FIXME
-Object *Eq(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Disallow, 0);
+Object *Eq(ArgSpan args) {
   return Create<Boolean>(args[0] == nullptr);
 }
 
 // FIXME
-Object *Equal(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Disallow, 0);
+Object *Equal(ArgSpan args) {
   return Create<Boolean>(args[0] == nullptr);
 }
 
-Object *IntegerEqual(const std::vector<Object *> &args) {
-  if (args.size() == 0)
-    return Create<Boolean>(true);
-
-  if (!IsNumber(args[0]))
-    throw RuntimeError("Syntax error!");
-
-  int64_t value = AsNumber(args[0])->GetValue();
-  for (const auto &obj : args) {
-    if (!IsNumber(obj))
-      throw RuntimeError("Syntax error!");
-
-    if (value != AsNumber(obj)->GetValue())
+Object *IntegerEqual(ArgSpan args) {
+  for (const auto &obj : args)
+    if (AsNumber(args[0])->GetValue() != AsNumber(obj)->GetValue())
       return Create<Boolean>(false);
-  }
   return Create<Boolean>(true);
 }
 
-Object *Not(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 1);
-
+Object *Not(ArgSpan args) {
   return Create<Boolean>(args[0] == nullptr ? false : args[0]->IsFalse());
 }
 
-Object *Equality(const std::vector<Object *> &args) {
-  if (args.size() == 0)
-    return Create<Boolean>(true);
-
-  if (!IsNumber(args[0]))
-    throw RuntimeError("Syntax error!");
-
-  int64_t value = AsNumber(args[0])->GetValue();
-  for (const auto &obj : args) {
-    if (!IsNumber(obj))
-      throw RuntimeError("Syntax error!");
-
-    if (value != AsNumber(obj)->GetValue())
+Object *Equality(ArgSpan args) {
+  for (const auto &obj : args)
+    if (AsNumber(args[0])->GetValue() != AsNumber(obj)->GetValue())
       return Create<Boolean>(false);
-  }
   return Create<Boolean>(true);
 }
 
-Object *More(const std::vector<Object *> &args) {
+Object *More(ArgSpan args) {
   for (size_t i = 1; i < args.size(); ++i) {
-    if (!IsNumber(args[i]) || !IsNumber(args[i - 1]))
-      throw RuntimeError("Syntax error!");
-
     if (AsNumber(args[i - 1])->GetValue() <= AsNumber(args[i])->GetValue())
       return Create<Boolean>(false);
   }
   return Create<Boolean>(true);
 }
 
-Object *Less(const std::vector<Object *> &args) {
+Object *Less(ArgSpan args) {
   for (size_t i = 1; i < args.size(); ++i) {
-    if (!IsNumber(args[i]) || !IsNumber(args[i - 1]))
-      throw RuntimeError("Syntax error!");
-
     if (AsNumber(args[i - 1])->GetValue() >= AsNumber(args[i])->GetValue())
       return Create<Boolean>(false);
   }
   return Create<Boolean>(true);
 }
 
-Object *MoreOrEqual(const std::vector<Object *> &args) {
+Object *MoreOrEqual(ArgSpan args) {
   for (size_t i = 1; i < args.size(); ++i) {
-    if (!IsNumber(args[i]) || !IsNumber(args[i - 1]))
-      throw RuntimeError("Syntax error!");
-
     if (AsNumber(args[i - 1])->GetValue() < AsNumber(args[i])->GetValue())
       return Create<Boolean>(false);
   }
   return Create<Boolean>(true);
 }
 
-Object *LessOrEqual(const std::vector<Object *> &args) {
+Object *LessOrEqual(ArgSpan args) {
   for (size_t i = 1; i < args.size(); ++i) {
-    if (!IsNumber(args[i]) || !IsNumber(args[i - 1]))
-      throw RuntimeError("Syntax error!");
-
     if (AsNumber(args[i - 1])->GetValue() > AsNumber(args[i])->GetValue())
       return Create<Boolean>(false);
   }
   return Create<Boolean>(true);
 }
 
-Object *Min(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Disallow, 0);
-
-  if (!IsNumber(args[0]))
-    throw RuntimeError("Syntax error!");
-
+Object *Min(ArgSpan args) {
   int64_t value = AsNumber(args[0])->GetValue();
   for (const auto &obj : args) {
-    if (!IsNumber(obj))
-      throw RuntimeError("Syntax error!");
-
     int64_t current = AsNumber(obj)->GetValue();
     if (value > current)
       value = current;
@@ -503,17 +667,9 @@ Object *Min(const std::vector<Object *> &args) {
   return Create<Number>(value);
 }
 
-Object *Max(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Disallow, 0);
-
-  if (!IsNumber(args[0]))
-    throw RuntimeError("Syntax error!");
-
+Object *Max(ArgSpan args) {
   int64_t value = AsNumber(args[0])->GetValue();
   for (const auto &obj : args) {
-    if (!IsNumber(obj))
-      throw RuntimeError("Syntax error!");
-
     int64_t current = AsNumber(obj)->GetValue();
     if (value < current)
       value = current;
@@ -521,42 +677,29 @@ Object *Max(const std::vector<Object *> &args) {
   return Create<Number>(value);
 }
 
-Object *Abs(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 1);
-
-  if (!IsNumber(args[0]))
-    throw RuntimeError("Syntax error!");
-
+Object *Abs(ArgSpan args) {
   return Create<Number>(std::abs(AsNumber(args[0])->GetValue()));
 }
 
-Object *Cons(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 2);
-
+Object *Cons(ArgSpan args) {
   return Create<Cell>(args[0], args[1]);
 }
 
-Object *Car(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 1);
-
+Object *Car(ArgSpan args) {
   if (!IsCell(args[0]))
     throw RuntimeError("Syntax error!");
 
   return AsCell(args[0])->GetFirst();
 }
 
-Object *Cdr(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 1);
-
+Object *Cdr(ArgSpan args) {
   if (!IsCell(args[0]))
     throw RuntimeError("Syntax error!");
 
   return AsCell(args[0])->GetSecond();
 }
 
-Object *SetCar(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 2);
-
+Object *SetCar(ArgSpan args) {
   if (!IsCell(args[0]))
     throw RuntimeError("Syntax error!");
 
@@ -564,9 +707,7 @@ Object *SetCar(const std::vector<Object *> &args) {
   return args[0];
 }
 
-Object *SetCdr(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 2);
-
+Object *SetCdr(ArgSpan args) {
   if (!IsCell(args[0]))
     throw RuntimeError("Syntax error!");
 
@@ -574,7 +715,7 @@ Object *SetCdr(const std::vector<Object *> &args) {
   return args[0];
 }
 
-Object *List(const std::vector<Object *> &args) {
+Object *List(ArgSpan args) {
   if (args.size() == 0)
     return nullptr;
 
@@ -590,9 +731,7 @@ Object *List(const std::vector<Object *> &args) {
   return res;
 }
 
-Object *ListRef(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 2);
-
+Object *ListRef(ArgSpan args) {
   if (!IsCell(args[0]) && !IsNumber(args[1]))
     throw RuntimeError("Arguments must be list and a number");
 
@@ -610,9 +749,7 @@ Object *ListRef(const std::vector<Object *> &args) {
   return AsCell(scope)->GetFirst();
 }
 
-Object *ListTail(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 2);
-
+Object *ListTail(ArgSpan args) {
   if (!IsCell(args[0]) && !IsNumber(args[1]))
     throw RuntimeError("Syntax error!");
 
@@ -632,35 +769,7 @@ Object *ListTail(const std::vector<Object *> &args) {
   return AsCell(scope);
 }
 
-Object *Map(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 2);
-
-  if (!IsCell(args[1]) || !IsFunction(args[0]))
-    throw RuntimeError("Syntax error!");
-
-  auto new_cell = Create<Cell>();
-  auto res = new_cell;
-  auto lock = GCManager::SafeLock(res);
-  auto source = AsCell(args[1]);
-  auto fn = AsFunction(args[0]);
-  while (true) {
-    if (source->GetSecond() && !IsCell(source->GetSecond()))
-      throw RuntimeError("Syntax error!");
-    std::shared_ptr<Scope> nullscope = nullptr;
-    auto result = fn->Apply(nullscope, {source->GetFirst()});
-    new_cell->SetFirst(result);
-    if (source->GetSecond()) {
-      source = AsCell(source->GetSecond());
-      new_cell->SetSecond(Create<Cell>());
-      new_cell = AsCell(new_cell->GetSecond());
-    } else {
-      break;
-    }
-  }
-  return res;
-}
-
-Object *And(std::shared_ptr<Scope> &scope, const std::vector<Object *> &args) {
+Object *And(std::shared_ptr<Scope> &scope, ArgSpan args) {
   for (size_t ind = 0; ind < args.size(); ++ind) {
     auto res = args[ind]->Eval(scope);
     if (res->IsFalse())
@@ -671,7 +780,7 @@ Object *And(std::shared_ptr<Scope> &scope, const std::vector<Object *> &args) {
   return Create<Boolean>(true);
 }
 
-Object *Or(std::shared_ptr<Scope> &scope, const std::vector<Object *> &args) {
+Object *Or(std::shared_ptr<Scope> &scope, ArgSpan args) {
   for (size_t ind = 0; ind < args.size(); ++ind) {
     auto res = args[ind]->Eval(scope);
     if (!res->IsFalse())
@@ -680,90 +789,312 @@ Object *Or(std::shared_ptr<Scope> &scope, const std::vector<Object *> &args) {
   return Create<Boolean>(false);
 }
 
-Object *Define(std::shared_ptr<Scope> &scope,
-               const std::vector<Object *> &args) {
+Object *Define(std::shared_ptr<Scope> &scope, ArgSpan args) {
   if (IsSymbol(args[0])) {
     SpecialForm::CheckArgs(args, Kind::Allow, 2);
 
-    (*scope)[AsSymbol(args[0])] = args[1]->Eval(scope);
+    scope->Assign(AsSymbol(args[0]), args[1]->Eval(scope));
   } else if (IsCell(args[0])) {
-    auto lambda_args = ToVector(AsCell(args[0])->GetSecond());
-    for (const auto &arg : lambda_args)
-      if (!IsSymbol(arg))
-        throw SyntaxError("wrong argument name");
-
-    (*scope)[AsSymbol(AsCell(args[0])->GetFirst())] = Create<LambdaFunction>(
-        scope, std::move(lambda_args),
+    if (!IsSymbol(AsCell(args[0])->GetFirst()))
+      throw SyntaxError("wrong function name");
+    Resolver resolver(GlobalScope(scope.get()));
+    auto code = resolver.ResolveLambda(
+        AsCell(args[0])->GetSecond(),
         std::span<Object *const>(args.begin() + 1, args.end()));
+    scope->Assign(AsSymbol(AsCell(args[0])->GetFirst()),
+                  Create<LambdaFunction>(scope, code));
   }
   return nullptr;
 }
 
-Object *Set(std::shared_ptr<Scope> &scope, const std::vector<Object *> &args) {
+Object *Set(std::shared_ptr<Scope> &scope, ArgSpan args) {
   SpecialForm::CheckArgs(args, Kind::Allow, 2);
 
   if (IsSymbol(args[0])) {
     auto [_, actual_scope] = scope->Lookup(
         AsSymbol(args[0])->GetName()); // For the sake of error checking
-    (*actual_scope)[AsSymbol(args[0])] = args[1]->Eval(scope);
+    actual_scope->Assign(AsSymbol(args[0]), args[1]->Eval(scope));
   } else {
     throw RuntimeError("Trying to set something that is not a variable");
   }
   return nullptr;
 }
 
-Object *Lambda(std::shared_ptr<Scope> &scope,
-               const std::vector<Object *> &args) {
+Object *Lambda(std::shared_ptr<Scope> &scope, ArgSpan args) {
   SpecialForm::CheckArgs(args, Kind::Disallow, 1, 0);
 
-  if (!IsCell(args[0]) && args[0])
-    throw SyntaxError("Bad argument list!");
-  auto lambda_args = ToVector(args[0]);
-  for (const auto &arg : lambda_args)
-    if (!IsSymbol(arg))
-      throw SyntaxError("wrong argument name");
+  Resolver resolver(GlobalScope(scope.get()));
+  auto code = resolver.ResolveLambda(
+      args[0], std::span<Object *const>(args.begin() + 1, args.end()));
+  return Create<LambdaFunction>(scope, code);
+}
+
+// The binding forms have no rules of their own here: the form is
+// translated and run as the resolver makes it.
+static Object *RunResolved(std::shared_ptr<Scope> &scope, const char *name,
+                           ArgSpan args) {
+  GCManager::SafeLock lock;
+  Object *form = nullptr;
+  for (auto it = args.rbegin(); it != args.rend(); ++it) {
+    form = Create<Cell>(*it, form);
+    lock.Lock(form);
+  }
+  auto head = Create<Symbol>(name);
+  lock.Lock(head);
+  form = Create<Cell>(head, form);
+  lock.Lock(form);
+  Resolver resolver(GlobalScope(scope.get()));
+  return resolver.ResolveTopLevel(form)->Run(scope);
+}
+
+Object *Let(std::shared_ptr<Scope> &scope, ArgSpan args) {
+  return RunResolved(scope, "let", args);
+}
+
+Object *LetStar(std::shared_ptr<Scope> &scope, ArgSpan args) {
+  return RunResolved(scope, "let*", args);
+}
+
+Object *Letrec(std::shared_ptr<Scope> &scope, ArgSpan args) {
+  return RunResolved(scope, "letrec", args);
+}
+
+Object *Do(std::shared_ptr<Scope> &scope, ArgSpan args) {
+  return RunResolved(scope, "do", args);
+}
+
+Object *DefineMemoized(std::shared_ptr<Scope> &scope, ArgSpan args) {
+  return RunResolved(scope, "define-memoized", args);
+}
+
+LambdaFunction::LambdaFunction(std::shared_ptr<Scope> scope, LambdaForm *code)
+    : Function("", nullptr), current_scope_(std::move(scope)), code_(code) {}
+
+LambdaForm *LambdaFunction::GetCode() const {
+  return static_cast<LambdaForm *>(static_cast<Object *>(code_));
+}
 
-  auto fn = Create<LambdaFunction>(
-      Scope::Create(scope), std::move(lambda_args),
-      std::span<Object *const>(args.begin() + 1, args.end()));
+const char *LambdaFunction::TypeName() const { return "lambda"; }
 
-  return fn;
+size_t LambdaFunction::AllocatedBytes() const {
+  return sizeof(LambdaFunction) + OutOfLineBytes(name);
 }
 
-void LambdaFunction::Release() { current_scope_->Release(); }
+Object *LambdaFunction::MoveTo(void *where) {
+  return new (where) LambdaFunction(std::move(*this));
+}
 
 void LambdaFunction::MarkRelated(GCMark mark) {
-  for (auto &arg : args_)
-    arg->Mark(mark);
-  for (auto &body : body_)
-    body->Mark(mark);
+  GetCode()->Mark(mark);
+  for (auto frame = current_scope_.get(); frame; frame = frame->parent_.get())
+    for (auto obj : frame->slots_)
+      if (obj)
+        obj->Mark(mark);
+}
+
+void LambdaFunction::VisitReferences(const ReferenceVisitor &visit) {
+  VisitRef(visit, code_, RefKind::Strong);
+  for (auto frame = current_scope_.get(); frame; frame = frame->parent_.get())
+    for (auto &obj : frame->slots_)
+      visit(obj, RefKind::Strong);
+}
+
+Object *LambdaFunction::Apply(std::shared_ptr<Scope> &, ArgSpan args) {
+  // One arena frame serves the whole chain of tail calls. It holds the
+  // arena slots and the operand stack of the lambda running, and after them
+  // the closure itself, which the caller no longer roots after a tail call.
+  // The arguments of a tail call wait in the pending call until they are
+  // copied into the frame.
+  auto arena = FrameArena::Current();
+  FrameArena::Frame frame(arena, 0);
+  auto &pending = PendingTailCall();
+  ArgSpan call_args = args;
+  LambdaFunction *fn = this;
+  while (true) {
+    auto code = fn->GetCode();
+    CheckArgs(call_args, Kind::Allow, code->ParamCount());
+
+    Object *result;
+    if (code->InArena()) {
+      auto size = code->FrameSize() + code->StackSize();
+      frame.Resize(size + 1);
+      arena->Slot(size) = fn;
+      std::copy(call_args.begin(), call_args.end(), arena->Base());
+      result = code->Run(fn->current_scope_);
+    } else {
+      // The arguments wait on the arena while the frame is allocated. The
+      // frame is a root while the call runs; afterwards only the closures
+      // created in it keep it alive.
+      auto argc = call_args.size();
+      auto size = std::max(argc, code->StackSize());
+      frame.Resize(size + 1);
+      arena->Slot(size) = fn;
+      std::copy(call_args.begin(), call_args.end(), arena->Base());
+      auto scope = Scope::Create(fn->current_scope_, code->FrameSize());
+      struct Unroot {
+        Scope *frame;
+        ~Unroot() { GCManager::GetInstance().RemoveRoot(frame); }
+      } unroot{scope.get()};
+      std::copy_n(arena->Base(), argc, scope->slots_.begin());
+      std::fill_n(arena->Base(), argc, nullptr);
+      result = code->Run(scope);
+    }
+
+    if (!pending.fn)
+      return result;
+    fn = pending.fn;
+    pending.fn = nullptr;
+    call_args = pending.args;
+  }
 }
 
-void LambdaFunction::UnmarkRelated(GCMark mark) {
-  for (auto &arg : args_)
-    arg->Unmark(mark);
-  for (auto &body : body_)
-    body->Unmark(mark);
+WeakBox::WeakBox(Object *value) : value_(value) {
+  GCManager::GetInstance().RegisterWeak(this);
 }
 
-Object *LambdaFunction::Apply(std::shared_ptr<Scope> &scope,
-                              const std::vector<Object *> &args) {
-  CheckArgs(args, Kind::Allow, args_.size());
+WeakBox::~WeakBox() { GCManager::GetInstance().UnregisterWeak(this); }
 
-  for (size_t ind = 0; ind < args.size(); ++ind)
-    (*current_scope_)[AsSymbol(args_[ind])] = args[ind]; //->Eval(scope);
+const char *WeakBox::TypeName() const { return "weak-box"; }
 
-  for (size_t ind = 0; ind < body_.size(); ++ind) {
-    if (ind != body_.size() - 1)
-      body_[ind]->Eval(current_scope_);
-    else
-      return body_[ind]->Eval(current_scope_);
+size_t WeakBox::AllocatedBytes() const { return sizeof(WeakBox); }
+
+Object *WeakBox::MoveTo(void *where) {
+  return new (where) WeakBox(std::move(*this));
+}
+
+void WeakBox::PrintTo(std::ostream *out) const { *out << "#<weak-box>"; }
+
+void WeakBox::PrintDebug(std::ostream *out) const {
+  PrintTo(out);
+  *out << std::endl;
+}
+
+void WeakBox::VisitReferences(const ReferenceVisitor &visit) {
+  visit(value_, RefKind::Weak);
+}
+
+Object *WeakBox::Eval(std::shared_ptr<Scope> &) { return this; }
+
+void WeakBox::Break() {
+  value_ = nullptr;
+  broken_ = true;
+}
+
+size_t WeakTable::KeyHash::operator()(Object *key) const {
+  if (IsNumber(key))
+    return std::hash<int64_t>()(AsNumber(key)->GetValue());
+  return std::hash<Object *>()(key);
+}
+
+bool WeakTable::KeyEqual::operator()(Object *lhs, Object *rhs) const {
+  if (IsNumber(lhs) && IsNumber(rhs))
+    return AsNumber(lhs)->GetValue() == AsNumber(rhs)->GetValue();
+  return lhs == rhs;
+}
+
+WeakTable::WeakTable() { GCManager::GetInstance().RegisterWeak(this); }
+
+WeakTable::~WeakTable() { GCManager::GetInstance().UnregisterWeak(this); }
+
+// Keys are visited through a copy: the entries are keyed by value, so a
+// visitor that rewrites references (relocation) re-inserts moved keys.
+void WeakTable::VisitReferences(const ReferenceVisitor &visit) {
+  Entries moved;
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    auto key = it->first;
+    visit(key, RefKind::Weak);
+    visit(it->second, RefKind::Weak);
+    if (key != it->first) {
+      moved.emplace(key, it->second);
+      it = entries_.erase(it);
+    } else {
+      ++it;
+    }
   }
+  entries_.merge(moved);
+}
+
+const char *WeakTable::TypeName() const { return "hash-table"; }
+
+size_t WeakTable::AllocatedBytes() const {
+  return sizeof(WeakTable) + OutOfLineBytes(entries_);
+}
+
+Object *WeakTable::MoveTo(void *where) {
+  return new (where) WeakTable(std::move(*this));
+}
+
+void WeakTable::PrintTo(std::ostream *out) const {
+  *out << "#<hash-table " << entries_.size() << ">";
+}
+
+void WeakTable::PrintDebug(std::ostream *out) const {
+  PrintTo(out);
+  *out << std::endl;
+}
+
+Object *WeakTable::Eval(std::shared_ptr<Scope> &) { return this; }
+
+Object *MakeWeakBox(ArgSpan args) {
+  return Create<WeakBox>(args[0]);
+}
+
+Object *WeakBoxValue(ArgSpan args) {
+  auto box = Is<WeakBox>(args[0]);
+  if (!box)
+    throw RuntimeError("weak-box-value: argument must be a weak box");
+  if (box->IsBroken())
+    return args.size() == 2 ? args[1] : Create<Boolean>(false);
+  return box->GetValue();
+}
+
+Object *CheckWeakBox(ArgSpan args) {
+  return Create<Boolean>(Is<WeakBox>(args[0]) != nullptr);
+}
+
+Object *MakeWeakHashTable(ArgSpan) {
+  return Create<WeakTable>();
+}
+
+static WeakTable *AsWeakTable(Object *obj, const char *who) {
+  auto table = Is<WeakTable>(obj);
+  if (!table)
+    throw RuntimeError(std::string(who) + ": argument must be a hash table");
+  return table;
+}
+
+Object *HashTableSet(ArgSpan args) {
+  auto table = AsWeakTable(args[0], "hash-table-set!");
+  if (!args[1])
+    throw RuntimeError("hash-table-set!: the empty list cannot be a key");
+  auto before = table->AllocatedBytes();
+  table->GetEntries()[args[1]] = args[2];
+  GCManager::GetInstance().AccountResize(before, table->AllocatedBytes());
+  return nullptr;
+}
+
+Object *HashTableRef(ArgSpan args) {
+  auto &entries = AsWeakTable(args[0], "hash-table-ref")->GetEntries();
+  auto it = entries.find(args[1]);
+  if (it != entries.end())
+    return it->second;
+  return args.size() == 3 ? args[2] : Create<Boolean>(false);
+}
+
+Object *HashTableDelete(ArgSpan args) {
+  auto table = AsWeakTable(args[0], "hash-table-delete!");
+  auto before = table->AllocatedBytes();
+  table->GetEntries().erase(args[1]);
+  GCManager::GetInstance().AccountResize(before, table->AllocatedBytes());
   return nullptr;
 }
 
-Object *Exit(const std::vector<Object *> &args) {
-  Function::CheckArgs(args, Kind::Allow, 0);
+Object *HashTableCount(ArgSpan args) {
+  return Create<Number>(static_cast<int64_t>(
+      AsWeakTable(args[0], "hash-table-count")->GetEntries().size()));
+}
+
+Object *Exit(ArgSpan) {
   return Create<BuiltInObject>();
 }
 
@@ -803,6 +1134,24 @@ bool IsFunction(const Object *obj) {
   return obj && dynamic_cast<const Function *>(obj) != nullptr;
 }
 
+bool IsString(const Object *obj) {
+  return obj && Types::stringType == obj->ID();
+}
+
+String *AsString(const Object *obj) {
+  return IsString(obj) ? static_cast<String *>(const_cast<Object *>(obj))
+                       : nullptr;
+}
+
+bool IsVector(const Object *obj) {
+  return obj && Types::vectorType == obj->ID();
+}
+
+Vector *AsVector(const Object *obj) {
+  return IsVector(obj) ? static_cast<Vector *>(const_cast<Object *>(obj))
+                       : nullptr;
+}
+
 Function *AsFunction(const Object *obj) {
   return IsFunction(obj) ? static_cast<Function *>(const_cast<Object *>(obj))
                          : nullptr;
@@ -833,6 +1182,10 @@ Object *Parser::ReadProper() {
                  std::get_if<ConstantToken>(&current_object)) {
     tokenizer_.Next();
     return Create<Number, constant>(static_cast<int64_t>(constant_tok->value));
+  } else if (StringToken *string_tok =
+                 std::get_if<StringToken>(&current_object)) {
+    tokenizer_.Next();
+    return Create<String>(string_tok->value);
   } else if (std::holds_alternative<QuoteToken>(current_object)) {
     tokenizer_.Next();
     auto new_cell = Create<Cell>();
@@ -843,6 +1196,21 @@ Object *Parser::ReadProper() {
     return new_cell;
   } else if (std::holds_alternative<DotToken>(current_object)) {
     throw SyntaxError("Unexpected symbol");
+  } else if (std::holds_alternative<VectorToken>(current_object)) {
+    // Read as a list first, which must be proper. Nothing is collected
+    // while reading.
+    ParenOpen();
+    tokenizer_.Next();
+    auto list = ReadList();
+    size_t size = 0;
+    for (auto cell = list; cell; cell = AsCell(cell)->GetSecond(), ++size)
+      if (!IsCell(cell))
+        throw SyntaxError("Improper vector syntax");
+    auto vector = Create<Vector>(size);
+    auto cell = list;
+    for (size_t ind = 0; ind < size; ++ind, cell = AsCell(cell)->GetSecond())
+      vector->Set(ind, AsCell(cell)->GetFirst());
+    return vector;
   } else if (BracketToken *bracket =
                  std::get_if<BracketToken>(&current_object)) {
     if (*bracket == BracketToken::CLOSE)
@@ -1,8 +1,10 @@
 #pragma once
 
 #include "../scheme-tokenizer/tokenizer.h"
+#include "ref.h"
 #include <concepts>
 #include <cstdint>
+#include <functional>
 #include <istream>
 #include <memory>
 #include <span>
@@ -14,7 +16,14 @@
 #include <utility>
 #include <vector>
 
-enum class Types { tType, cellType, numberType, symbolType };
+enum class Types {
+  tType,
+  cellType,
+  numberType,
+  symbolType,
+  stringType,
+  vectorType
+};
 
 enum class Kind { Allow, Disallow };
 class Object;
@@ -22,6 +31,7 @@ class Symbol;
 class Number;
 class Boolean;
 class GCManager;
+class LambdaForm;
 
 struct constant {};
 
@@ -41,37 +51,85 @@ concept Creatable =
     (std::is_same_v<Tag, constant> && NumberOrSymbol<Derived>) ||
     !std::is_same_v<Tag, constant>;
 
+// Bytes owned out of line by standard containers, for memory accounting.
+inline size_t OutOfLineBytes(const std::string &str) {
+  auto begin = reinterpret_cast<const char *>(&str);
+  bool inline_storage =
+      str.data() >= begin && str.data() < begin + sizeof(str);
+  return inline_storage ? 0 : str.capacity() + 1;
+}
+
+template <typename T> size_t OutOfLineBytes(const std::vector<T> &vec) {
+  return vec.capacity() * sizeof(T);
+}
+
+// Node-based map: a bucket array plus one node (next pointer, cached hash
+// and the value) per element.
+template <typename Map> size_t OutOfLineBytes(const Map &map) {
+  return map.bucket_count() * sizeof(void *) +
+         map.size() * (sizeof(void *) + sizeof(size_t) +
+                       sizeof(typename Map::value_type));
+}
+
+// Arguments of a call, which the caller keeps rooted until it returns:
+// mostly slots of the FrameArena (frame_arena.h), so passing them allocates
+// nothing.
+using ArgSpan = std::span<Object *const>;
+
 class Scope : public std::enable_shared_from_this<Scope> {
 public:
   static std::shared_ptr<Scope> Create();
 
   static std::shared_ptr<Scope> Create(std::shared_ptr<Scope> &parent);
 
+  // Frame of a call with `slots` variables addressed by index.
+  static std::shared_ptr<Scope> Create(const std::shared_ptr<Scope> &parent,
+                                       size_t slots);
+
   Scope() = default;
   explicit Scope(std::shared_ptr<Scope> &parent) : parent_(parent){};
   ~Scope();
-  void Release();
 
   std::pair<Object *, std::shared_ptr<Scope>> Lookup(const std::string &name);
 
   Object *&operator[](Symbol *symbol);
 
+  // Binds `symbol` to `value` and bumps version_.
+  void Assign(Symbol *symbol, Object *value);
+
+  size_t AllocatedBytes() const;
+
   std::unordered_map<std::string, Object *> variables_;
+  std::vector<Object *> slots_;
   std::shared_ptr<Scope> parent_;
+  // Changes whenever a variable of this scope is defined or assigned, so
+  // that inline caches over the global scope can tell they are stale.
+  uint64_t version_ = 0;
 };
 
 class Object {
 public:
-  enum class GCMark : int { White = 0, Black = 1, Safe = 2 };
+  enum class GCMark : uint8_t { White = 0, Black = 1, Safe = 2 };
+
+  enum class RefKind { Strong, Weak };
+  using ReferenceVisitor = std::function<void(Object *&, RefKind)>;
 
   friend bool operator<(GCMark a, GCMark b) {
     return static_cast<int>(a) < static_cast<int>(b);
   }
 
-  Object() = default;
+  // Objects are born marked, so that they survive the collection that their
+  // own registration may trigger. Copies take the mark of the original.
+  Object();
+  Object(const Object &other);
 
   virtual ~Object();
 
+  // Objects live in the collector's paged heap (see heap.h).
+  static void *operator new(size_t size);
+  static void *operator new(size_t, void *where) { return where; }
+  static void operator delete(void *ptr);
+
   void Mark(GCMark mark = GCMark::Black);
   void Unmark(GCMark mark = GCMark::Black);
   bool isMarked() const;
@@ -79,22 +137,62 @@ public:
   virtual void MarkRelated(GCMark mark = GCMark::Black);
   virtual void UnmarkRelated(GCMark mark = GCMark::Black);
 
+  // Calls `visit` on every object reference held by this object, including
+  // the weak ones, so that heap walkers see the same edges as the marker.
+  virtual void VisitReferences(const ReferenceVisitor &visit);
+
   virtual Types ID() const;
 
+  virtual const char *TypeName() const;
+
+  // Size of the object including the storage it owns out of line (strings,
+  // vectors, tables). Objects that grow after construction report the
+  // change through GCManager::AccountResize.
+  virtual size_t AllocatedBytes() const = 0;
+
+  // Move-constructs a copy of this object into the free slot `where` and
+  // returns it; used by the compacting collector to evacuate pages. The
+  // moved-from object is left to be destroyed by the caller.
+  virtual Object *MoveTo(void *where) = 0;
+
   virtual bool IsFalse() const;
 
+  // Whether GCManager::Freeze may move the object to read-only pages. An
+  // object that writes to its own fields while the program runs, to fill a
+  // cache say, says no next to those fields.
+  virtual bool Freezable() const;
+
   virtual void PrintTo(std::ostream *out) const = 0;
   virtual void PrintDebug(std::ostream *out) const = 0;
 
   virtual Object *Eval(std::shared_ptr<Scope> &scope) = 0;
 
+protected:
+  // Visits a reference field that may be stored compressed.
+  static void VisitRef(const ReferenceVisitor &visit, Ref<Object> &ref,
+                       RefKind kind) {
+#ifdef SCHEME_COMPRESSED_REFS
+    Object *ptr = ref;
+    visit(ptr, kind);
+    if (ptr != ref)
+      ref = ptr;
+#else
+    visit(ref, kind);
+#endif
+  }
+
 private:
-  GCMark marked_ = GCMark::Black;
+  // The mark lives in a side table of the heap (Heap::MarkOf); objects
+  // without one (frozen, or not allocated with new) count as marked.
+  uint8_t *MarkByte() const;
 };
 
 class BuiltInObject : public Object {
 public:
   virtual Types ID() const override;
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
 
   virtual void PrintTo(std::ostream *out) const override;
   virtual void PrintDebug(std::ostream *out) const override;
@@ -110,8 +208,12 @@ public:
 
   virtual void MarkRelated(GCMark mark = GCMark::Black) override;
   virtual void UnmarkRelated(GCMark mark = GCMark::Black) override;
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
 
   virtual Types ID() const override;
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
 
   virtual void PrintTo(std::ostream *out) const override;
   virtual void PrintDebug(std::ostream *out) const override;
@@ -127,20 +229,24 @@ public:
   void SetSecond(Object *object);
 
 private:
-  Object *head_;
-  Object *tail_;
+  void CheckMutable() const;
+
+  Ref<Object> head_;
+  Ref<Object> tail_;
 };
 
 class Number : public Object {
 public:
   using ValueType = int64_t;
-  static std::unordered_map<ValueType, Number *> *GetConstantRegistry();
 
   Number();
 
   explicit Number(int64_t value);
 
   virtual Types ID() const override;
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
 
   virtual void PrintTo(std::ostream *out) const override;
   virtual void PrintDebug(std::ostream *out) const override;
@@ -158,21 +264,27 @@ private:
 class SpecialForm : public Object {
 public:
   using ApplyMethod = Object *(*)(std::shared_ptr<Scope> &scope,
-                                  const std::vector<Object *> &);
+                                  ArgSpan);
 
   SpecialForm(const std::string &&name, ApplyMethod &&apply_method);
 
   virtual Object *Eval(std::shared_ptr<Scope> &scope) override;
 
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
   void PrintTo(std::ostream *out) const override;
   virtual void PrintDebug(std::ostream *out) const override;
 
-  virtual Object *Apply(std::shared_ptr<Scope> &scope,
-                        const std::vector<Object *> &args);
+  virtual Object *Apply(std::shared_ptr<Scope> &scope, ArgSpan args);
 
+  // Throws unless the number of arguments is one of `sizes` (Kind::Allow)
+  // or none of them (Kind::Disallow).
   template <typename... Sizes>
-  static void CheckArgs(const std::vector<Object *> &args, Kind kind,
-                        Sizes... sizes);
+  static void CheckArgs(ArgSpan args, Kind kind, Sizes... sizes);
+
+  const std::string &GetName() const { return name; }
 
 protected:
   std::string name;
@@ -191,6 +303,9 @@ public:
   explicit Symbol(std::string name);
 
   virtual Types ID() const override;
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
 
   virtual void PrintTo(std::ostream *out) const override;
   virtual void PrintDebug(std::ostream *out) const override;
@@ -213,66 +328,250 @@ public:
 
   explicit Boolean(bool val);
 
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
   virtual Object *Eval(std::shared_ptr<Scope> &) override;
 
   bool IsFalse() const override;
 };
 
+class String : public Object {
+public:
+  explicit String(std::string value);
+
+  virtual Types ID() const override;
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual void PrintTo(std::ostream *out) const override;
+  virtual void PrintDebug(std::ostream *out) const override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &) override;
+
+  const std::string &GetValue() const;
+
+private:
+  std::string value_;
+};
+
+// A fixed number of elements in one contiguous array: `#(1 2 3)`, or one of
+// the vector builtins (vectors.h). A frozen vector cannot be changed.
+class Vector : public Object {
+public:
+  explicit Vector(size_t size, Object *fill = nullptr);
+
+  virtual void MarkRelated(GCMark mark = GCMark::Black) override;
+  virtual void UnmarkRelated(GCMark mark = GCMark::Black) override;
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual Types ID() const override;
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual void PrintTo(std::ostream *out) const override;
+  virtual void PrintDebug(std::ostream *out) const override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &) override;
+
+  size_t Size() const { return elements_.size(); }
+
+  Object *Get(size_t index) const { return elements_[index]; }
+
+  void Set(size_t index, Object *object);
+
+  // Throws if the vector is frozen, which Set checks too.
+  void CheckMutable() const;
+
+private:
+  std::vector<Ref<Object>> elements_;
+};
+
+// What a builtin accepts: between `min` and `max` arguments, all of them
+// numbers if `type` says so. Function::Apply checks it before calling the
+// builtin, which takes it for granted.
+struct Signature {
+  static constexpr size_t kVariadic = SIZE_MAX;
+  enum class Type : uint8_t { Any, Number };
+
+  size_t min = 0;
+  size_t max = kVariadic;
+  Type type = Type::Any;
+
+  static constexpr Signature Exactly(size_t count) { return {count, count}; }
+  static constexpr Signature Between(size_t min, size_t max) {
+    return {min, max};
+  }
+  static constexpr Signature AtLeast(size_t min) { return {min, kVariadic}; }
+  static constexpr Signature Numbers(size_t min, size_t max = kVariadic) {
+    return {min, max, Type::Number};
+  }
+};
+
 class Function : public Object {
 public:
-  using ApplyMethod = Object *(*)(const std::vector<Object *> &);
+  using ApplyMethod = Object *(*)(ArgSpan);
 
-  Function(const std::string &&name, ApplyMethod &&apply_method);
+  Function(const std::string &&name, ApplyMethod &&apply_method,
+           Signature signature = {});
 
   virtual Object *Eval(std::shared_ptr<Scope> &scope) override;
 
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
   void PrintTo(std::ostream *out) const override;
   virtual void PrintDebug(std::ostream *out) const override;
 
-  virtual Object *Apply(std::shared_ptr<Scope> &scope,
-                        const std::vector<Object *> &args);
+  virtual Object *Apply(std::shared_ptr<Scope> &scope, ArgSpan args);
+
+  // Calls of known arity, for builtins that call back, like map. The
+  // arguments are passed from the native stack, so the caller roots them.
+  Object *Call(std::shared_ptr<Scope> &scope, Object *arg) {
+    Object *args[] = {arg};
+    return Apply(scope, args);
+  }
+  Object *Call(std::shared_ptr<Scope> &scope, Object *first, Object *second) {
+    Object *args[] = {first, second};
+    return Apply(scope, args);
+  }
 
   template <typename... Sizes>
-  static void CheckArgs(const std::vector<Object *> &args, Kind kind,
-                        Sizes... sizes);
+  static void CheckArgs(ArgSpan args, Kind kind, Sizes... sizes);
+
+  // Throws unless `args` fit the signature. Apply checks; code that calls
+  // the apply method itself checks first.
+  void CheckSignature(ArgSpan args) const;
+  const Signature &GetSignature() const { return signature; }
+
+  // Compiled code (jit.h) recognizes a builtin by its apply method, which it
+  // reads from the object at ApplyMethodOffset().
+  ApplyMethod GetApplyMethod() const { return apply_method; }
+  size_t ApplyMethodOffset() const {
+    return reinterpret_cast<const char *>(&apply_method) -
+           reinterpret_cast<const char *>(this);
+  }
 
 protected:
   std::string name;
 
   const ApplyMethod apply_method;
+  Signature signature;
 };
 
+// Closure: resolved code (see resolver.h) and the frame it was created in.
 class LambdaFunction : public Function {
 public:
-  LambdaFunction(std::shared_ptr<Scope> scope, std::vector<Object *> &&args,
-                 std::span<Object *const> body)
-      : Function("", nullptr), current_scope_(scope), args_(args),
-        body_(body.begin(), body.end()) {}
+  LambdaFunction(std::shared_ptr<Scope> scope, LambdaForm *code);
 
   virtual void MarkRelated(GCMark mark = GCMark::Black) override;
-  virtual void UnmarkRelated(GCMark mark = GCMark::Black) override;
 
-  Object *Apply(std::shared_ptr<Scope> &scope,
-                const std::vector<Object *> &args) override;
+  // Besides the code, visits the slots of the enclosing frames, which only
+  // the closures created in them keep alive once their call has returned.
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  // Runs the body. Calls it makes in tail position come back here and run
+  // in place of this one, so a loop of tail calls takes constant space.
+  Object *Apply(std::shared_ptr<Scope> &scope, ArgSpan args) override;
+
+  // A call of a closure in tail position does not call: it leaves the
+  // closure and the arguments here and returns nullptr to the Apply that
+  // runs the body. Nothing is allocated until that Apply has taken them.
+  struct TailCall {
+    LambdaFunction *fn = nullptr;
+    std::vector<Object *> args;
+  };
+  static TailCall &PendingTailCall() {
+    static TailCall pending;
+    return pending;
+  }
 
   std::shared_ptr<Scope> GetScope() { return current_scope_; }
 
-  void SetScope(const std::shared_ptr<Scope> &scope) { current_scope_ = scope; }
+  LambdaForm *GetCode() const;
 
-  std::vector<Object *> GetArgs() { return args_; }
+private:
+  std::shared_ptr<Scope> current_scope_;
+  Ref<Object> code_;
+};
 
-  void SetArgs(std::vector<Object *> args) { args_ = args; }
+// Holds its value without keeping it alive: once the value is collected the
+// box is broken and reports no value.
+class WeakBox : public Object {
+public:
+  explicit WeakBox(Object *value);
+  WeakBox(WeakBox &&) = default;
+  ~WeakBox() override;
 
-  std::vector<Object *> GetBody() { return body_; }
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
 
-  void AddToBody(Object *form) { body_.push_back(form); }
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
 
-  void Release();
+  virtual void PrintTo(std::ostream *out) const override;
+  virtual void PrintDebug(std::ostream *out) const override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &) override;
+
+  Object *GetValue() const { return value_; }
+
+  bool IsBroken() const { return broken_; }
+
+  void Break();
+
+  // Broken by the collector.
+  virtual bool Freezable() const override { return false; }
 
 private:
-  std::shared_ptr<Scope> current_scope_;
-  std::vector<Object *> args_;
-  std::vector<Object *> body_;
+  Object *value_;
+  bool broken_ = false;
+};
+
+// Weak-keyed hash table with ephemeron semantics: an entry keeps its value
+// alive only while the key is reachable from elsewhere, and entries whose
+// key was collected are dropped by the collector. Keys are compared with
+// eqv?, i.e. numbers by value and everything else by identity.
+class WeakTable : public Object {
+public:
+  struct KeyHash {
+    size_t operator()(Object *key) const;
+  };
+  struct KeyEqual {
+    bool operator()(Object *lhs, Object *rhs) const;
+  };
+  using Entries = std::unordered_map<Object *, Object *, KeyHash, KeyEqual>;
+
+  WeakTable();
+  WeakTable(WeakTable &&) = default;
+  ~WeakTable() override;
+
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual void PrintTo(std::ostream *out) const override;
+  virtual void PrintDebug(std::ostream *out) const override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &) override;
+
+  Entries &GetEntries() { return entries_; }
+
+  // Changed by the program and by the collector.
+  virtual bool Freezable() const override { return false; }
+
+private:
+  Entries entries_;
 };
 
 struct SyntaxError : public std::runtime_error {
@@ -287,6 +586,20 @@ struct NameError : public std::runtime_error {
   explicit NameError(const std::string &what);
 };
 
+template <typename... Sizes>
+void SpecialForm::CheckArgs(ArgSpan args, Kind kind, Sizes... sizes) {
+  bool listed = ((args.size() == static_cast<size_t>(sizes)) || ...);
+  if (listed != (kind == Kind::Allow))
+    throw SyntaxError("Wrong number of arguments!");
+}
+
+template <typename... Sizes>
+void Function::CheckArgs(ArgSpan args, Kind kind, Sizes... sizes) {
+  bool listed = ((args.size() == static_cast<size_t>(sizes)) || ...);
+  if (listed != (kind == Kind::Allow))
+    throw RuntimeError("Wrong number of arguments!");
+}
+
 inline void PrintTo(const Object *obj, std::ostream *out) {
   if (!obj) {
     *out << "()";
@@ -315,87 +628,117 @@ Symbol *AsSymbol(const Object *obj);
 bool IsCell(const Object *obj);
 Cell *AsCell(const Object *obj);
 
+bool IsString(const Object *obj);
+String *AsString(const Object *obj);
+
+bool IsVector(const Object *obj);
+Vector *AsVector(const Object *obj);
+
 bool IsFunction(const Object *obj);
 Function *AsFunction(const Object *obj);
 
-Object *Quote(std::shared_ptr<Scope> &scope, const std::vector<Object *> &args);
+Object *Quote(std::shared_ptr<Scope> &scope, ArgSpan args);
+
+Object *Plus(ArgSpan args);
 
-Object *Plus(const std::vector<Object *> &args);
+Object *Minus(ArgSpan args);
 
-Object *Minus(const std::vector<Object *> &args);
+Object *Multiply(ArgSpan args);
 
-Object *Multiply(const std::vector<Object *> &args);
+Object *Divide(ArgSpan args);
 
-Object *Divide(const std::vector<Object *> &args);
+Object *If(std::shared_ptr<Scope> &scope, ArgSpan args);
 
-Object *If(std::shared_ptr<Scope> &scope, const std::vector<Object *> &args);
+Object *CheckNull(ArgSpan args);
 
-Object *CheckNull(const std::vector<Object *> &args);
+Object *CheckPair(ArgSpan args);
 
-Object *CheckPair(const std::vector<Object *> &args);
+Object *CheckNumber(ArgSpan args);
+Object *CheckBoolean(ArgSpan args);
 
-Object *CheckNumber(const std::vector<Object *> &args);
-Object *CheckBoolean(const std::vector<Object *> &args);
+Object *CheckSymbol(ArgSpan args);
 
-Object *CheckSymbol(const std::vector<Object *> &args);
+Object *CheckList(ArgSpan args);
 
-Object *CheckList(const std::vector<Object *> &args);
+Object *CheckString(ArgSpan args);
 
 // FIXME
-Object *Eq(const std::vector<Object *> &args);
+Object *Eq(ArgSpan args);
 // FIXME
-Object *Equal(const std::vector<Object *> &args);
-Object *IntegerEqual(const std::vector<Object *> &args);
+Object *Equal(ArgSpan args);
+Object *IntegerEqual(ArgSpan args);
+
+Object *Not(ArgSpan args);
+
+Object *Equality(ArgSpan args);
+
+Object *More(ArgSpan args);
+
+Object *Less(ArgSpan args);
+
+Object *MoreOrEqual(ArgSpan args);
+
+Object *LessOrEqual(ArgSpan args);
+
+Object *Min(ArgSpan args);
+
+Object *Max(ArgSpan args);
+
+Object *Abs(ArgSpan args);
+
+Object *Cons(ArgSpan args);
+
+Object *Car(ArgSpan args);
+
+Object *Cdr(ArgSpan args);
 
-Object *Not(const std::vector<Object *> &args);
+Object *SetCar(ArgSpan args);
 
-Object *Equality(const std::vector<Object *> &args);
+Object *SetCdr(ArgSpan args);
 
-Object *More(const std::vector<Object *> &args);
+Object *List(ArgSpan args);
 
-Object *Less(const std::vector<Object *> &args);
+Object *ListRef(ArgSpan args);
 
-Object *MoreOrEqual(const std::vector<Object *> &args);
+Object *ListTail(ArgSpan args);
 
-Object *LessOrEqual(const std::vector<Object *> &args);
+Object *And(std::shared_ptr<Scope> &scope, ArgSpan args);
 
-Object *Min(const std::vector<Object *> &args);
+Object *Or(std::shared_ptr<Scope> &scope, ArgSpan args);
 
-Object *Max(const std::vector<Object *> &args);
+Object *Define(std::shared_ptr<Scope> &scope, ArgSpan args);
 
-Object *Abs(const std::vector<Object *> &args);
+Object *Set(std::shared_ptr<Scope> &scope, ArgSpan args);
 
-Object *Cons(const std::vector<Object *> &args);
+Object *Lambda(std::shared_ptr<Scope> &scope, ArgSpan args);
 
-Object *Car(const std::vector<Object *> &args);
+Object *Let(std::shared_ptr<Scope> &scope, ArgSpan args);
 
-Object *Cdr(const std::vector<Object *> &args);
+Object *LetStar(std::shared_ptr<Scope> &scope, ArgSpan args);
 
-Object *SetCar(const std::vector<Object *> &args);
+Object *Letrec(std::shared_ptr<Scope> &scope, ArgSpan args);
 
-Object *SetCdr(const std::vector<Object *> &args);
+Object *Do(std::shared_ptr<Scope> &scope, ArgSpan args);
 
-Object *List(const std::vector<Object *> &args);
+Object *DefineMemoized(std::shared_ptr<Scope> &scope, ArgSpan args);
 
-Object *ListRef(const std::vector<Object *> &args);
+Object *Exit(ArgSpan args);
 
-Object *ListTail(const std::vector<Object *> &args);
+Object *MakeWeakBox(ArgSpan args);
 
-Object *And(std::shared_ptr<Scope> &scope, const std::vector<Object *> &args);
+Object *WeakBoxValue(ArgSpan args);
 
-Object *Or(std::shared_ptr<Scope> &scope, const std::vector<Object *> &args);
+Object *CheckWeakBox(ArgSpan args);
 
-Object *Define(std::shared_ptr<Scope> &scope,
-               const std::vector<Object *> &args);
+Object *MakeWeakHashTable(ArgSpan args);
 
-Object *Set(std::shared_ptr<Scope> &scope, const std::vector<Object *> &args);
+Object *HashTableSet(ArgSpan args);
 
-Object *Lambda(std::shared_ptr<Scope> &scope,
-               const std::vector<Object *> &args);
+Object *HashTableRef(ArgSpan args);
 
-Object *Exit(const std::vector<Object *> &args);
+Object *HashTableDelete(ArgSpan args);
 
-Object *Map(const std::vector<Object *> &args);
+Object *HashTableCount(ArgSpan args);
 
 // Object* Load(const std::vector<Object*> &args);
 
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "heap.h"
+#include <cassert>
+#include <cstdint>
+
+#ifdef SCHEME_COMPRESSED_REFS
+
+// Reference to an object of the heap stored as a 32-bit offset, in granules,
+// from the heap base; 0 is the null reference. Converts to and from T * so
+// that fields can switch between Ref<T> and T * without touching their users.
+template <typename T> class Ref {
+public:
+  Ref(T *ptr = nullptr) : offset_(Encode(ptr)) {}
+
+  Ref &operator=(T *ptr) {
+    offset_ = Encode(ptr);
+    return *this;
+  }
+
+  operator T *() const { return Decode(offset_); }
+
+  T *operator->() const { return Decode(offset_); }
+
+private:
+  static uint32_t Encode(T *ptr) {
+    if (!ptr)
+      return 0;
+    auto offset = reinterpret_cast<uintptr_t>(ptr) - Heap::RefBase();
+    assert(offset < Heap::kReservedBytes && offset % Heap::kGranule == 0);
+    return static_cast<uint32_t>(offset / Heap::kGranule + 1);
+  }
+
+  static T *Decode(uint32_t offset) {
+    return offset ? reinterpret_cast<T *>(Heap::RefBase() +
+                                          (offset - 1) * Heap::kGranule)
+                  : nullptr;
+  }
+
+  uint32_t offset_;
+};
+
+static_assert(Heap::kReservedBytes / Heap::kGranule < UINT32_MAX,
+              "compressed references cannot address the whole heap");
+
+#else
+
+template <typename T> using Ref = T *;
+
+#endif
@@ -0,0 +1,1575 @@
+#include "resolver.h"
+#include "builtins.h"
+#include "cek.h"
+#include "create.h"
+#include "gc.h"
+#include "jit.h"
+#include "macro.h"
+#include "memo.h"
+#include "parser.h"
+#include <algorithm>
+#include <span>
+#include <string>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+namespace {
+
+template <typename T> std::vector<Ref<Object>> ToRefs(std::vector<T> objects) {
+  return {objects.begin(), objects.end()};
+}
+
+Form *AsForm(const Ref<Object> &ref) {
+  return static_cast<Form *>(static_cast<Object *>(ref));
+}
+
+void CheckSize(const std::vector<Object *> &args, size_t min, size_t max) {
+  if (args.size() < min || args.size() > max)
+    throw SyntaxError("Wrong number of arguments!");
+}
+
+bool IsTrue(const Object *obj) { return !obj || !obj->IsFalse(); }
+
+// The `(variable value ...)` lists of a binding form, each of at most
+// `size` elements.
+std::vector<std::vector<Object *>> BindingList(Object *bindings, size_t size) {
+  if (bindings && !IsCell(bindings))
+    throw SyntaxError("bad binding list");
+  std::vector<std::vector<Object *>> result;
+  for (auto binding : ToVector(bindings)) {
+    if (!IsCell(binding))
+      throw SyntaxError("bad binding");
+    auto parts = ToVector(binding);
+    if (parts.size() < 2 || parts.size() > size || !IsSymbol(parts[0]) ||
+        Is<Boolean>(parts[0]))
+      throw SyntaxError("bad binding");
+    result.push_back(std::move(parts));
+  }
+  return result;
+}
+
+// Builtins whose result depends on their arguments alone. The arithmetic
+// ones are only folded on numbers, as some of them do not check; `/` traps
+// on a zero divisor and is left out.
+const Function::ApplyMethod kArithmetic[] = {
+    Plus,  Minus, Multiply,    Min,         Max,        Abs,
+    Less,  More,  LessOrEqual, MoreOrEqual, Equality,   IntegerEqual,
+};
+const Function::ApplyMethod kPredicates[] = {
+    Not,          CheckNull,   CheckPair,   CheckNumber,
+    CheckBoolean, CheckSymbol, CheckString, CheckList,
+};
+
+// The value `form` always has while `guards` hold, which it adds them to.
+bool KnownValue(Object *form, Object **value,
+                std::vector<GuardForm::Guard> *guards) {
+  if (auto guarded = Is<GuardForm>(form)) {
+    if (!KnownValue(guarded->Fast(), value, guards))
+      return false;
+    guarded->AppendGuards(guards);
+    return true;
+  }
+  auto constant = Is<ConstantForm>(form);
+  if (!constant)
+    return false;
+  *value = constant->Value();
+  return true;
+}
+
+// Whether `form` has a value known without guards: conditions whose value
+// rests on globals are not pruned, as the guard would cost what the test
+// does and both branches would be kept anyway.
+bool Constant(Object *form, Object **value) {
+  std::vector<GuardForm::Guard> guards;
+  return KnownValue(form, value, &guards) && guards.empty();
+}
+
+// Lambdas whose bodies have at most this many atoms are inlined.
+constexpr size_t kInlineAtoms = 32;
+
+// Whether `form` has at most `*budget` atoms, which it takes from it.
+bool Fits(Object *form, size_t *budget) {
+  if (!IsCell(form))
+    return (*budget)-- > 0;
+  return Fits(AsCell(form)->GetFirst(), budget) &&
+         Fits(AsCell(form)->GetSecond(), budget);
+}
+
+bool Mentions(Object *form, const std::string &name) {
+  if (IsCell(form))
+    return Mentions(AsCell(form)->GetFirst(), name) ||
+           Mentions(AsCell(form)->GetSecond(), name);
+  return IsSymbol(form) && AsSymbol(form)->GetName() == name;
+}
+
+// Forms the machine evaluates in place, as they call nothing.
+bool Immediate(Object *form) {
+  return Is<ConstantForm>(form) || Is<LocalRef>(form) || Is<GlobalRef>(form);
+}
+
+// Has the machine evaluate `forms` from the step of `frame` on, or from the
+// first when there is no frame yet; the last one is in tail position.
+void StepSequence(Machine *machine, Form *owner, MachineFrame *frame,
+                  const std::vector<Ref<Object>> &forms) {
+  if (forms.empty())
+    return machine->Return(nullptr);
+  size_t step = frame ? frame->Step() : 0;
+  if (step + 1 < forms.size()) {
+    if (frame)
+      machine->Keep(frame);
+    else
+      frame = machine->Push(owner, 0);
+    frame->SetStep(step + 1);
+  }
+  machine->Eval(forms[step]);
+}
+
+} // namespace
+
+void Form::MarkRelated(GCMark mark) {
+  VisitReferences([mark](Object *&ref, RefKind) {
+    if (ref)
+      ref->Mark(mark);
+  });
+}
+
+void Form::MarkTail() {
+  std::vector<Form *> tails;
+  Tails(&tails);
+  for (auto tail : tails)
+    tail->SetTail();
+}
+
+void Form::Step(Machine *machine, std::shared_ptr<Scope> &scope) {
+  machine->Return(Eval(scope));
+}
+
+void Form::Resume(Machine *, MachineFrame *, Object *) {
+  throw RuntimeError("can't resume " + std::string(TypeName()));
+}
+
+void Form::PrintTo(std::ostream *out) const {
+  *out << "#<" << TypeName() << ">";
+}
+
+void Form::PrintDebug(std::ostream *out) const {
+  PrintTo(out);
+  *out << std::endl;
+}
+
+ConstantForm::ConstantForm(Object *value) : value_(value) {}
+
+void ConstantForm::VisitReferences(const ReferenceVisitor &visit) {
+  VisitRef(visit, value_, RefKind::Strong);
+}
+
+const char *ConstantForm::TypeName() const { return "constant-form"; }
+
+size_t ConstantForm::AllocatedBytes() const { return sizeof(ConstantForm); }
+
+Object *ConstantForm::MoveTo(void *where) {
+  return new (where) ConstantForm(std::move(*this));
+}
+
+Object *ConstantForm::Eval(std::shared_ptr<Scope> &) { return value_; }
+
+void ConstantForm::Compile(Compiler *compiler) {
+  compiler->Emit(Bytecode::kConst, {compiler->Constant(value_)}, 1);
+}
+
+LocalRef::LocalRef(Symbol *name, uint32_t depth, uint32_t index)
+    : name_(name), depth_(depth), index_(index) {}
+
+void LocalRef::VisitReferences(const ReferenceVisitor &visit) {
+  VisitRef(visit, name_, RefKind::Strong);
+}
+
+const char *LocalRef::TypeName() const { return "local-ref"; }
+
+size_t LocalRef::AllocatedBytes() const { return sizeof(LocalRef); }
+
+Object *LocalRef::MoveTo(void *where) {
+  return new (where) LocalRef(std::move(*this));
+}
+
+Object *LocalRef::Eval(std::shared_ptr<Scope> &scope) {
+  return Slot(scope.get());
+}
+
+void LocalRef::Compile(Compiler *compiler) {
+  if (in_arena_)
+    compiler->Emit(Bytecode::kArenaRef, {index_}, 1);
+  else
+    compiler->Emit(Bytecode::kScopeRef, {depth_, index_}, 1);
+}
+
+void LocalRef::CompileStore(Compiler *compiler) {
+  if (in_arena_)
+    compiler->Emit(Bytecode::kSetArena, {index_}, 0);
+  else
+    compiler->Emit(Bytecode::kSetScope, {depth_, index_}, 0);
+}
+
+GlobalRef::GlobalRef(Symbol *name, Scope *global)
+    : name_(name), global_(global) {}
+
+void GlobalRef::VisitReferences(const ReferenceVisitor &visit) {
+  VisitRef(visit, name_, RefKind::Strong);
+}
+
+void GlobalRef::PrintTo(std::ostream *out) const {
+  *out << static_cast<Symbol *>(static_cast<Object *>(name_))->GetName();
+}
+
+const char *GlobalRef::TypeName() const { return "global-ref"; }
+
+size_t GlobalRef::AllocatedBytes() const { return sizeof(GlobalRef); }
+
+Object *GlobalRef::MoveTo(void *where) {
+  return new (where) GlobalRef(std::move(*this));
+}
+
+Object *GlobalRef::Eval(std::shared_ptr<Scope> &) { return Binding(); }
+
+void GlobalRef::Compile(Compiler *compiler) {
+  compiler->Emit(Bytecode::kGlobalRef, {compiler->Constant(this)}, 1);
+}
+
+Object *&GlobalRef::Binding() {
+  auto binding = Lookup();
+  if (!binding)
+    throw NameError(Name());
+  return *binding;
+}
+
+Object **GlobalRef::Lookup() {
+  if (!binding_) {
+    auto it = global_->variables_.find(Name());
+    if (it == global_->variables_.end())
+      return nullptr;
+    binding_ = &it->second;
+  }
+  return binding_;
+}
+
+const std::string &GlobalRef::Name() const {
+  return AsSymbol(name_)->GetName();
+}
+
+LocalSet::LocalSet(LocalRef *target, Object *value)
+    : target_(target), value_(value) {}
+
+void LocalSet::VisitReferences(const ReferenceVisitor &visit) {
+  VisitRef(visit, target_, RefKind::Strong);
+  VisitRef(visit, value_, RefKind::Strong);
+}
+
+const char *LocalSet::TypeName() const { return "local-set"; }
+
+size_t LocalSet::AllocatedBytes() const { return sizeof(LocalSet); }
+
+Object *LocalSet::MoveTo(void *where) {
+  return new (where) LocalSet(std::move(*this));
+}
+
+Object *LocalSet::Eval(std::shared_ptr<Scope> &scope) {
+  auto value = value_->Eval(scope);
+  static_cast<LocalRef *>(static_cast<Object *>(target_))->Slot(scope.get()) =
+      value;
+  return nullptr;
+}
+
+void LocalSet::Compile(Compiler *compiler) {
+  AsForm(value_)->Compile(compiler);
+  static_cast<LocalRef *>(static_cast<Object *>(target_))
+      ->CompileStore(compiler);
+}
+
+void LocalSet::Step(Machine *machine, std::shared_ptr<Scope> &) {
+  machine->Push(this, 0);
+  machine->Eval(value_);
+}
+
+void LocalSet::Resume(Machine *machine, MachineFrame *frame, Object *value) {
+  static_cast<LocalRef *>(static_cast<Object *>(target_))
+      ->Slot(frame->GetScope().get()) = value;
+  machine->Return(nullptr);
+}
+
+GlobalDefine::GlobalDefine(Symbol *name, Scope *global, Object *value)
+    : name_(name), global_(global), value_(value) {}
+
+void GlobalDefine::VisitReferences(const ReferenceVisitor &visit) {
+  VisitRef(visit, name_, RefKind::Strong);
+  VisitRef(visit, value_, RefKind::Strong);
+}
+
+const char *GlobalDefine::TypeName() const { return "global-define"; }
+
+size_t GlobalDefine::AllocatedBytes() const { return sizeof(GlobalDefine); }
+
+Object *GlobalDefine::MoveTo(void *where) {
+  return new (where) GlobalDefine(std::move(*this));
+}
+
+Object *GlobalDefine::Eval(std::shared_ptr<Scope> &scope) {
+  Define(value_->Eval(scope));
+  return nullptr;
+}
+
+void GlobalDefine::Compile(Compiler *compiler) {
+  AsForm(value_)->Compile(compiler);
+  compiler->Emit(Bytecode::kDefineGlobal, {compiler->Constant(this)}, 0);
+}
+
+void GlobalDefine::Step(Machine *machine, std::shared_ptr<Scope> &) {
+  machine->Push(this, 0);
+  machine->Eval(value_);
+}
+
+void GlobalDefine::Resume(Machine *machine, MachineFrame *, Object *value) {
+  Define(value);
+  machine->Return(nullptr);
+}
+
+GlobalSet::GlobalSet(GlobalRef *target, Object *value)
+    : target_(target), value_(value) {}
+
+void GlobalSet::VisitReferences(const ReferenceVisitor &visit) {
+  VisitRef(visit, target_, RefKind::Strong);
+  VisitRef(visit, value_, RefKind::Strong);
+}
+
+const char *GlobalSet::TypeName() const { return "global-set"; }
+
+size_t GlobalSet::AllocatedBytes() const { return sizeof(GlobalSet); }
+
+Object *GlobalSet::MoveTo(void *where) {
+  return new (where) GlobalSet(std::move(*this));
+}
+
+Object *GlobalSet::Eval(std::shared_ptr<Scope> &scope) {
+  auto target = static_cast<GlobalRef *>(static_cast<Object *>(target_));
+  // Fails before the value is computed, as the top-level `set!` does.
+  target->Binding();
+  target->Store(value_->Eval(scope));
+  return nullptr;
+}
+
+void GlobalSet::Compile(Compiler *compiler) {
+  AsForm(value_)->Compile(compiler);
+  compiler->Emit(Bytecode::kSetGlobal, {compiler->Constant(target_)}, 0);
+}
+
+void GlobalSet::Step(Machine *machine, std::shared_ptr<Scope> &) {
+  static_cast<GlobalRef *>(static_cast<Object *>(target_))->Binding();
+  machine->Push(this, 0);
+  machine->Eval(value_);
+}
+
+void GlobalSet::Resume(Machine *machine, MachineFrame *, Object *value) {
+  static_cast<GlobalRef *>(static_cast<Object *>(target_))->Store(value);
+  machine->Return(nullptr);
+}
+
+IfForm::IfForm(Object *condition, Object *then, Object *otherwise)
+    : condition_(condition), then_(then), otherwise_(otherwise),
+      immediate_(Immediate(condition)) {}
+
+void IfForm::VisitReferences(const ReferenceVisitor &visit) {
+  VisitRef(visit, condition_, RefKind::Strong);
+  VisitRef(visit, then_, RefKind::Strong);
+  VisitRef(visit, otherwise_, RefKind::Strong);
+}
+
+const char *IfForm::TypeName() const { return "if-form"; }
+
+size_t IfForm::AllocatedBytes() const { return sizeof(IfForm); }
+
+Object *IfForm::MoveTo(void *where) {
+  return new (where) IfForm(std::move(*this));
+}
+
+Object *IfForm::Eval(std::shared_ptr<Scope> &scope) {
+  auto result = condition_->Eval(scope);
+  if (result && !result->IsFalse())
+    return then_->Eval(scope);
+  return otherwise_ ? otherwise_->Eval(scope) : nullptr;
+}
+
+void IfForm::Tails(std::vector<Form *> *tails) {
+  AsForm(then_)->Tails(tails);
+  if (otherwise_)
+    AsForm(otherwise_)->Tails(tails);
+}
+
+void IfForm::Compile(Compiler *compiler) {
+  AsForm(condition_)->Compile(compiler);
+  auto otherwise = compiler->EmitJump(Bytecode::kJumpIfFalse, -1);
+  AsForm(then_)->Compile(compiler);
+  auto end = compiler->EmitJump(Bytecode::kJump, 0);
+  compiler->SetDepth(compiler->Depth() - 1);
+  compiler->Patch(otherwise);
+  if (otherwise_)
+    AsForm(otherwise_)->Compile(compiler);
+  else
+    compiler->Emit(Bytecode::kConst, {compiler->Constant(nullptr)}, 1);
+  compiler->Patch(end);
+}
+
+void IfForm::Step(Machine *machine, std::shared_ptr<Scope> &scope) {
+  if (immediate_)
+    return Resume(machine, nullptr, condition_->Eval(scope));
+  machine->Push(this, 0);
+  machine->Eval(condition_);
+}
+
+void IfForm::Resume(Machine *machine, MachineFrame *, Object *value) {
+  if (value && !value->IsFalse())
+    machine->Eval(then_);
+  else if (otherwise_)
+    machine->Eval(otherwise_);
+  else
+    machine->Return(nullptr);
+}
+
+JunctionForm::JunctionForm(bool conjunction, std::vector<Object *> operands)
+    : conjunction_(conjunction), operands_(ToRefs(std::move(operands))) {}
+
+void JunctionForm::VisitReferences(const ReferenceVisitor &visit) {
+  for (auto &operand : operands_)
+    VisitRef(visit, operand, RefKind::Strong);
+}
+
+const char *JunctionForm::TypeName() const {
+  return conjunction_ ? "and-form" : "or-form";
+}
+
+size_t JunctionForm::AllocatedBytes() const {
+  return sizeof(JunctionForm) + OutOfLineBytes(operands_);
+}
+
+Object *JunctionForm::MoveTo(void *where) {
+  return new (where) JunctionForm(std::move(*this));
+}
+
+Object *JunctionForm::Eval(std::shared_ptr<Scope> &scope) {
+  if (operands_.empty())
+    return Create<Boolean>(conjunction_);
+  for (size_t ind = 0; ind + 1 < operands_.size(); ++ind) {
+    auto res = operands_[ind]->Eval(scope);
+    bool truth = !res || !res->IsFalse();
+    if (conjunction_ != truth)
+      return conjunction_ ? Create<Boolean>(false) : res;
+  }
+  // Whatever the last operand is, it is the value.
+  return operands_.back()->Eval(scope);
+}
+
+void JunctionForm::Tails(std::vector<Form *> *tails) {
+  if (!operands_.empty())
+    AsForm(operands_.back())->Tails(tails);
+}
+
+void JunctionForm::Compile(Compiler *compiler) {
+  if (operands_.empty()) {
+    compiler->Emit(Bytecode::kConst,
+                   {compiler->Constant(Create<constant>(conjunction_))}, 1);
+    return;
+  }
+  auto jump =
+      conjunction_ ? Bytecode::kJumpIfFalseKeep : Bytecode::kJumpIfTrueKeep;
+  std::vector<size_t> ends;
+  for (size_t ind = 0; ind + 1 < operands_.size(); ++ind) {
+    AsForm(operands_[ind])->Compile(compiler);
+    // The value stays when the jump is taken, and is popped otherwise.
+    ends.push_back(compiler->EmitJump(jump, -1));
+  }
+  AsForm(operands_.back())->Compile(compiler);
+  for (auto end : ends)
+    compiler->Patch(end);
+}
+
+void JunctionForm::Step(Machine *machine, std::shared_ptr<Scope> &) {
+  if (operands_.empty())
+    return machine->Return(Create<Boolean>(conjunction_));
+  if (operands_.size() > 1)
+    machine->Push(this, 0);
+  machine->Eval(operands_[0]);
+}
+
+void JunctionForm::Resume(Machine *machine, MachineFrame *frame,
+                          Object *value) {
+  if (conjunction_ != IsTrue(value))
+    return machine->Return(conjunction_ ? Create<Boolean>(false) : value);
+  auto step = frame->Step() + 1;
+  if (step + 1 < operands_.size()) {
+    machine->Keep(frame);
+    frame->SetStep(step);
+  }
+  machine->Eval(operands_[step]);
+}
+
+SequenceForm::SequenceForm(std::vector<Object *> forms)
+    : forms_(ToRefs(std::move(forms))) {}
+
+void SequenceForm::VisitReferences(const ReferenceVisitor &visit) {
+  for (auto &form : forms_)
+    VisitRef(visit, form, RefKind::Strong);
+}
+
+const char *SequenceForm::TypeName() const { return "sequence-form"; }
+
+size_t SequenceForm::AllocatedBytes() const {
+  return sizeof(SequenceForm) + OutOfLineBytes(forms_);
+}
+
+Object *SequenceForm::MoveTo(void *where) {
+  return new (where) SequenceForm(std::move(*this));
+}
+
+Object *SequenceForm::Eval(std::shared_ptr<Scope> &scope) {
+  Object *result = nullptr;
+  for (auto &form : forms_)
+    result = form->Eval(scope);
+  return result;
+}
+
+void SequenceForm::Tails(std::vector<Form *> *tails) {
+  if (!forms_.empty())
+    AsForm(forms_.back())->Tails(tails);
+}
+
+void SequenceForm::Compile(Compiler *compiler) {
+  if (forms_.empty())
+    compiler->Emit(Bytecode::kConst, {compiler->Constant(nullptr)}, 1);
+  for (size_t ind = 0; ind < forms_.size(); ++ind) {
+    if (ind)
+      compiler->Emit(Bytecode::kPop, {}, -1);
+    AsForm(forms_[ind])->Compile(compiler);
+  }
+}
+
+void SequenceForm::Step(Machine *machine, std::shared_ptr<Scope> &) {
+  StepSequence(machine, this, nullptr, forms_);
+}
+
+void SequenceForm::Resume(Machine *machine, MachineFrame *frame, Object *) {
+  StepSequence(machine, this, frame, forms_);
+}
+
+GuardForm::GuardForm(const std::vector<Guard> &guards, Object *fast,
+                     Object *slow)
+    : fast_(fast), slow_(slow) {
+  for (const auto &guard : guards) {
+    globals_.emplace_back(guard.global);
+    values_.emplace_back(guard.value);
+  }
+}
+
+void GuardForm::VisitReferences(const ReferenceVisitor &visit) {
+  for (auto &global : globals_)
+    VisitRef(visit, global, RefKind::Strong);
+  for (auto &value : values_)
+    VisitRef(visit, value, RefKind::Strong);
+  VisitRef(visit, fast_, RefKind::Strong);
+  VisitRef(visit, slow_, RefKind::Strong);
+}
+
+const char *GuardForm::TypeName() const { return "guard-form"; }
+
+size_t GuardForm::AllocatedBytes() const {
+  return sizeof(GuardForm) + OutOfLineBytes(globals_) +
+         OutOfLineBytes(values_);
+}
+
+Object *GuardForm::MoveTo(void *where) {
+  return new (where) GuardForm(std::move(*this));
+}
+
+void GuardForm::AppendGuards(std::vector<Guard> *guards) const {
+  for (size_t ind = 0; ind < globals_.size(); ++ind)
+    guards->push_back(
+        {static_cast<GlobalRef *>(static_cast<Object *>(globals_[ind])),
+         values_[ind]});
+}
+
+bool GuardForm::Holds() {
+  for (size_t ind = 0; ind < globals_.size(); ++ind) {
+    auto binding =
+        static_cast<GlobalRef *>(static_cast<Object *>(globals_[ind]))
+            ->Lookup();
+    if (!binding || *binding != values_[ind])
+      return false;
+  }
+  return true;
+}
+
+Object *GuardForm::Eval(std::shared_ptr<Scope> &scope) {
+  return Holds() ? fast_->Eval(scope) : slow_->Eval(scope);
+}
+
+void GuardForm::Tails(std::vector<Form *> *tails) {
+  AsForm(fast_)->Tails(tails);
+  AsForm(slow_)->Tails(tails);
+}
+
+void GuardForm::Compile(Compiler *compiler) {
+  std::vector<size_t> slow;
+  for (size_t ind = 0; ind < globals_.size(); ++ind)
+    slow.push_back(compiler->EmitGuard(globals_[ind], values_[ind]));
+  AsForm(fast_)->Compile(compiler);
+  auto end = compiler->EmitJump(Bytecode::kJump, 0);
+  compiler->SetDepth(compiler->Depth() - 1);
+  for (auto target : slow)
+    compiler->Patch(target);
+  AsForm(slow_)->Compile(compiler);
+  compiler->Patch(end);
+}
+
+void GuardForm::Step(Machine *machine, std::shared_ptr<Scope> &) {
+  machine->Eval(Holds() ? fast_ : slow_);
+}
+
+LoopForm::LoopForm(std::vector<LocalRef *> vars, std::vector<Object *> inits)
+    : vars_(ToRefs(std::move(vars))), inits_(ToRefs(std::move(inits))) {}
+
+void LoopForm::VisitReferences(const ReferenceVisitor &visit) {
+  for (auto &var : vars_)
+    VisitRef(visit, var, RefKind::Strong);
+  for (auto &init : inits_)
+    VisitRef(visit, init, RefKind::Strong);
+  VisitRef(visit, body_, RefKind::Strong);
+}
+
+const char *LoopForm::TypeName() const { return "loop-form"; }
+
+size_t LoopForm::AllocatedBytes() const {
+  return sizeof(LoopForm) + OutOfLineBytes(vars_) + OutOfLineBytes(inits_);
+}
+
+Object *LoopForm::MoveTo(void *where) {
+  return new (where) LoopForm(std::move(*this));
+}
+
+Object *LoopForm::Eval(std::shared_ptr<Scope> &scope) {
+  // The initial values cannot see the variables: they may be set in turn.
+  for (size_t ind = 0; ind < vars_.size(); ++ind)
+    Var(ind)->Slot(scope.get()) = inits_[ind]->Eval(scope);
+  Object *result;
+  do
+    result = body_->Eval(scope);
+  while (result == this);
+  return result;
+}
+
+void LoopForm::Compile(Compiler *compiler) {
+  for (size_t ind = 0; ind < vars_.size(); ++ind) {
+    AsForm(inits_[ind])->Compile(compiler);
+    Var(ind)->CompileStore(compiler);
+    compiler->Emit(Bytecode::kPop, {}, -1);
+  }
+  start_ = compiler->Here();
+  AsForm(body_)->Compile(compiler);
+}
+
+void LoopForm::Step(Machine *machine, std::shared_ptr<Scope> &) {
+  if (vars_.empty())
+    return machine->Eval(body_);
+  machine->Push(this, 0);
+  machine->Eval(inits_[0]);
+}
+
+void LoopForm::Resume(Machine *machine, MachineFrame *frame, Object *value) {
+  auto step = frame->Step();
+  Var(step)->Slot(frame->GetScope().get()) = value;
+  if (++step == vars_.size())
+    return machine->Eval(body_);
+  machine->Keep(frame);
+  frame->SetStep(step);
+  machine->Eval(inits_[step]);
+}
+
+void LoopForm::Tails(std::vector<Form *> *tails) {
+  AsForm(body_)->Tails(tails);
+}
+
+RecurForm::RecurForm(LoopForm *loop, std::vector<Object *> args)
+    : loop_(loop), args_(ToRefs(std::move(args))) {}
+
+void RecurForm::VisitReferences(const ReferenceVisitor &visit) {
+  VisitRef(visit, loop_, RefKind::Strong);
+  for (auto &arg : args_)
+    VisitRef(visit, arg, RefKind::Strong);
+}
+
+const char *RecurForm::TypeName() const { return "recur-form"; }
+
+size_t RecurForm::AllocatedBytes() const {
+  return sizeof(RecurForm) + OutOfLineBytes(args_);
+}
+
+Object *RecurForm::MoveTo(void *where) {
+  return new (where) RecurForm(std::move(*this));
+}
+
+Object *RecurForm::Eval(std::shared_ptr<Scope> &scope) {
+  // The values stay rooted on the arena until they are stored.
+  FrameArena::Args values(FrameArena::Current(), args_.size());
+  for (size_t ind = 0; ind < args_.size(); ++ind)
+    values[ind] = args_[ind]->Eval(scope);
+  for (size_t ind = 0; ind < args_.size(); ++ind)
+    Loop()->Var(ind)->Slot(scope.get()) = values[ind];
+  return Loop();
+}
+
+void RecurForm::Compile(Compiler *compiler) {
+  auto depth = compiler->Depth();
+  for (auto &arg : args_)
+    AsForm(arg)->Compile(compiler);
+  for (size_t ind = args_.size(); ind-- > 0;) {
+    Loop()->Var(ind)->CompileStore(compiler);
+    compiler->Emit(Bytecode::kPop, {}, -1);
+  }
+  compiler->Emit(Bytecode::kJump, {Loop()->Start()}, 0);
+  // Nothing follows in the body: the depth is that of a value left there.
+  compiler->SetDepth(depth + 1);
+}
+
+// On the machine the body runs again in place of the RecurForm, which is in
+// tail position of it.
+void RecurForm::Step(Machine *machine, std::shared_ptr<Scope> &) {
+  if (args_.empty())
+    return machine->Eval(Loop()->Body());
+  machine->Push(this, args_.size());
+  machine->Eval(args_[0]);
+}
+
+void RecurForm::Resume(Machine *machine, MachineFrame *frame, Object *value) {
+  auto &values = frame->Values();
+  auto step = frame->Step();
+  values[step] = value;
+  if (++step < args_.size()) {
+    machine->Keep(frame);
+    frame->SetStep(step);
+    return machine->Eval(args_[step]);
+  }
+  for (size_t ind = 0; ind < args_.size(); ++ind)
+    Loop()->Var(ind)->Slot(frame->GetScope().get()) = values[ind];
+  machine->Eval(Loop()->Body());
+}
+
+LambdaForm::LambdaForm(std::vector<Object *> params, size_t frame_size,
+                       std::vector<Object *> body, bool in_arena,
+                       bool on_machine)
+    : params_(ToRefs(std::move(params))), frame_size_(frame_size),
+      body_(ToRefs(std::move(body))), in_arena_(in_arena),
+      on_machine_(on_machine) {}
+
+void LambdaForm::VisitReferences(const ReferenceVisitor &visit) {
+  for (auto &param : params_)
+    VisitRef(visit, param, RefKind::Strong);
+  for (auto &form : body_)
+    VisitRef(visit, form, RefKind::Strong);
+  for (auto &form : source_)
+    VisitRef(visit, form, RefKind::Strong);
+  if (!bytecode_)
+    return;
+  for (auto &constant : bytecode_->constants)
+    VisitRef(visit, constant, RefKind::Strong);
+  for (auto &cache : bytecode_->caches)
+    VisitRef(visit, cache.function, RefKind::Strong);
+}
+
+const char *LambdaForm::TypeName() const { return "lambda-form"; }
+
+size_t LambdaForm::AllocatedBytes() const {
+  return sizeof(LambdaForm) + OutOfLineBytes(params_) + OutOfLineBytes(body_) +
+         OutOfLineBytes(source_) +
+         (bytecode_ ? bytecode_->AllocatedBytes() : 0);
+}
+
+Object *LambdaForm::MoveTo(void *where) {
+  return new (where) LambdaForm(std::move(*this));
+}
+
+void LambdaForm::SetBytecode(std::shared_ptr<Bytecode> bytecode) {
+  auto before = AllocatedBytes();
+  bytecode_ = std::move(bytecode);
+  GCManager::GetInstance().AccountResize(before, AllocatedBytes());
+}
+
+Object *LambdaForm::Eval(std::shared_ptr<Scope> &scope) {
+  return Create<LambdaFunction>(scope, this);
+}
+
+void LambdaForm::Compile(Compiler *compiler) {
+  Compiler::Compile(this);
+  compiler->Emit(Bytecode::kClosure, {compiler->Constant(this)}, 1);
+}
+
+void LambdaForm::CompileBody(Compiler *compiler) {
+  if (body_.empty())
+    compiler->Emit(Bytecode::kConst, {compiler->Constant(nullptr)}, 1);
+  for (size_t ind = 0; ind < body_.size(); ++ind) {
+    if (ind)
+      compiler->Emit(Bytecode::kPop, {}, -1);
+    AsForm(body_[ind])->Compile(compiler);
+  }
+}
+
+void LambdaForm::Enter(Machine *machine) {
+  StepSequence(machine, this, nullptr, body_);
+}
+
+void LambdaForm::Resume(Machine *machine, MachineFrame *frame, Object *) {
+  StepSequence(machine, this, frame, body_);
+}
+
+Object *LambdaForm::Run(std::shared_ptr<Scope> &scope) {
+  if (on_machine_) {
+    Machine machine;
+    return machine.Run(this, scope);
+  }
+  if (bytecode_)
+    return Jit::GetInstance().Run(bytecode_.get(), scope,
+                                  in_arena_ ? frame_size_ : 0);
+  Object *result = nullptr;
+  for (auto &form : body_)
+    result = form->Eval(scope);
+  return result;
+}
+
+CallForm::CallForm(Object *function, std::vector<Object *> args)
+    : function_(function), args_(ToRefs(std::move(args))),
+      global_head_(Is<GlobalRef>(function)),
+      immediate_(Immediate(function) &&
+                 std::ranges::all_of(args_, [](Object *arg) {
+                   return Immediate(arg);
+                 })) {}
+
+void CallForm::VisitReferences(const ReferenceVisitor &visit) {
+  VisitRef(visit, function_, RefKind::Strong);
+  for (auto &arg : args_)
+    VisitRef(visit, arg, RefKind::Strong);
+  VisitRef(visit, cached_, RefKind::Strong);
+}
+
+const char *CallForm::TypeName() const { return "call-form"; }
+
+size_t CallForm::AllocatedBytes() const {
+  return sizeof(CallForm) + OutOfLineBytes(args_);
+}
+
+Object *CallForm::MoveTo(void *where) {
+  return new (where) CallForm(std::move(*this));
+}
+
+Function *CallForm::Callee(std::shared_ptr<Scope> &scope) {
+  if (!global_head_)
+    return AsFunction(function_->Eval(scope));
+  auto global = static_cast<GlobalRef *>(static_cast<Object *>(function_));
+  if (cached_ && cached_version_ == global->Version())
+    return static_cast<Function *>(static_cast<Object *>(cached_));
+  auto fn = AsFunction(global->Eval(scope));
+  cached_ = fn;
+  cached_version_ = global->Version();
+  return fn;
+}
+
+void CallForm::Compile(Compiler *compiler) {
+  if (global_head_) {
+    for (auto &arg : args_)
+      AsForm(arg)->Compile(compiler);
+    uint32_t argc = args_.size();
+    compiler->Emit(tail_ ? Bytecode::kTailCallGlobal : Bytecode::kCallGlobal,
+                   {compiler->Constant(function_), argc, compiler->Cache()},
+                   1 - static_cast<int>(argc));
+    return;
+  }
+  AsForm(function_)->Compile(compiler);
+  for (auto &arg : args_)
+    AsForm(arg)->Compile(compiler);
+  uint32_t argc = args_.size();
+  compiler->Emit(tail_ ? Bytecode::kTailCall : Bytecode::kCall, {argc},
+                 -static_cast<int>(argc));
+}
+
+Object *CallForm::Eval(std::shared_ptr<Scope> &scope) {
+  auto fn = Callee(scope);
+  if (!fn)
+    throw RuntimeError("First element of the list must be a function");
+
+  // The function and the arguments stay rooted on the arena until the call
+  // returns.
+  FrameArena::Args slots(FrameArena::Current(), args_.size() + 1);
+  slots[0] = fn;
+  for (size_t ind = 0; ind < args_.size(); ++ind)
+    slots[ind + 1] = args_[ind]->Eval(scope);
+  auto args = slots.Span(1);
+  if (tail_)
+    if (auto lambda = Is<LambdaFunction>(fn)) {
+      auto &pending = LambdaFunction::PendingTailCall();
+      pending.fn = lambda;
+      pending.args.assign(args.begin(), args.end());
+      return nullptr;
+    }
+  return fn->Apply(scope, args);
+}
+
+void CallForm::Step(Machine *machine, std::shared_ptr<Scope> &scope) {
+  // Nothing runs before the call, which needs no frame.
+  if (immediate_) {
+    FrameArena::Args slots(FrameArena::Current(), args_.size() + 1);
+    slots[0] = Callee(scope);
+    for (size_t ind = 0; ind < args_.size(); ++ind)
+      slots[ind + 1] = args_[ind]->Eval(scope);
+    return machine->Apply(slots[0], slots.Span(1));
+  }
+  if (!global_head_) {
+    machine->Push(this, args_.size() + 1);
+    return machine->Eval(function_);
+  }
+  auto fn = Callee(scope);
+  if (args_.empty())
+    return machine->Apply(fn, {});
+  auto frame = machine->Push(this, args_.size() + 1);
+  frame->Values()[0] = fn;
+  frame->SetStep(1);
+  machine->Eval(args_[0]);
+}
+
+void CallForm::Resume(Machine *machine, MachineFrame *frame, Object *value) {
+  auto &values = frame->Values();
+  auto step = frame->Step();
+  values[step] = value;
+  if (++step < values.size()) {
+    machine->Keep(frame);
+    frame->SetStep(step);
+    return machine->Eval(args_[step - 1]);
+  }
+  // The frame, held by the machine until the next one is resumed, keeps the
+  // arguments rooted.
+  machine->Apply(values[0], ArgSpan(values).subspan(1));
+}
+
+Resolver::Resolver(Scope *global) : global_(global), level_(opt_level_) {}
+
+template <typename T, typename... Args> T *Resolver::Make(Args &&...args) {
+  auto form = Create<T>(std::forward<Args>(args)...);
+  lock_.Lock(form);
+  return form;
+}
+
+LambdaForm *Resolver::ResolveLambda(Object *params,
+                                    std::span<Object *const> body) {
+  if (params && !IsCell(params))
+    throw SyntaxError("Bad argument list!");
+  auto param_list = ToVector(params);
+  if (!frames_.empty())
+    frames_.back().captured = true;
+  auto &frame = frames_.emplace_back();
+  for (auto param : param_list) {
+    if (!IsSymbol(param) || Is<Boolean>(param))
+      throw SyntaxError("wrong argument name");
+    frame.names.push_back(AsSymbol(param)->GetName());
+  }
+
+  DeclareDefines(body);
+
+  std::vector<Object *> forms;
+  for (auto form : body)
+    forms.push_back(Resolve(form));
+  if (!forms.empty())
+    AsForm(forms.back())->MarkTail();
+
+  // Without nested lambdas nothing can refer to the frame after the call,
+  // unless a continuation the machine captures does.
+  auto done = std::move(frames_.back());
+  frames_.pop_back();
+  bool in_arena = !done.captured && !on_machine_;
+  if (in_arena)
+    for (auto ref : done.refs)
+      ref->MoveToArena();
+  auto size = param_list.size();
+  auto lambda = Make<LambdaForm>(std::move(param_list), done.names.size(),
+                                 std::move(forms), in_arena, on_machine_);
+  // Only a lambda without locals of its own besides the parameters, and
+  // closing over nothing but globals, can have its body inlined.
+  size_t budget = kInlineAtoms;
+  if (!done.captured && frames_.empty() && done.names.size() == size &&
+      std::ranges::all_of(body, [&](Object *form) {
+        return Fits(form, &budget);
+      }))
+    lambda->SetSource(body);
+  return lambda;
+}
+
+LambdaForm *Resolver::ResolveTopLevel(Object *form) {
+  auto body = Resolve(form);
+  return Make<LambdaForm>(std::vector<Object *>{}, 0,
+                          std::vector<Object *>{body}, true, on_machine_);
+}
+
+Object *Resolver::Resolve(Object *form) {
+  if (IsSymbol(form) && !Is<Boolean>(form)) {
+    if (auto local = FindLocal(AsSymbol(form)); local)
+      return local;
+    return Make<GlobalRef>(GlobalName(AsSymbol(form)), global_);
+  }
+  if (!IsCell(form))
+    return Make<ConstantForm>(form);
+
+  if (auto macro = Is<Macro>(Keyword(form)); macro)
+    return Resolve(macro->Expand(AsCell(form), &lock_));
+  if (auto name = SpecialFormName(form); name)
+    return ResolveSpecial(*name, AsCell(form));
+  return ResolveCall(AsCell(form));
+}
+
+Object *Resolver::ResolveCall(Cell *form) {
+  std::vector<Object *> args;
+  for (auto arg : ToVector(form->GetSecond()))
+    args.push_back(Resolve(arg));
+  // A loop called from its own frame iterates; anywhere else, or with the
+  // wrong number of arguments, the call needs a closure.
+  auto head = form->GetFirst();
+  size_t frame, slot;
+  if (!loops_.empty() && IsSymbol(head) &&
+      Lookup(AsSymbol(head)->GetName(), &frame, &slot)) {
+    auto loop = FindLoop(frame, slot);
+    if (loop && frame + 1 == frames_.size() &&
+        args.size() == loop->form->VarCount()) {
+      auto recur = Make<RecurForm>(loop->form, std::move(args));
+      loop->recurs.push_back(recur);
+      return recur;
+    }
+  }
+  auto function = Resolve(head);
+  if (auto folded = Fold(function, args); folded)
+    return folded;
+  if (auto inlined = Inline(function, args); inlined)
+    return inlined;
+  return Make<CallForm>(function, std::move(args));
+}
+
+Object *Resolver::ResolveSpecial(const std::string &name, Cell *form) {
+  auto args = ToVector(form->GetSecond());
+  if (name == "quote") {
+    CheckSize(args, 1, 1);
+    return Make<ConstantForm>(args[0]);
+  }
+  if (name == "if") {
+    CheckSize(args, 2, 3);
+    auto condition = Resolve(args[0]);
+    auto then = Resolve(args[1]);
+    auto otherwise = args.size() == 3 ? Resolve(args[2]) : nullptr;
+    if (auto folded = FoldIf(condition, then, otherwise); folded)
+      return folded;
+    return Make<IfForm>(condition, then, otherwise);
+  }
+  if (name == "and" || name == "or") {
+    std::vector<Object *> operands;
+    for (auto arg : args)
+      operands.push_back(Resolve(arg));
+    if (auto folded = FoldJunction(name == "and", operands); folded)
+      return folded;
+    return Make<JunctionForm>(name == "and", std::move(operands));
+  }
+  if (name == "lambda") {
+    CheckSize(args, 2, SIZE_MAX);
+    return ResolveLambda(
+        args[0], std::span<Object *const>(args.begin() + 1, args.end()));
+  }
+  if (name == "define" || name == "define-memoized")
+    return ResolveDefine(args, name == "define-memoized");
+  if (name == "let" || name == "let*" || name == "letrec" || name == "do")
+    return ResolveLet(name, form);
+  if (name == "define-syntax") {
+    CheckSize(args, 2, 2);
+    if (!frames_.empty())
+      throw SyntaxError("define-syntax is only allowed at top level");
+    if (!IsSymbol(args[0]))
+      throw SyntaxError("wrong macro name");
+    auto macro = SyntaxRules(AsSymbol(args[0]), args[1]);
+    lock_.Lock(macro);
+    return Make<GlobalDefine>(AsSymbol(args[0]), global_,
+                              Make<ConstantForm>(macro));
+  }
+  if (name == "set!") {
+    CheckSize(args, 2, 2);
+    if (!IsSymbol(args[0]))
+      throw RuntimeError("Trying to set something that is not a variable");
+    return ResolveSet(AsSymbol(args[0]), Resolve(args[1]));
+  }
+  throw SyntaxError("Unsupported special form: " + name);
+}
+
+Object *Resolver::ResolveDefine(const std::vector<Object *> &args,
+                                bool memoized) {
+  CheckSize(args, 2, SIZE_MAX);
+  Symbol *name;
+  Object *value;
+  if (memoized && !IsCell(args[0]))
+    throw SyntaxError("define-memoized expects (name params...)");
+  if (IsSymbol(args[0])) {
+    CheckSize(args, 2, 2);
+    name = AsSymbol(args[0]);
+    if (!frames_.empty())
+      DeclareLocal(name);
+    value = Resolve(args[1]);
+  } else {
+    if (!IsCell(args[0]) || !IsSymbol(AsCell(args[0])->GetFirst()))
+      throw SyntaxError("wrong function name");
+    name = AsSymbol(AsCell(args[0])->GetFirst());
+    if (!frames_.empty())
+      DeclareLocal(name);
+    value = ResolveLambda(
+        AsCell(args[0])->GetSecond(),
+        std::span<Object *const>(args.begin() + 1, args.end()));
+  }
+  // Called through a builtin of its own, which `memoize` may not be any
+  // more.
+  if (memoized) {
+    auto memoize = CreateBuiltin("memoize");
+    lock_.Lock(memoize);
+    value = Make<CallForm>(Make<ConstantForm>(memoize),
+                           std::vector<Object *>{value});
+  }
+  if (frames_.empty())
+    return Make<GlobalDefine>(GlobalName(name), global_, value);
+  return ResolveSet(name, value);
+}
+
+Object *Resolver::ResolveSet(Symbol *name, Object *value) {
+  if (auto local = FindLocal(name); local)
+    return Make<LocalSet>(local, value);
+  return Make<GlobalSet>(Make<GlobalRef>(GlobalName(name), global_), value);
+}
+
+Object *Resolver::ResolveLet(const std::string &name, Cell *form) {
+  // At the top level there is no frame to bind in: the form runs as the
+  // body of a lambda without parameters.
+  if (frames_.empty()) {
+    Object *body[] = {form};
+    return Make<CallForm>(ResolveLambda(nullptr, body),
+                          std::vector<Object *>{});
+  }
+  auto args = ToVector(form->GetSecond());
+  if (name == "do")
+    return ResolveDo(args);
+  CheckSize(args, 2, SIZE_MAX);
+  if (name == "let" && IsSymbol(args[0]) && !Is<Boolean>(args[0])) {
+    CheckSize(args, 3, SIZE_MAX);
+    return ResolveNamedLet(
+        AsSymbol(args[0]), args[1],
+        std::span<Object *const>(args.begin() + 2, args.end()));
+  }
+
+  auto bindings = BindingList(args[0], 2);
+  auto first = frames_.back().names.size();
+  std::vector<Object *> forms;
+  if (name == "let") {
+    std::vector<Object *> inits;
+    for (const auto &binding : bindings)
+      inits.push_back(Resolve(binding[1]));
+    for (size_t ind = 0; ind < bindings.size(); ++ind)
+      forms.push_back(
+          Make<LocalSet>(Bind(AsSymbol(bindings[ind][0])), inits[ind]));
+  } else if (name == "let*") {
+    for (const auto &binding : bindings) {
+      auto init = Resolve(binding[1]);
+      forms.push_back(Make<LocalSet>(Bind(AsSymbol(binding[0])), init));
+    }
+  } else {
+    std::vector<LocalRef *> vars;
+    for (const auto &binding : bindings)
+      vars.push_back(Bind(AsSymbol(binding[0])));
+    for (size_t ind = 0; ind < bindings.size(); ++ind)
+      forms.push_back(Make<LocalSet>(vars[ind], Resolve(bindings[ind][1])));
+  }
+  forms.push_back(
+      ResolveBody(std::span<Object *const>(args.begin() + 1, args.end()),
+                  first));
+  Unbind(first);
+  return Make<SequenceForm>(std::move(forms));
+}
+
+Object *Resolver::ResolveNamedLet(Symbol *name, Object *bindings,
+                                  std::span<Object *const> body) {
+  std::vector<Object *> vars, inits;
+  for (const auto &binding : BindingList(bindings, 2)) {
+    vars.push_back(binding[0]);
+    inits.push_back(Resolve(binding[1]));
+  }
+  if (auto loop = ResolveLoop(name, vars, inits, body); loop)
+    return loop;
+
+  // Otherwise the name is bound to a closure in the body.
+  auto first = frames_.back().names.size();
+  auto self = Bind(name);
+  Object *params = nullptr;
+  for (auto it = vars.rbegin(); it != vars.rend(); ++it)
+    params = Make<Cell>(*it, params);
+  auto lambda = ResolveLambda(params, body);
+  Unbind(first);
+  return Make<SequenceForm>(std::vector<Object *>{
+      Make<LocalSet>(self, lambda), Make<CallForm>(self, std::move(inits))});
+}
+
+Object *Resolver::ResolveLoop(Symbol *name, const std::vector<Object *> &vars,
+                              const std::vector<Object *> &inits,
+                              std::span<Object *const> body) {
+  auto first = frames_.back().names.size();
+  frames_.back().names.push_back(name->GetName());
+  std::vector<LocalRef *> refs;
+  for (auto var : vars)
+    refs.push_back(Bind(AsSymbol(var)));
+  auto loop = Make<LoopForm>(std::move(refs), inits);
+  loops_.push_back({frames_.size() - 1, first, loop, {}, false});
+  Object *resolved;
+  bool captures;
+  try {
+    captures = Captures([&] { resolved = ResolveBody(body, first); });
+  } catch (...) {
+    loops_.pop_back();
+    throw;
+  }
+  auto done = std::move(loops_.back());
+  loops_.pop_back();
+  Unbind(first);
+
+  // A closure made in the body would see the variables of later iterations
+  // in the slots; with one call per iteration each has its own.
+  std::vector<Form *> tails;
+  AsForm(resolved)->Tails(&tails);
+  if (captures || done.escapes ||
+      std::ranges::any_of(done.recurs, [&](Form *recur) {
+        return std::ranges::find(tails, recur) == tails.end();
+      }))
+    return nullptr;
+  loop->SetBody(resolved);
+  return loop;
+}
+
+Object *Resolver::ResolveDo(const std::vector<Object *> &args) {
+  CheckSize(args, 2, SIZE_MAX);
+  auto bindings = BindingList(args[0], 3);
+  if (!IsCell(args[1]))
+    throw SyntaxError("bad do test");
+  auto exit = ToVector(args[1]);
+  std::vector<Object *> inits;
+  for (const auto &binding : bindings)
+    inits.push_back(Resolve(binding[1]));
+
+  auto first = frames_.back().names.size();
+  std::vector<LocalRef *> vars;
+  for (const auto &binding : bindings)
+    vars.push_back(Bind(AsSymbol(binding[0])));
+  auto loop = Make<LoopForm>(vars, std::move(inits));
+  Object *test;
+  std::vector<Object *> result, commands, steps;
+  auto captures = Captures([&] {
+    test = Resolve(exit[0]);
+    for (size_t ind = 1; ind < exit.size(); ++ind)
+      result.push_back(Resolve(exit[ind]));
+    for (size_t ind = 2; ind < args.size(); ++ind)
+      commands.push_back(Resolve(args[ind]));
+    // A variable without a step keeps its value.
+    for (size_t ind = 0; ind < bindings.size(); ++ind)
+      steps.push_back(bindings[ind].size() == 3 ? Resolve(bindings[ind][2])
+                                                : vars[ind]);
+  });
+  Unbind(first);
+  // As for a named let, a closure made in the loop needs a call per
+  // iteration.
+  if (captures)
+    return ResolveDoCalls(bindings, exit,
+                          std::span<Object *const>(args.begin() + 2,
+                                                   args.end()));
+  commands.push_back(Make<RecurForm>(loop, std::move(steps)));
+
+  Object *done = result.empty() ? Make<ConstantForm>(nullptr)
+                 : result.size() == 1 ? result[0]
+                                      : Make<SequenceForm>(std::move(result));
+  Object *again = commands.size() == 1
+                      ? commands[0]
+                      : Make<SequenceForm>(std::move(commands));
+  loop->SetBody(Make<IfForm>(test, done, again));
+  return loop;
+}
+
+// The loop is the named let
+//   (let do%loop ((var init) ...)
+//     (if test (let () result ...) (let () command ... (do%loop step ...))))
+// written with renamed keywords, which no local binding can shadow.
+Object *Resolver::ResolveDoCalls(
+    const std::vector<std::vector<Object *>> &bindings,
+    const std::vector<Object *> &exit, std::span<Object *const> commands) {
+  auto keyword = [&](const char *name) {
+    return Make<Symbol>(std::string(name) + "%do");
+  };
+  auto list = [&](std::vector<Object *> items, Object *tail = nullptr) {
+    for (auto it = items.rbegin(); it != items.rend(); ++it)
+      tail = Make<Cell>(*it, tail);
+    return tail;
+  };
+  auto name = Make<Symbol>("do%loop");
+  std::vector<Object *> inits, steps;
+  for (const auto &binding : bindings) {
+    inits.push_back(list({binding[0], binding[1]}));
+    steps.push_back(binding.size() == 3 ? binding[2] : binding[0]);
+  }
+  auto done = exit.size() == 1
+                  ? list({keyword("quote"), nullptr})
+                  : list({keyword("let"), nullptr},
+                         list({exit.begin() + 1, exit.end()}));
+  auto again = list({keyword("let"), nullptr},
+                    list({commands.begin(), commands.end()},
+                         list({list({name}, list(steps))})));
+  Object *body[] = {list({keyword("if"), exit[0], done, again})};
+  return ResolveNamedLet(name, list(inits), body);
+}
+
+Object *Resolver::ResolveBody(std::span<Object *const> body, size_t first) {
+  auto outer = std::exchange(frames_.back().body, first);
+  DeclareDefines(body);
+  std::vector<Object *> forms;
+  for (auto form : body)
+    forms.push_back(Resolve(form));
+  frames_.back().body = outer;
+  return forms.size() == 1 ? forms[0] : Make<SequenceForm>(std::move(forms));
+}
+
+Object *Resolver::Keyword(Object *form) const {
+  if (!IsCell(form) || !IsSymbol(AsCell(form)->GetFirst()))
+    return nullptr;
+  const auto &name = AsSymbol(AsCell(form)->GetFirst())->GetName();
+  for (const auto &frame : frames_)
+    if (std::find(frame.names.begin(), frame.names.end(), name) !=
+        frame.names.end())
+      return nullptr;
+  auto it = global_->variables_.find(std::string(Unrenamed(name)));
+  return it == global_->variables_.end() ? nullptr : it->second;
+}
+
+const std::string *Resolver::SpecialFormName(Object *form) const {
+  auto special = Is<SpecialForm>(Keyword(form));
+  return special ? &special->GetName() : nullptr;
+}
+
+Symbol *Resolver::GlobalName(Symbol *name) {
+  if (!IsRenamed(name->GetName()))
+    return name;
+  return Make<Symbol>(std::string(Unrenamed(name->GetName())));
+}
+
+void Resolver::DeclareDefines(std::span<Object *const> body) {
+  // Internal defines get their slots before the body is resolved, so that
+  // they are visible to the whole body.
+  for (auto form : body) {
+    auto name = SpecialFormName(form);
+    if (!name || (*name != "define" && *name != "define-memoized") ||
+        !IsCell(AsCell(form)->GetSecond()))
+      continue;
+    auto target = AsCell(AsCell(form)->GetSecond())->GetFirst();
+    if (IsCell(target))
+      target = AsCell(target)->GetFirst();
+    if (IsSymbol(target))
+      DeclareLocal(AsSymbol(target));
+  }
+}
+
+Object *Resolver::Fold(Object *function, const std::vector<Object *> &args) {
+  if (level_ < OptLevel::Fold)
+    return nullptr;
+  auto global = Is<GlobalRef>(function);
+  auto binding = global ? global->Lookup() : nullptr;
+  if (!binding || !*binding || typeid(**binding) != typeid(Function))
+    return nullptr;
+  auto fn = static_cast<Function *>(*binding);
+  bool numeric = std::ranges::find(kArithmetic, fn->GetApplyMethod()) !=
+                 std::end(kArithmetic);
+  if (!numeric && std::ranges::find(kPredicates, fn->GetApplyMethod()) ==
+                      std::end(kPredicates))
+    return nullptr;
+
+  Guards guards{{global, fn}};
+  // Held by the constant forms.
+  std::vector<Object *> values;
+  for (auto arg : args) {
+    Object *value;
+    if (!KnownValue(arg, &value, &guards) || (numeric && !IsNumber(value)))
+      return nullptr;
+    values.push_back(value);
+  }
+  Object *result;
+  try {
+    fn->CheckSignature(values);
+    result = fn->GetApplyMethod()(values);
+  } catch (const std::runtime_error &) {
+    // Left for the call to report when it runs.
+    return nullptr;
+  }
+  lock_.Lock(result);
+  return Make<GuardForm>(guards, Make<ConstantForm>(result),
+                         Make<CallForm>(function, args));
+}
+
+Object *Resolver::FoldIf(Object *condition, Object *then, Object *otherwise) {
+  Object *value;
+  if (level_ < OptLevel::Fold || !Constant(condition, &value))
+    return nullptr;
+  auto taken = IsTrue(value) ? then : otherwise;
+  return taken ? taken : Make<ConstantForm>(nullptr);
+}
+
+Object *Resolver::FoldJunction(bool conjunction,
+                               const std::vector<Object *> &operands) {
+  if (level_ < OptLevel::Fold)
+    return nullptr;
+  // Constant operands that do not decide the value are dropped, unless
+  // last; one that does ends the junction.
+  std::vector<Object *> kept;
+  for (size_t ind = 0; ind < operands.size(); ++ind) {
+    Object *value;
+    if (!Constant(operands[ind], &value)) {
+      kept.push_back(operands[ind]);
+      continue;
+    }
+    if (IsTrue(value) != conjunction) {
+      kept.push_back(operands[ind]);
+      break;
+    }
+    if (ind + 1 == operands.size())
+      kept.push_back(operands[ind]);
+  }
+  if (kept.size() == operands.size())
+    return nullptr;
+  return kept.size() == 1 ? kept[0] : Make<JunctionForm>(conjunction, kept);
+}
+
+Object *Resolver::Inline(Object *function, const std::vector<Object *> &args) {
+  if (level_ < OptLevel::Inline || inlining_ || frames_.empty())
+    return nullptr;
+  auto global = Is<GlobalRef>(function);
+  auto binding = global ? global->Lookup() : nullptr;
+  auto callee = binding ? Is<LambdaFunction>(*binding) : nullptr;
+  if (!callee || callee->GetScope().get() != global_)
+    return nullptr;
+  auto code = callee->GetCode();
+  const auto &source = code->Source();
+  if (source.empty() || code->ParamCount() != args.size() ||
+      std::ranges::any_of(source, [&](Object *form) {
+        return Mentions(form, global->Name());
+      }))
+    return nullptr;
+
+  // The body is resolved again in slots appended to the caller's frame,
+  // with the caller's own names hidden from it: it only sees its
+  // parameters and globals.
+  auto first = frames_.back().names.size();
+  auto outer = std::exchange(frames_, {});
+  auto outer_loops = std::exchange(loops_, {});
+  auto &frame = frames_.emplace_back();
+  frame.names.assign(first, "");
+  std::vector<Object *> slots;
+  for (size_t ind = 0; ind < args.size(); ++ind) {
+    frame.names.push_back(code->Param(ind)->GetName());
+    slots.push_back(Make<LocalRef>(code->Param(ind), 0, first + ind));
+    frame.refs.push_back(static_cast<LocalRef *>(slots.back()));
+  }
+  std::vector<Object *> body;
+  bool resolved = true;
+  inlining_ = true;
+  try {
+    for (auto form : source)
+      body.push_back(Resolve(form));
+  } catch (const std::runtime_error &) {
+    // Special forms the body uses have been redefined since.
+    resolved = false;
+  }
+  inlining_ = false;
+  auto done = std::move(frames_.back());
+  frames_ = std::move(outer);
+  loops_ = std::move(outer_loops);
+  if (!resolved)
+    return nullptr;
+
+  auto &caller = frames_.back();
+  caller.names.resize(done.names.size());
+  caller.refs.insert(caller.refs.end(), done.refs.begin(), done.refs.end());
+
+  // The arguments go to the slots first, so that neither path evaluates
+  // them again; the call made once the guard fails takes them from there.
+  std::vector<Object *> forms;
+  for (size_t ind = 0; ind < args.size(); ++ind)
+    forms.push_back(Make<LocalSet>(static_cast<LocalRef *>(slots[ind]),
+                                   args[ind]));
+  forms.push_back(Make<GuardForm>(
+      Guards{{global, callee}},
+      body.size() == 1 ? body[0] : Make<SequenceForm>(std::move(body)),
+      Make<CallForm>(function, std::move(slots))));
+  return Make<SequenceForm>(std::move(forms));
+}
+
+bool Resolver::Lookup(const std::string &name, size_t *frame,
+                      size_t *slot) const {
+  for (size_t depth = 0; depth < frames_.size(); ++depth) {
+    *frame = frames_.size() - 1 - depth;
+    // Variables of binding forms shadow the earlier names of their frame.
+    const auto &names = frames_[*frame].names;
+    auto it = std::find(names.rbegin(), names.rend(), name);
+    if (it != names.rend()) {
+      *slot = names.rend() - it - 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+LocalRef *Resolver::FindLocal(Symbol *name) {
+  size_t frame, slot;
+  if (!Lookup(name->GetName(), &frame, &slot))
+    return nullptr;
+  if (auto loop = FindLoop(frame, slot); loop)
+    loop->escapes = true;
+  auto depth = frames_.size() - 1 - frame;
+  auto ref = Make<LocalRef>(name, static_cast<uint32_t>(depth),
+                            static_cast<uint32_t>(slot));
+  frames_.back().refs.push_back(ref);
+  return ref;
+}
+
+size_t Resolver::DeclareLocal(Symbol *name) {
+  auto &frame = frames_.back();
+  auto &names = frame.names;
+  auto end = names.rend() - frame.body;
+  auto it = std::find(names.rbegin(), end, name->GetName());
+  if (it != end)
+    return names.rend() - it - 1;
+  names.push_back(name->GetName());
+  return names.size() - 1;
+}
+
+LocalRef *Resolver::Bind(Symbol *name) {
+  auto &frame = frames_.back();
+  frame.names.push_back(name->GetName());
+  auto ref = Make<LocalRef>(name, 0,
+                            static_cast<uint32_t>(frame.names.size() - 1));
+  frame.refs.push_back(ref);
+  return ref;
+}
+
+void Resolver::Unbind(size_t first) {
+  auto &names = frames_.back().names;
+  std::fill(names.begin() + first, names.end(), "");
+}
+
+Resolver::Loop *Resolver::FindLoop(size_t frame, size_t slot) {
+  for (auto &loop : loops_)
+    if (loop.frame == frame && loop.slot == slot)
+      return &loop;
+  return nullptr;
+}
@@ -0,0 +1,668 @@
+#pragma once
+
+#include "cek.h"
+#include "frame_arena.h"
+#include "gc.h"
+#include "parser.h"
+#include "vm.h"
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Resolved code. Lambda bodies are translated once, when the closure is
+// created, into a tree of forms: variable references are bound to a slot
+// of an enclosing frame or to a global, and special forms are recognised
+// up front. Evaluating a form never hashes a variable name.
+//
+// A frame holds the parameters and internal defines of one call. Lambdas
+// that create closures get a Scope per call, whose slots_ are the frame and
+// whose parent_ is the frame the closure was created in. The frames of all
+// other lambdas cannot outlive the call and are pushed on the FrameArena,
+// unless the lambdas run on the CEK machine (cek.h).
+class Form : public Object {
+public:
+  virtual void MarkRelated(GCMark mark = GCMark::Black) override;
+
+  // Emits bytecode that leaves the value of the form on the operand stack.
+  virtual void Compile(Compiler *compiler) = 0;
+
+  // Evaluates the form on the CEK machine (cek.h), telling it what to do
+  // next; by default, to return what Eval gives. Forms with parts that may
+  // call push a frame and have the machine evaluate the parts instead.
+  virtual void Step(Machine *machine, std::shared_ptr<Scope> &scope);
+
+  // Goes on from `frame`, which the form pushed, once the form evaluated
+  // after it has returned `value`. The frame has been popped.
+  virtual void Resume(Machine *machine, MachineFrame *frame, Object *value);
+
+  // The form's value is the value of its lambda's body: calls in it become
+  // tail calls.
+  void MarkTail();
+
+  // Appends the forms whose value is the value of this one: the form
+  // itself, or the tails of the forms it takes its value from.
+  virtual void Tails(std::vector<Form *> *tails) { tails->push_back(this); }
+
+  virtual void PrintTo(std::ostream *out) const override;
+  virtual void PrintDebug(std::ostream *out) const override;
+
+protected:
+  // Called by MarkTail on each of the tails.
+  virtual void SetTail() {}
+};
+
+class ConstantForm : public Form {
+public:
+  explicit ConstantForm(Object *value);
+
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &) override;
+  virtual void Compile(Compiler *compiler) override;
+
+  Object *Value() const { return value_; }
+
+private:
+  Ref<Object> value_;
+};
+
+// Slot `index` of the innermost arena frame, or of the Scope `depth` levels
+// up from the one the code runs in.
+class LocalRef : public Form {
+public:
+  LocalRef(Symbol *name, uint32_t depth, uint32_t index);
+
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &scope) override;
+  virtual void Compile(Compiler *compiler) override;
+
+  Object *&Slot(Scope *frame) const {
+    if (in_arena_)
+      return FrameArena::Current()->Slot(index_);
+    for (auto depth = depth_; depth; --depth)
+      frame = frame->parent_.get();
+    return frame->slots_[index_];
+  }
+
+  // Rebases the reference for a lambda whose frame is on the arena: its own
+  // slots move there, and enclosing frames are one Scope closer.
+  void MoveToArena() {
+    if (depth_ == 0)
+      in_arena_ = true;
+    else
+      --depth_;
+  }
+
+  // Emits a store of the top of the operand stack to the slot.
+  void CompileStore(Compiler *compiler);
+
+private:
+  Ref<Object> name_;
+  uint32_t depth_;
+  uint32_t index_;
+  bool in_arena_ = false;
+};
+
+// Variable of the global scope. The first evaluation binds the reference
+// to the variable's entry in the global table; entries are never removed
+// while the interpreter lives, so later evaluations read it directly.
+class GlobalRef : public Form {
+public:
+  GlobalRef(Symbol *name, Scope *global);
+
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  // Prints the name of the variable.
+  virtual void PrintTo(std::ostream *out) const override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &) override;
+  virtual void Compile(Compiler *compiler) override;
+
+  // The variable's value cell; throws NameError while it is not defined.
+  Object *&Binding();
+
+  // Likewise, but nullptr while it is not defined.
+  Object **Lookup();
+
+  const std::string &Name() const;
+
+  void Store(Object *value) {
+    Binding() = value;
+    ++global_->version_;
+  }
+
+  uint64_t Version() const { return global_->version_; }
+
+  // Binds itself on the first evaluation.
+  virtual bool Freezable() const override { return false; }
+
+private:
+  Ref<Object> name_;
+  // Owned by the closures that run this code.
+  Scope *global_;
+  Object **binding_ = nullptr;
+};
+
+// `set!` or internal `define` of a frame slot.
+class LocalSet : public Form {
+public:
+  LocalSet(LocalRef *target, Object *value);
+
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &scope) override;
+  virtual void Compile(Compiler *compiler) override;
+  virtual void Step(Machine *machine, std::shared_ptr<Scope> &scope) override;
+  virtual void Resume(Machine *machine, MachineFrame *frame,
+                      Object *value) override;
+
+private:
+  Ref<Object> target_;
+  Ref<Object> value_;
+};
+
+// Top-level `define` in resolved code.
+class GlobalDefine : public Form {
+public:
+  GlobalDefine(Symbol *name, Scope *global, Object *value);
+
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &scope) override;
+  virtual void Compile(Compiler *compiler) override;
+  virtual void Step(Machine *machine, std::shared_ptr<Scope> &scope) override;
+  virtual void Resume(Machine *machine, MachineFrame *frame,
+                      Object *value) override;
+
+  void Define(Object *value) {
+    global_->Assign(static_cast<Symbol *>(static_cast<Object *>(name_)), value);
+  }
+
+private:
+  Ref<Object> name_;
+  Scope *global_;
+  Ref<Object> value_;
+};
+
+// `set!` of an existing global.
+class GlobalSet : public Form {
+public:
+  GlobalSet(GlobalRef *target, Object *value);
+
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &scope) override;
+  virtual void Compile(Compiler *compiler) override;
+  virtual void Step(Machine *machine, std::shared_ptr<Scope> &scope) override;
+  virtual void Resume(Machine *machine, MachineFrame *frame,
+                      Object *value) override;
+
+private:
+  Ref<Object> target_;
+  Ref<Object> value_;
+};
+
+class IfForm : public Form {
+public:
+  IfForm(Object *condition, Object *then, Object *otherwise);
+
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &scope) override;
+  virtual void Compile(Compiler *compiler) override;
+  virtual void Step(Machine *machine, std::shared_ptr<Scope> &scope) override;
+  virtual void Resume(Machine *machine, MachineFrame *frame,
+                      Object *value) override;
+  virtual void Tails(std::vector<Form *> *tails) override;
+
+private:
+  Ref<Object> condition_;
+  Ref<Object> then_;
+  Ref<Object> otherwise_;
+  // The machine evaluates the condition in place.
+  bool immediate_;
+};
+
+// `and` when `conjunction` is set, `or` otherwise.
+class JunctionForm : public Form {
+public:
+  JunctionForm(bool conjunction, std::vector<Object *> operands);
+
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &scope) override;
+  virtual void Compile(Compiler *compiler) override;
+  virtual void Step(Machine *machine, std::shared_ptr<Scope> &scope) override;
+  virtual void Resume(Machine *machine, MachineFrame *frame,
+                      Object *value) override;
+  virtual void Tails(std::vector<Form *> *tails) override;
+
+private:
+  bool conjunction_;
+  std::vector<Ref<Object>> operands_;
+};
+
+// Forms evaluated in order; the value is the last one's. Built by the
+// optimizer for inlined calls.
+class SequenceForm : public Form {
+public:
+  explicit SequenceForm(std::vector<Object *> forms);
+
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &scope) override;
+  virtual void Compile(Compiler *compiler) override;
+  virtual void Step(Machine *machine, std::shared_ptr<Scope> &scope) override;
+  virtual void Resume(Machine *machine, MachineFrame *frame,
+                      Object *value) override;
+  virtual void Tails(std::vector<Form *> *tails) override;
+
+private:
+  std::vector<Ref<Object>> forms_;
+};
+
+// Code the optimizer specialized for the values some globals held when it
+// ran: `fast` runs while every one of them still holds its value, and
+// `slow`, the code as written, once one has been defined or assigned anew.
+class GuardForm : public Form {
+public:
+  struct Guard {
+    GlobalRef *global;
+    Object *value;
+  };
+
+  GuardForm(const std::vector<Guard> &guards, Object *fast, Object *slow);
+
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &scope) override;
+  virtual void Compile(Compiler *compiler) override;
+  virtual void Step(Machine *machine, std::shared_ptr<Scope> &scope) override;
+  virtual void Tails(std::vector<Form *> *tails) override;
+
+  Object *Fast() const { return fast_; }
+
+  void AppendGuards(std::vector<Guard> *guards) const;
+
+private:
+  bool Holds();
+
+  std::vector<Ref<Object>> globals_;
+  std::vector<Ref<Object>> values_;
+  Ref<Object> fast_;
+  Ref<Object> slow_;
+};
+
+// A named `let` or a `do` whose iterations are jumps: the variables are
+// slots of the enclosing frame, set to the initial values, and RecurForm,
+// in tail position of the body, sets them anew and runs the body again.
+class LoopForm : public Form {
+public:
+  LoopForm(std::vector<LocalRef *> vars, std::vector<Object *> inits);
+
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &scope) override;
+  virtual void Compile(Compiler *compiler) override;
+  virtual void Step(Machine *machine, std::shared_ptr<Scope> &scope) override;
+  virtual void Resume(Machine *machine, MachineFrame *frame,
+                      Object *value) override;
+  virtual void Tails(std::vector<Form *> *tails) override;
+
+  // Set once the body, which refers to the loop, is resolved.
+  void SetBody(Object *body) { body_ = body; }
+  Object *Body() const { return body_; }
+
+  size_t VarCount() const { return vars_.size(); }
+  LocalRef *Var(size_t index) const {
+    return static_cast<LocalRef *>(static_cast<Object *>(vars_[index]));
+  }
+
+  // Where the bytecode of the body starts.
+  uint32_t Start() const { return start_; }
+
+private:
+  std::vector<Ref<Object>> vars_;
+  std::vector<Ref<Object>> inits_;
+  Ref<Object> body_ = nullptr;
+  uint32_t start_ = 0;
+};
+
+// The next iteration of a loop: its variables get the values of `args`,
+// all computed before any is set. Evaluates to the LoopForm itself, which
+// no program can see as a value, for the loop to run its body again: forms
+// may be frozen and shared, so they keep no state of a run.
+class RecurForm : public Form {
+public:
+  RecurForm(LoopForm *loop, std::vector<Object *> args);
+
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &scope) override;
+  virtual void Compile(Compiler *compiler) override;
+  virtual void Step(Machine *machine, std::shared_ptr<Scope> &scope) override;
+  virtual void Resume(Machine *machine, MachineFrame *frame,
+                      Object *value) override;
+
+private:
+  LoopForm *Loop() const {
+    return static_cast<LoopForm *>(static_cast<Object *>(loop_));
+  }
+
+  Ref<Object> loop_;
+  std::vector<Ref<Object>> args_;
+};
+
+// Code of a lambda. Evaluating it creates a closure over the current frame.
+class LambdaForm : public Form {
+public:
+  LambdaForm(std::vector<Object *> params, size_t frame_size,
+             std::vector<Object *> body, bool in_arena, bool on_machine);
+
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &scope) override;
+  virtual void Compile(Compiler *compiler) override;
+  // Resumes the body, which Enter started.
+  virtual void Resume(Machine *machine, MachineFrame *frame,
+                      Object *value) override;
+
+  size_t ParamCount() const { return params_.size(); }
+  Symbol *Param(size_t index) const {
+    return static_cast<Symbol *>(static_cast<Object *>(params_[index]));
+  }
+
+  size_t FrameSize() const { return frame_size_; }
+
+  // No closure is created in the body, so frames go on the FrameArena.
+  bool InArena() const { return in_arena_; }
+
+  // Resolved for the CEK machine (cek.h): calls run the body on it.
+  bool OnMachine() const { return on_machine_; }
+
+  // Has the machine evaluate the body in the current scope, the call's
+  // own frame.
+  void Enter(Machine *machine);
+
+  // Slots the bytecode needs for its operand stack, 0 if not compiled.
+  size_t StackSize() const { return bytecode_ ? bytecode_->max_stack : 0; }
+
+  // Evaluates the body and returns the value of its last form, with the
+  // bytecode if there is some, or on a machine of its own when OnMachine().
+  // `scope` is the call's own frame, or the closure's scope when InArena().
+  // The innermost arena frame holds the operand stack after the lambda's
+  // arena slots.
+  Object *Run(std::shared_ptr<Scope> &scope);
+
+  Bytecode *GetBytecode() const { return bytecode_.get(); }
+  // Attaches the compiled body, whose size the form reports from then on.
+  void SetBytecode(std::shared_ptr<Bytecode> bytecode);
+
+  // Emits the body, leaving the value of its last form.
+  void CompileBody(Compiler *compiler);
+
+  // The body as it was read, kept for lambdas small enough to inline;
+  // empty for the others.
+  const std::vector<Ref<Object>> &Source() const { return source_; }
+  void SetSource(std::span<Object *const> body) {
+    source_.assign(body.begin(), body.end());
+  }
+
+private:
+  std::vector<Ref<Object>> params_;
+  size_t frame_size_;
+  std::vector<Ref<Object>> body_;
+  std::vector<Ref<Object>> source_;
+  bool in_arena_;
+  bool on_machine_;
+  // Shared by the copies MoveTo makes. Kept outside the object, so that
+  // the caches in it stay writable when the form is frozen.
+  std::shared_ptr<Bytecode> bytecode_;
+};
+
+// Calls through a global keep a monomorphic inline cache: the function the
+// global held when it was last read, valid until the global scope's version
+// changes. A call of a closure in tail position hands the call to the Apply
+// running the body (LambdaFunction::TailCall) instead of making it. On the
+// machine the values of the function and the arguments go to the frame.
+class CallForm : public Form {
+public:
+  CallForm(Object *function, std::vector<Object *> args);
+
+  virtual void VisitReferences(const ReferenceVisitor &visit) override;
+
+  virtual const char *TypeName() const override;
+  virtual size_t AllocatedBytes() const override;
+  virtual Object *MoveTo(void *where) override;
+
+  virtual Object *Eval(std::shared_ptr<Scope> &scope) override;
+  virtual void Compile(Compiler *compiler) override;
+  virtual void Step(Machine *machine, std::shared_ptr<Scope> &scope) override;
+  virtual void Resume(Machine *machine, MachineFrame *frame,
+                      Object *value) override;
+
+  // Caches its callee.
+  virtual bool Freezable() const override { return false; }
+
+protected:
+  virtual void SetTail() override { tail_ = true; }
+
+private:
+  Function *Callee(std::shared_ptr<Scope> &scope);
+
+  Ref<Object> function_;
+  std::vector<Ref<Object>> args_;
+  bool global_head_;
+  // The function and the arguments are variables or constants.
+  bool immediate_;
+  bool tail_ = false;
+  Ref<Object> cached_ = nullptr;
+  uint64_t cached_version_ = 0;
+};
+
+// What the resolver optimizes: nothing; calls of pure builtins on known
+// values, which are made once, and branches of `if`, `and` and `or` that
+// constant conditions rule out; or also calls of small lambdas, which are
+// inlined.
+enum class OptLevel { None, Fold, Inline };
+
+// Translates lambda expressions into forms. Special forms and macros are
+// recognised by the global binding of the head symbol when it is not
+// shadowed locally; macro uses are expanded and the expansion translated.
+// Every form created is guarded until the resolver is destroyed.
+//
+// Optimizations rely on what globals hold while the code is resolved; the
+// code they produce checks that they still do (GuardForm), and runs the
+// code as written otherwise.
+class Resolver {
+public:
+  explicit Resolver(Scope *global);
+
+  // The level of the resolvers created from now on. Process-wide, like the
+  // JIT: SchemeInterpreter sets its own on every Eval.
+  static void SetOptLevel(OptLevel level) { opt_level_ = level; }
+  static OptLevel GetOptLevel() { return opt_level_; }
+
+  // Whether the lambdas resolved from now on run on the CEK machine
+  // (cek.h). Their frames are all Scopes: a continuation the machine
+  // captures may return into a call after it has returned.
+  static void SetMachine(bool on_machine) { on_machine_ = on_machine; }
+
+  // `params` is the parameter list of the lambda.
+  LambdaForm *ResolveLambda(Object *params, std::span<Object *const> body);
+
+  // A top-level form, as the body of a lambda without parameters that runs
+  // in the global scope. `define` in it binds globals.
+  LambdaForm *ResolveTopLevel(Object *form);
+
+private:
+  using Guards = std::vector<GuardForm::Guard>;
+
+  template <typename T, typename... Args> T *Make(Args &&...args);
+
+  Object *Resolve(Object *form);
+  Object *ResolveCall(Cell *form);
+  Object *ResolveSpecial(const std::string &name, Cell *form);
+  // `define`, or with `memoized` `define-memoized`, which binds the name to
+  // the function wrapped by `memoize`.
+  Object *ResolveDefine(const std::vector<Object *> &args, bool memoized);
+  Object *ResolveSet(Symbol *name, Object *value);
+
+  // `let`, `let*`, `letrec`, named `let` and `do`; their variables take
+  // slots of the innermost frame, which the body alone sees.
+  Object *ResolveLet(const std::string &name, Cell *form);
+  Object *ResolveNamedLet(Symbol *name, Object *bindings,
+                          std::span<Object *const> body);
+  // The loop of a named `let`, or nullptr unless every use of the name in
+  // the body is a call in tail position and the body makes no closure.
+  Object *ResolveLoop(Symbol *name, const std::vector<Object *> &vars,
+                      const std::vector<Object *> &inits,
+                      std::span<Object *const> body);
+  Object *ResolveDo(const std::vector<Object *> &args);
+  // A `do` whose iterations are calls of a closure, as a named `let`.
+  Object *ResolveDoCalls(const std::vector<std::vector<Object *>> &bindings,
+                         const std::vector<Object *> &exit,
+                         std::span<Object *const> commands);
+  // The body of a binding form, internal defines included, whose variables
+  // take the slots from `first` on.
+  Object *ResolveBody(std::span<Object *const> body, size_t first);
+
+  // The global value of the symbol `form` starts with, when no local
+  // shadows it: a special form or a macro is recognised by it.
+  Object *Keyword(Object *form) const;
+
+  // Name of the special form `form` starts with, or nullptr.
+  const std::string *SpecialFormName(Object *form) const;
+
+  // The global variable `name` stands for: a symbol renamed by a macro
+  // expansion (macro.h) that no local binds refers to the global of its
+  // original name.
+  Symbol *GlobalName(Symbol *name);
+
+  // Gives the internal defines of `body` their slots in the innermost
+  // frame.
+  void DeclareDefines(std::span<Object *const> body);
+
+  // The optimizations; each returns nullptr where it does not apply, and
+  // otherwise a form guarded on the globals it relied on, if any.
+  Object *Fold(Object *function, const std::vector<Object *> &args);
+  Object *FoldIf(Object *condition, Object *then, Object *otherwise);
+  Object *FoldJunction(bool conjunction, const std::vector<Object *> &operands);
+  Object *Inline(Object *function, const std::vector<Object *> &args);
+
+  // Where the innermost binding of the local `name` is.
+  bool Lookup(const std::string &name, size_t *frame, size_t *slot) const;
+  LocalRef *FindLocal(Symbol *name);
+  size_t DeclareLocal(Symbol *name);
+
+  // Binds `name` to a new slot of the innermost frame.
+  LocalRef *Bind(Symbol *name);
+  // Hides the names of the innermost frame from slot `first` on; the
+  // slots stay taken.
+  void Unbind(size_t first);
+
+  struct Frame {
+    std::vector<std::string> names;
+    // Set when a lambda is nested in this one.
+    bool captured = false;
+    // References made from this lambda's own body.
+    std::vector<LocalRef *> refs;
+    // First slot of the innermost body being resolved: its defines reuse
+    // no slot before it.
+    size_t body = 0;
+  };
+
+  // A named `let` being resolved as a loop. Its name is slot `slot` of
+  // frame `frame`; calls of it become RecurForms, and other uses make it
+  // escape.
+  struct Loop {
+    size_t frame;
+    size_t slot;
+    LoopForm *form;
+    std::vector<Form *> recurs;
+    bool escapes = false;
+  };
+
+  // The loop whose name the local variable in slot `slot` of frame `frame`
+  // is, or nullptr.
+  Loop *FindLoop(size_t frame, size_t slot);
+
+  // Runs `resolve`, and tells whether it created a lambda nested in the
+  // innermost frame.
+  template <typename Resolve> bool Captures(Resolve resolve) {
+    auto &frame = frames_.back();
+    auto captured = std::exchange(frame.captured, false);
+    resolve();
+    auto captures = frames_.back().captured;
+    frames_.back().captured = captured || captures;
+    return captures;
+  }
+
+  static inline OptLevel opt_level_ = OptLevel::Inline;
+  static inline bool on_machine_ = false;
+
+  Scope *global_;
+  OptLevel level_;
+  // Set while the body of an inlined lambda is resolved: calls in it are
+  // not inlined in turn.
+  bool inlining_ = false;
+  std::vector<Frame> frames_;
+  std::vector<Loop> loops_;
+  GCManager::SafeLock lock_;
+};
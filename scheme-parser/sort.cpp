@@ -0,0 +1,174 @@
+#include "sort.h"
+#include "create.h"
+#include "frame_arena.h"
+#include "parser.h"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+bool IsTrue(const Object *obj) { return !obj || !obj->IsFalse(); }
+
+using Key = std::pair<int64_t, Object *>;
+
+// Sorts the halves on two threads, down to `depth` levels, and merges
+// them. Only the keys are touched, never the heap, so the collector does
+// not need to know about the threads.
+template <typename Compare>
+void ParallelSort(Key *first, Key *last, Compare compare, unsigned depth) {
+  if (depth == 0 || static_cast<size_t>(last - first) < kParallelSortSize) {
+    std::stable_sort(first, last, compare);
+    return;
+  }
+  auto middle = first + (last - first) / 2;
+  {
+    std::jthread left(
+        [=] { ParallelSort(first, middle, compare, depth - 1); });
+    ParallelSort(middle, last, compare, depth - 1);
+  }
+  std::inplace_merge(first, middle, last, compare);
+}
+
+// Sorts by value, if `less` is the builtin < or > and all items are
+// numbers; the comparator itself is never called.
+bool SortNumbers(Function *less, std::span<Object *> items) {
+  auto apply = less->GetApplyMethod();
+  if (apply != Less && apply != More)
+    return false;
+  std::vector<Key> keys;
+  keys.reserve(items.size());
+  for (auto item : items) {
+    if (!IsNumber(item))
+      return false;
+    keys.emplace_back(AsNumber(item)->GetValue(), item);
+  }
+  auto threads = std::max(std::thread::hardware_concurrency(), 1u);
+  auto depth = std::min<unsigned>(std::bit_width(threads) - 1, 3);
+  if (apply == Less)
+    ParallelSort(
+        keys.data(), keys.data() + keys.size(),
+        [](const Key &lhs, const Key &rhs) { return lhs.first < rhs.first; },
+        depth);
+  else
+    ParallelSort(
+        keys.data(), keys.data() + keys.size(),
+        [](const Key &lhs, const Key &rhs) { return lhs.first > rhs.first; },
+        depth);
+  for (size_t ind = 0; ind < items.size(); ++ind)
+    items[ind] = keys[ind].second;
+  return true;
+}
+
+// Bottom-up: runs of 1, 2, 4 ... items are merged back and forth between
+// `items` and a buffer in the arena, which roots what is being moved.
+void MergeSort(Function *less, std::span<Object *> items) {
+  auto size = items.size();
+  FrameArena::Args buffer(FrameArena::Current(), size);
+  FrameArena::Args pair(FrameArena::Current(), 2);
+  std::shared_ptr<Scope> nullscope = nullptr;
+  // The right item goes first only if it is less than the left one, so
+  // equal items keep their order.
+  auto right_first = [&](Object *left, Object *right) {
+    pair[0] = right;
+    pair[1] = left;
+    return IsTrue(less->Apply(nullscope, pair.Span()));
+  };
+
+  std::span<Object *> from = items, to(&buffer[0], size);
+  for (size_t width = 1; width < size; width *= 2) {
+    for (size_t low = 0; low < size; low += 2 * width) {
+      auto middle = std::min(low + width, size);
+      auto high = std::min(low + 2 * width, size);
+      auto left = low, right = middle, out = low;
+      while (left < middle && right < high)
+        to[out++] = right_first(from[left], from[right]) ? from[right++]
+                                                         : from[left++];
+      out = std::copy(from.begin() + left, from.begin() + middle,
+                      to.begin() + out) -
+            to.begin();
+      std::copy(from.begin() + right, from.begin() + high, to.begin() + out);
+    }
+    std::swap(from, to);
+  }
+  if (from.data() != items.data())
+    std::copy(from.begin(), from.end(), items.begin());
+}
+
+Function *AsComparator(Object *less, const char *who) {
+  if (!IsFunction(less))
+    throw RuntimeError(std::string(who) + ": comparator must be a function");
+  return AsFunction(less);
+}
+
+Object *SortList(Object *list, Object *less, const char *who) {
+  auto fn = AsComparator(less, who);
+  size_t count = 0;
+  for (auto cell = list; cell; cell = AsCell(cell)->GetSecond(), ++count)
+    if (!IsCell(cell))
+      throw RuntimeError(std::string(who) + ": argument must be a list");
+  if (!count)
+    return nullptr;
+
+  // The items, then the new list, consed from the back.
+  FrameArena::Args items(FrameArena::Current(), count + 1);
+  auto cell = list;
+  for (size_t ind = 0; ind < count; ++ind, cell = AsCell(cell)->GetSecond())
+    items[ind] = AsCell(cell)->GetFirst();
+  SortObjects(fn, {&items[0], count});
+  for (size_t ind = count; ind-- > 0;)
+    items[count] = Create<Cell>(items[ind], items[count]);
+  return items[count];
+}
+
+// Sorts a copy in the arena, which the comparator cannot change, and
+// stores it into `to`, which may be `from`.
+void SortVector(Vector *from, Vector *to, Function *less) {
+  auto size = from->Size();
+  if (!size)
+    return;
+  FrameArena::Args items(FrameArena::Current(), size);
+  for (size_t ind = 0; ind < size; ++ind)
+    items[ind] = from->Get(ind);
+  SortObjects(less, {&items[0], size});
+  for (size_t ind = 0; ind < size; ++ind)
+    to->Set(ind, items[ind]);
+}
+
+} // namespace
+
+void SortObjects(Function *less, std::span<Object *> items) {
+  if (items.size() < 2 || SortNumbers(less, items))
+    return;
+  MergeSort(less, items);
+}
+
+Object *Sort(ArgSpan args) {
+  if (!IsVector(args[0]))
+    return SortList(args[0], args[1], "sort");
+  auto less = AsComparator(args[1], "sort");
+  auto vector = AsVector(args[0]);
+  auto sorted = Create<Vector>(vector->Size());
+  FrameArena::Args root(FrameArena::Current(), 1);
+  root[0] = sorted;
+  SortVector(vector, sorted, less);
+  return sorted;
+}
+
+Object *ListSort(ArgSpan args) {
+  return SortList(args[1], args[0], "list-sort");
+}
+
+Object *VectorSort(ArgSpan args) {
+  auto vector = AsVector(args[0]);
+  if (!vector)
+    throw RuntimeError("vector-sort!: argument must be a vector");
+  vector->CheckMutable();
+  SortVector(vector, vector, AsComparator(args[1], "vector-sort!"));
+  return vector;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "parser.h"
+#include <span>
+
+// Stable merge sort by a comparator `less`, called as (less a b). When the
+// comparator is the builtin < or > and every element is a number, the
+// elements are sorted by value without calling it, in parallel when there
+// are more than kParallelSortSize of them; otherwise they are merged in
+// place in the FrameArena, one call of the comparator per comparison.
+inline constexpr size_t kParallelSortSize = size_t(1) << 14;
+
+// Sorts `items`, which the caller roots, for instance in the FrameArena.
+void SortObjects(Function *less, std::span<Object *> items);
+
+// `(sort sequence less)`, after SRFI-95: a new list or vector, the one
+// given is kept.
+Object *Sort(ArgSpan args);
+
+// `(list-sort less list)`: the same with the arguments of SRFI-132.
+Object *ListSort(ArgSpan args);
+
+// `(vector-sort! vector less)`: sorts the vector in place.
+Object *VectorSort(ArgSpan args);
@@ -0,0 +1,88 @@
+#include "vectors.h"
+#include "create.h"
+#include "frame_arena.h"
+#include "parser.h"
+#include <cstdint>
+#include <string>
+
+namespace {
+
+Vector *AsVectorArg(Object *obj, const char *who) {
+  if (!IsVector(obj))
+    throw RuntimeError(std::string(who) + ": argument must be a vector");
+  return AsVector(obj);
+}
+
+size_t AsIndex(Object *obj, size_t size, const char *who) {
+  if (!IsNumber(obj))
+    throw RuntimeError(std::string(who) + ": index must be a number");
+  auto index = AsNumber(obj)->GetValue();
+  if (index < 0 || static_cast<uint64_t>(index) >= size)
+    throw RuntimeError(std::string(who) + ": index out of range");
+  return static_cast<size_t>(index);
+}
+
+} // namespace
+
+Object *CheckVector(ArgSpan args) {
+  return Create<Boolean>(IsVector(args[0]));
+}
+
+Object *MakeVectorOf(ArgSpan args) {
+  auto vector = Create<Vector>(args.size());
+  for (size_t ind = 0; ind < args.size(); ++ind)
+    vector->Set(ind, args[ind]);
+  return vector;
+}
+
+Object *MakeVector(ArgSpan args) {
+  if (!IsNumber(args[0]) || AsNumber(args[0])->GetValue() < 0)
+    throw RuntimeError("make-vector: size must be a non-negative number");
+  auto size = static_cast<size_t>(AsNumber(args[0])->GetValue());
+  auto fill = args.size() > 1 ? args[1] : Create<Number>(int64_t(0));
+  return Create<Vector>(size, fill);
+}
+
+Object *VectorRef(ArgSpan args) {
+  auto vector = AsVectorArg(args[0], "vector-ref");
+  return vector->Get(AsIndex(args[1], vector->Size(), "vector-ref"));
+}
+
+Object *VectorSet(ArgSpan args) {
+  auto vector = AsVectorArg(args[0], "vector-set!");
+  vector->Set(AsIndex(args[1], vector->Size(), "vector-set!"), args[2]);
+  return vector;
+}
+
+Object *VectorLength(ArgSpan args) {
+  auto vector = AsVectorArg(args[0], "vector-length");
+  return Create<Number>(static_cast<int64_t>(vector->Size()));
+}
+
+// Consed from the back onto a rooted slot.
+Object *VectorToList(ArgSpan args) {
+  auto vector = AsVectorArg(args[0], "vector->list");
+  FrameArena::Args res(FrameArena::Current(), 1);
+  for (size_t ind = vector->Size(); ind-- > 0;)
+    res[0] = Create<Cell>(vector->Get(ind), res[0]);
+  return res[0];
+}
+
+Object *ListToVector(ArgSpan args) {
+  size_t size = 0;
+  for (auto cell = args[0]; cell; cell = AsCell(cell)->GetSecond(), ++size)
+    if (!IsCell(cell))
+      throw RuntimeError("list->vector: argument must be a list");
+  auto vector = Create<Vector>(size);
+  auto cell = args[0];
+  for (size_t ind = 0; ind < size; ++ind, cell = AsCell(cell)->GetSecond())
+    vector->Set(ind, AsCell(cell)->GetFirst());
+  return vector;
+}
+
+Object *VectorFill(ArgSpan args) {
+  auto vector = AsVectorArg(args[0], "vector-fill!");
+  for (size_t ind = 0; ind < vector->Size(); ++ind)
+    vector->Set(ind, args[1]);
+  return vector;
+}
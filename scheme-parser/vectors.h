@@ -0,0 +1,28 @@
+#pragma once
+
+#include "parser.h"
+
+// The vector builtins. Indices are checked against the size of the vector;
+// the ones that change a vector throw if it is frozen.
+
+Object *CheckVector(ArgSpan args);
+
+// `(vector obj ...)`.
+Object *MakeVectorOf(ArgSpan args);
+
+// `(make-vector size [fill])`: `size` elements, 0 unless `fill` is given.
+Object *MakeVector(ArgSpan args);
+
+Object *VectorRef(ArgSpan args);
+
+// `(vector-set! vector index obj)`: returns the vector.
+Object *VectorSet(ArgSpan args);
+
+Object *VectorLength(ArgSpan args);
+
+Object *VectorToList(ArgSpan args);
+
+Object *ListToVector(ArgSpan args);
+
+// `(vector-fill! vector obj)`: returns the vector.
+Object *VectorFill(ArgSpan args);
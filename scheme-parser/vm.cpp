@@ -0,0 +1,323 @@
+#include "vm.h"
+#include "create.h"
+#include "frame_arena.h"
+#include "gc.h"
+#include "jit.h"
+#include "parser.h"
+#include "resolver.h"
+#include <algorithm>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+// GCC and Clang dispatch through a table of label addresses, one indirect
+// jump per instruction; other compilers get a switch.
+#if defined(__GNUC__)
+#define SCHEME_VM_THREADED
+#endif
+
+namespace {
+
+struct OpInfo {
+  const char *name;
+  size_t operands;
+};
+
+constexpr OpInfo kOps[] = {
+    {"const", 1},          {"arena-ref", 1},        {"scope-ref", 2},
+    {"global-ref", 1},     {"set-arena", 1},        {"set-scope", 2},
+    {"set-global", 1},     {"define-global", 1},    {"pop", 0},
+    {"jump", 1},           {"jump-if-false", 1},    {"jump-if-false-keep", 1},
+    {"jump-if-true-keep", 1}, {"guard", 3},         {"closure", 1},
+    {"call", 1},           {"call-global", 3},      {"tail-call", 1},
+    {"tail-call-global", 3}, {"return", 0},
+};
+static_assert(std::size(kOps) == Bytecode::kOpCount);
+
+bool IsTrue(const Object *obj) { return !obj || !obj->IsFalse(); }
+
+template <typename T> T *As(const Ref<Object> &ref) {
+  return static_cast<T *>(static_cast<Object *>(ref));
+}
+
+} // namespace
+
+Bytecode::Bytecode() = default;
+
+Bytecode::~Bytecode() = default;
+
+size_t Bytecode::AllocatedBytes() const {
+  return sizeof(Bytecode) + OutOfLineBytes(code) + OutOfLineBytes(constants) +
+         OutOfLineBytes(caches);
+}
+
+size_t Bytecode::Length(size_t pc) const {
+  return 1 + kOps[code[pc]].operands;
+}
+
+void Bytecode::PrintInstruction(size_t pc, std::ostream *out) const {
+  const auto &op = kOps[code[pc]];
+  *out << pc << ": " << op.name;
+  for (size_t ind = 1; ind <= op.operands; ++ind)
+    *out << ' ' << code[pc + ind];
+  if (code[pc] == kConst || code[pc] == kGlobalRef ||
+      code[pc] == kCallGlobal || code[pc] == kTailCallGlobal) {
+    *out << "  ; ";
+    PrintTo(constants[code[pc + 1]], out);
+  } else if (code[pc] == kGuard) {
+    *out << "  ; ";
+    PrintTo(constants[code[pc + 2]], out);
+  }
+  *out << '\n';
+}
+
+void Bytecode::Disassemble(std::ostream *out) const {
+  for (size_t pc = 0; pc < code.size(); pc += Length(pc))
+    PrintInstruction(pc, out);
+}
+
+void Compiler::Compile(LambdaForm *code) {
+  if (code->GetBytecode())
+    return;
+  auto bytecode = std::make_shared<Bytecode>();
+  Compiler compiler(bytecode.get());
+  code->CompileBody(&compiler);
+  compiler.Emit(Bytecode::kReturn, {}, -1);
+  code->SetBytecode(std::move(bytecode));
+}
+
+uint32_t Compiler::Constant(Object *obj) {
+  auto &constants = bytecode_->constants;
+  auto it = std::find(constants.begin(), constants.end(), obj);
+  if (it != constants.end())
+    return it - constants.begin();
+  constants.push_back(obj);
+  return constants.size() - 1;
+}
+
+uint32_t Compiler::Cache() {
+  bytecode_->caches.emplace_back();
+  return bytecode_->caches.size() - 1;
+}
+
+void Compiler::Emit(Bytecode::Op op, std::initializer_list<uint32_t> operands,
+                    int stack_effect) {
+  bytecode_->code.push_back(op);
+  bytecode_->code.insert(bytecode_->code.end(), operands);
+  depth_ += stack_effect;
+  bytecode_->max_stack = std::max(bytecode_->max_stack, depth_);
+}
+
+size_t Compiler::EmitJump(Bytecode::Op op, int stack_effect) {
+  Emit(op, {0}, stack_effect);
+  return bytecode_->code.size() - 1;
+}
+
+size_t Compiler::EmitGuard(Object *global, Object *value) {
+  Emit(Bytecode::kGuard, {0, Constant(global), Constant(value)}, 0);
+  return bytecode_->code.size() - 3;
+}
+
+void Compiler::Patch(size_t target) {
+  bytecode_->code[target] = bytecode_->code.size();
+}
+
+Object *Execute(Bytecode *bytecode, std::shared_ptr<Scope> &scope,
+                size_t stack_base, size_t start, size_t depth) {
+  auto arena = FrameArena::Current();
+  const uint32_t *code = bytecode->code.data();
+  const uint32_t *pc = code + start;
+  auto sp = stack_base + depth;
+
+  auto push = [&](Object *obj) { arena->Slot(sp++) = obj; };
+  // Popped slots are cleared: the whole frame is a root.
+  auto pop = [&] {
+    auto &slot = arena->Slot(--sp);
+    auto obj = slot;
+    slot = nullptr;
+    return obj;
+  };
+  auto scope_slot = [&](uint32_t depth, uint32_t index) -> Object *& {
+    auto frame = scope.get();
+    for (; depth; --depth)
+      frame = frame->parent_.get();
+    return frame->slots_[index];
+  };
+  // Calls `fn` on the values from `first_arg` to the top. They stay on the
+  // stack, and so rooted, until the call returns.
+  auto call = [&](Function *fn, size_t first_arg) {
+    auto result =
+        fn->Apply(scope, ArgSpan(arena->Base() + first_arg, sp - first_arg));
+    while (sp > first_arg)
+      pop();
+    return result;
+  };
+  // Likewise for a call in tail position: a closure is left pending for the
+  // Apply that runs this code.
+  auto tail_call = [&](Function *fn, size_t first_arg) -> Object * {
+    auto lambda = Is<LambdaFunction>(fn);
+    if (!lambda)
+      return call(fn, first_arg);
+    auto &pending = LambdaFunction::PendingTailCall();
+    auto base = arena->Base();
+    pending.args.assign(base + first_arg, base + sp);
+    while (sp > first_arg)
+      pop();
+    pending.fn = lambda;
+    return nullptr;
+  };
+  // The function a kCallGlobal or kTailCallGlobal calls.
+  auto callee = [&](const uint32_t *operands) {
+    auto global = As<GlobalRef>(bytecode->constants[operands[0]]);
+    auto &cache = bytecode->caches[operands[2]];
+    if (cache.function && cache.version == global->Version())
+      return As<Function>(cache.function);
+    auto fn = AsFunction(global->Binding());
+    if (!fn)
+      throw RuntimeError("First element of the list must be a function");
+    cache.function = fn;
+    cache.version = global->Version();
+    return fn;
+  };
+
+#ifdef SCHEME_VM_THREADED
+  static const void *const kLabels[] = {
+      &&op_kConst,        &&op_kArenaRef,       &&op_kScopeRef,
+      &&op_kGlobalRef,    &&op_kSetArena,       &&op_kSetScope,
+      &&op_kSetGlobal,    &&op_kDefineGlobal,   &&op_kPop,
+      &&op_kJump,         &&op_kJumpIfFalse,    &&op_kJumpIfFalseKeep,
+      &&op_kJumpIfTrueKeep, &&op_kGuard,        &&op_kClosure,
+      &&op_kCall,         &&op_kCallGlobal,     &&op_kTailCall,
+      &&op_kTailCallGlobal, &&op_kReturn,
+  };
+  static_assert(std::size(kLabels) == Bytecode::kOpCount);
+#define CASE(op) op_##op
+#define DISPATCH() goto *kLabels[*pc++]
+  DISPATCH();
+#else
+#define CASE(op) case Bytecode::op
+#define DISPATCH() continue
+  while (true) {
+    switch (*pc++) {
+#endif
+
+  CASE(kConst) : {
+    push(bytecode->constants[pc[0]]);
+    pc += 1;
+    DISPATCH();
+  }
+  CASE(kArenaRef) : {
+    push(arena->Slot(pc[0]));
+    pc += 1;
+    DISPATCH();
+  }
+  CASE(kScopeRef) : {
+    push(scope_slot(pc[0], pc[1]));
+    pc += 2;
+    DISPATCH();
+  }
+  CASE(kGlobalRef) : {
+    push(As<GlobalRef>(bytecode->constants[pc[0]])->Binding());
+    pc += 1;
+    DISPATCH();
+  }
+  CASE(kSetArena) : {
+    arena->Slot(pc[0]) = pop();
+    push(nullptr);
+    pc += 1;
+    DISPATCH();
+  }
+  CASE(kSetScope) : {
+    scope_slot(pc[0], pc[1]) = pop();
+    push(nullptr);
+    pc += 2;
+    DISPATCH();
+  }
+  CASE(kSetGlobal) : {
+    As<GlobalRef>(bytecode->constants[pc[0]])->Store(pop());
+    push(nullptr);
+    pc += 1;
+    DISPATCH();
+  }
+  CASE(kDefineGlobal) : {
+    As<GlobalDefine>(bytecode->constants[pc[0]])->Define(pop());
+    push(nullptr);
+    pc += 1;
+    DISPATCH();
+  }
+  CASE(kPop) : {
+    pop();
+    DISPATCH();
+  }
+  CASE(kJump) : {
+    pc = code + pc[0];
+    DISPATCH();
+  }
+  CASE(kJumpIfFalse) : {
+    pc = IsTrue(pop()) ? pc + 1 : code + pc[0];
+    DISPATCH();
+  }
+  CASE(kJumpIfFalseKeep) : {
+    if (IsTrue(arena->Slot(sp - 1))) {
+      pop();
+      pc += 1;
+    } else {
+      pc = code + pc[0];
+    }
+    DISPATCH();
+  }
+  CASE(kJumpIfTrueKeep) : {
+    if (!IsTrue(arena->Slot(sp - 1))) {
+      pop();
+      pc += 1;
+    } else {
+      pc = code + pc[0];
+    }
+    DISPATCH();
+  }
+  CASE(kGuard) : {
+    auto global = As<GlobalRef>(bytecode->constants[pc[1]]);
+    pc = global->Binding() == bytecode->constants[pc[2]] ? pc + 3
+                                                         : code + pc[0];
+    DISPATCH();
+  }
+  CASE(kClosure) : {
+    auto form = As<LambdaForm>(bytecode->constants[pc[0]]);
+    push(Create<LambdaFunction>(scope, form));
+    pc += 1;
+    DISPATCH();
+  }
+  CASE(kCall) : {
+    auto callee = sp - pc[0] - 1;
+    auto fn = AsFunction(arena->Slot(callee));
+    if (!fn)
+      throw RuntimeError("First element of the list must be a function");
+    auto result = call(fn, callee + 1);
+    arena->Slot(callee) = result;
+    pc += 1;
+    DISPATCH();
+  }
+  CASE(kCallGlobal) : {
+    push(call(callee(pc), sp - pc[1]));
+    pc += 3;
+    DISPATCH();
+  }
+  CASE(kTailCall) : {
+    auto head = sp - pc[0] - 1;
+    auto fn = AsFunction(arena->Slot(head));
+    if (!fn)
+      throw RuntimeError("First element of the list must be a function");
+    return tail_call(fn, head + 1);
+  }
+  CASE(kTailCallGlobal) : { return tail_call(callee(pc), sp - pc[1]); }
+  CASE(kReturn) : { return arena->Slot(sp - 1); }
+
+#ifndef SCHEME_VM_THREADED
+    default:
+      throw RuntimeError("bad opcode");
+    }
+  }
+#endif
+#undef CASE
+#undef DISPATCH
+}
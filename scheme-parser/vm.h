@@ -0,0 +1,112 @@
+#pragma once
+
+#include "parser.h"
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+class LambdaForm;
+class NativeCode;
+
+// Code of one lambda body for the stack machine in vm.cpp, compiled from its
+// resolved forms. Operands follow their opcode in `code`. The operand stack
+// of a run is part of the innermost FrameArena frame, after the lambda's own
+// slots when those are on the arena too, so whatever it holds is a root.
+struct Bytecode {
+  enum Op : uint32_t {
+    kConst,           // k: push constants[k]
+    kArenaRef,        // i: push slot i of the arena frame
+    kScopeRef,        // d i: push slot i of the Scope d levels up
+    kGlobalRef,       // k: push the value of the GlobalRef constants[k]
+    kSetArena,        // i: store the top in arena slot i and replace it by ()
+    kSetScope,        // d i: likewise for a Scope slot
+    kSetGlobal,       // k: likewise through the GlobalRef constants[k]
+    kDefineGlobal,    // k: likewise through the GlobalDefine constants[k]
+    kPop,             // drop the top
+    kJump,            // t: continue at t, which may be before it (loops)
+    kJumpIfFalse,     // t: pop, continue at t if it was false
+    kJumpIfFalseKeep, // t: continue at t if the top is false, else pop
+    kJumpIfTrueKeep,  // t: continue at t if the top is true, else pop
+    kGuard,           // t k v: continue at t unless the GlobalRef constants[k]
+                      // holds constants[v]
+    kClosure,         // k: push a closure of the LambdaForm constants[k]
+    kCall,            // n: call the function under the top n values
+    kCallGlobal,      // k n c: call the GlobalRef constants[k] on the top n
+                      // values, the function cached in caches[c]
+    kTailCall,        // n: like kCall, then return the result; a closure is
+                      // left to the caller as a LambdaFunction::TailCall
+    kTailCallGlobal,  // k n c: likewise for kCallGlobal
+    kReturn,          // return the top
+    kOpCount
+  };
+
+  // Inline cache of a kCallGlobal: valid while the global scope's version
+  // equals `version`.
+  struct CallCache {
+    Ref<Object> function;
+    uint64_t version = 0;
+  };
+
+  Bytecode();
+  ~Bytecode();
+
+  size_t AllocatedBytes() const;
+
+  // Words taken by the instruction at `pc`, operands included.
+  size_t Length(size_t pc) const;
+
+  void PrintInstruction(size_t pc, std::ostream *out) const;
+  void Disassemble(std::ostream *out) const;
+
+  std::vector<uint32_t> code;
+  std::vector<Ref<Object>> constants;
+  std::vector<CallCache> caches;
+  size_t max_stack = 0;
+
+  // Runs counted towards the JIT threshold, and the machine code compiled
+  // once it was reached (jit.h).
+  uint32_t calls = 0;
+  std::unique_ptr<NativeCode> native;
+};
+
+// Emits the bytecode of one lambda; the forms call back into it from
+// Form::Compile. Tracks the operand stack depth to size the stack.
+class Compiler {
+public:
+  // Compiles `code`, and the lambdas nested in it, unless already done.
+  static void Compile(LambdaForm *code);
+
+  uint32_t Constant(Object *obj);
+  uint32_t Cache();
+
+  // `stack_effect` is the change of the operand stack depth.
+  void Emit(Bytecode::Op op, std::initializer_list<uint32_t> operands,
+            int stack_effect);
+
+  // Emits a forward jump and returns the position of its target, for Patch.
+  size_t EmitJump(Bytecode::Op op, int stack_effect);
+  // Likewise for a kGuard of `global` holding `value`.
+  size_t EmitGuard(Object *global, Object *value);
+  void Patch(size_t target);
+  // Position of the next instruction, for a jump back to it.
+  uint32_t Here() const { return bytecode_->code.size(); }
+
+  size_t Depth() const { return depth_; }
+  // Control flow merges: the stack depth at a label is that of its sources.
+  void SetDepth(size_t depth) { depth_ = depth; }
+
+private:
+  explicit Compiler(Bytecode *bytecode) : bytecode_(bytecode) {}
+
+  Bytecode *bytecode_;
+  size_t depth_ = 0;
+};
+
+// Runs the bytecode of `code` in `scope`, the call's own Scope or the
+// closure's scope (LambdaForm::Run). The innermost arena frame must have
+// room for the operand stack from slot `stack_base` on. The JIT resumes
+// code it gives up on at `start`, with `depth` values on the stack.
+Object *Execute(Bytecode *bytecode, std::shared_ptr<Scope> &scope,
+                size_t stack_base, size_t start = 0, size_t depth = 0);
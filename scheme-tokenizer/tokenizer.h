@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <variant>
 
@@ -16,6 +17,12 @@ struct SymbolToken {
   bool IsExceptional = false;
 };
 
+struct StringToken {
+  bool operator==(const StringToken &rhs) const { return value == rhs.value; }
+
+  std::string value;
+};
+
 struct QuoteToken {
   bool operator==(const QuoteToken &) const { return true; }
 };
@@ -30,6 +37,11 @@ struct NullToken {
 
 enum class BracketToken { OPEN, CLOSE };
 
+// `#(`, which opens a vector; it is closed by BracketToken::CLOSE.
+struct VectorToken {
+  bool operator==(const VectorToken &) const { return true; }
+};
+
 struct ConstantToken {
   ConstantToken(int number) : value(number) {}
   bool operator==(const ConstantToken &rhs) const {
@@ -40,7 +52,7 @@ struct ConstantToken {
 };
 
 using Token = std::variant<SymbolToken, ConstantToken, BracketToken, DotToken,
-                           QuoteToken, NullToken>;
+                           QuoteToken, NullToken, StringToken, VectorToken>;
 
 inline Token MakeLongToken(std::string symbols) {
   if (isdigit(symbols.at(0)) ||
@@ -75,6 +87,10 @@ public:
         if (accum_token.empty()) {
           this_token_ = BracketToken::OPEN;
           working_stream_->get();
+        } else if (accum_token == "#") {
+          this_token_ = VectorToken();
+          accum_token.clear();
+          working_stream_->get();
         } else {
           RecordLongToken(&accum_token);
         }
@@ -103,16 +119,32 @@ public:
           RecordLongToken(&accum_token);
         }
         break;
+      } else if (cur == '"') {
+        if (accum_token.empty()) {
+          working_stream_->get();
+          this_token_ = ReadString();
+        } else {
+          RecordLongToken(&accum_token);
+        }
+        break;
       } else if (cur == '.') {
         if (accum_token.empty()) {
-          this_token_ = DotToken();
           working_stream_->get();
+          this_token_ = DotToken();
+          // `...`, the ellipsis of syntax-rules, is a symbol.
+          if (working_stream_->peek() == '.') {
+            working_stream_->get();
+            if (working_stream_->get() != '.')
+              throw std::runtime_error("Unexpected '..'");
+            this_token_ = SymbolToken("...");
+          }
         } else {
           RecordLongToken(&accum_token);
         }
         break;
       } else if (isdigit(cur) || isalpha(cur) || cur == '?' || cur == '!' ||
-                 cur == '#' || cur == '>' || cur == '<' || cur == '=') {
+                 cur == '#' || cur == '>' || cur == '<' || cur == '=' ||
+                 cur == '_') {
         accum_token += cur;
         working_stream_->get();
       } else if (cur == '*' || cur == '/') {
@@ -120,6 +152,11 @@ public:
           std::string s(1, cur);
           this_token_ = SymbolToken(s);
           working_stream_->get();
+        } else if (isalpha(accum_token.at(0))) {
+          // As in `let*` and `call/cc`.
+          accum_token += cur;
+          working_stream_->get();
+          continue;
         } else {
           RecordLongToken(&accum_token);
         }
@@ -155,6 +192,27 @@ public:
   Token GetToken() { return this_token_; }
 
 private:
+  // Reads the rest of a string literal after its opening quote. Supports the
+  // \", \\ and \n escapes.
+  StringToken ReadString() {
+    StringToken token;
+    while (true) {
+      int cur = working_stream_->get();
+      if (cur == EOF)
+        throw std::runtime_error("Unterminated string literal");
+      if (cur == '"')
+        return token;
+      if (cur == '\\') {
+        cur = working_stream_->get();
+        if (cur == EOF)
+          throw std::runtime_error("Unterminated string literal");
+        if (cur == 'n')
+          cur = '\n';
+      }
+      token.value += static_cast<char>(cur);
+    }
+  }
+
   void RecordLongToken(std::string *accum_token) {
     this_token_ = MakeLongToken(*accum_token);
     accum_token->clear();
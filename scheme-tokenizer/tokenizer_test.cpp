@@ -139,3 +139,20 @@ TEST(TokenizerTests, HandlesEmptyStringCorrectly) {
 
   EXPECT_TRUE(tokenizer.IsEnd());
 }
+
+TEST(TokenizerTests, HandlesStrings) {
+  std::stringstream ss{R"EOF("a \"quoted\" word"("x"))EOF"};
+  Tokenizer tokenizer{&ss};
+
+  tokenizer.Next();
+  EXPECT_EQ(tokenizer.GetToken(), Token{StringToken{"a \"quoted\" word"}});
+
+  tokenizer.Next();
+  EXPECT_EQ(tokenizer.GetToken(), Token{BracketToken::OPEN});
+
+  tokenizer.Next();
+  EXPECT_EQ(tokenizer.GetToken(), Token{StringToken{"x"}});
+
+  tokenizer.Next();
+  EXPECT_EQ(tokenizer.GetToken(), Token{BracketToken::CLOSE});
+}
@@ -1,12 +1,54 @@
 #include "gc.h"
+#include "jit.h"
 #include "parser.h"
 #include "scheme.h"
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <string_view>
 
-int main() {
+// scheme [--vm | --jit | --cek] [--jit-dump] [--opt=0|1|2] [library.scm ...]:
+// the libraries are loaded, then frozen together with the builtins before the
+// REPL starts. --vm compiles every form to bytecode instead of walking it;
+// --jit also compiles hot lambdas to machine code, and --jit-dump prints that
+// code to stderr as it is generated. --cek runs forms on the stackless
+// machine, which supports full continuations. --opt=0 turns the optimizer
+// off, --opt=1 only folds constants and branches, and --opt=2, the default,
+// also inlines.
+int main(int argc, char **argv) {
   SchemeInterpreter sch_int;
+  int first = 1;
+  for (; first < argc && std::string_view(argv[first]).starts_with("--");
+       ++first) {
+    std::string_view flag = argv[first];
+    if (flag == "--vm") {
+      sch_int.SetEvalMode(EvalMode::Bytecode);
+    } else if (flag == "--jit") {
+      sch_int.SetEvalMode(EvalMode::Native);
+    } else if (flag == "--cek") {
+      sch_int.SetEvalMode(EvalMode::Cek);
+    } else if (flag == "--jit-dump") {
+      Jit::GetInstance().SetDump(&std::cerr);
+    } else if (flag == "--opt=0") {
+      sch_int.SetOptLevel(OptLevel::None);
+    } else if (flag == "--opt=1") {
+      sch_int.SetOptLevel(OptLevel::Fold);
+    } else if (flag == "--opt=2") {
+      sch_int.SetOptLevel(OptLevel::Inline);
+    } else {
+      std::cerr << "unknown option " << flag << std::endl;
+      return 1;
+    }
+  }
+  for (int ind = first; ind < argc; ++ind) {
+    std::ifstream library(argv[ind]);
+    if (!library) {
+      std::cerr << "cannot open " << argv[ind] << std::endl;
+      return 1;
+    }
+    sch_int.Load(&library);
+  }
+  GCManager::GetInstance().Freeze();
   sch_int.REPL();
   // std::ofstream debugFile;
   // debugFile.open("debug.txt", std::ios::app);
@@ -1,55 +1,18 @@
 #include "scheme.h"
+#include "builtins.h"
 #include "create.h"
 #include "gc.h"
+#include "jit.h"
 #include "parser.h"
+#include "resolver.h"
 #include "tokenizer.h"
+#include "vm.h"
 #include <istream>
 #include <memory>
 
-SchemeInterpreter::SchemeInterpreter() : global_scope_(Scope::Create()) {
-  global_scope_->variables_["+"] = Create<Function>("+", Plus);
-  global_scope_->variables_["-"] = Create<Function>("-", Minus);
-  global_scope_->variables_["*"] = Create<Function>("*", Multiply);
-  global_scope_->variables_["/"] = Create<Function>("/", Divide);
-  global_scope_->variables_["if"] = Create<SpecialForm>("if", If);
-  global_scope_->variables_["quote"] = Create<SpecialForm>("quote", Quote);
-  global_scope_->variables_["null?"] = Create<Function>("null?", CheckNull);
-  global_scope_->variables_["pair?"] = Create<Function>("pair?", CheckPair);
-  global_scope_->variables_["number?"] =
-      Create<Function>("number?", CheckNumber);
-  global_scope_->variables_["boolean?"] =
-      Create<Function>("boolean?", CheckBoolean);
-  global_scope_->variables_["symbol?"] =
-      Create<Function>("symbol?", CheckSymbol);
-  global_scope_->variables_["list?"] = Create<Function>("list?", CheckList);
-  global_scope_->variables_["eq?"] = Create<Function>("eq?", Eq);
-  global_scope_->variables_["integer-equal?"] =
-      Create<Function>("integer-equal?", IntegerEqual);
-  global_scope_->variables_["not"] = Create<Function>("not", Not);
-  global_scope_->variables_["="] = Create<Function>("=", Equality);
-  global_scope_->variables_[">"] = Create<Function>(">", More);
-  global_scope_->variables_["<"] = Create<Function>("<", Less);
-  global_scope_->variables_[">="] = Create<Function>(">=", MoreOrEqual);
-  global_scope_->variables_["<="] = Create<Function>("<=", LessOrEqual);
-  global_scope_->variables_["min"] = Create<Function>("min", Min);
-  global_scope_->variables_["max"] = Create<Function>("max", Max);
-  global_scope_->variables_["abs"] = Create<Function>("abs", Abs);
-  global_scope_->variables_["cons"] = Create<Function>("cons", Cons);
-  global_scope_->variables_["car"] = Create<Function>("car", Car);
-  global_scope_->variables_["cdr"] = Create<Function>("cdr", Cdr);
-  global_scope_->variables_["set-car!"] = Create<Function>("set-car!", SetCar);
-  global_scope_->variables_["set-cdr!"] = Create<Function>("set-cdr!", SetCdr);
-  global_scope_->variables_["list"] = Create<Function>("list", List);
-  global_scope_->variables_["list-ref"] = Create<Function>("list-ref", ListRef);
-  global_scope_->variables_["list-tail"] =
-      Create<Function>("list-tail", ListTail);
-  global_scope_->variables_["and"] = Create<SpecialForm>("and", And);
-  global_scope_->variables_["or"] = Create<SpecialForm>("or", Or);
-  global_scope_->variables_["lambda"] = Create<SpecialForm>("lambda", Lambda);
-  global_scope_->variables_["define"] = Create<SpecialForm>("define", Define);
-  global_scope_->variables_["set!"] = Create<SpecialForm>("set!", Set);
-  global_scope_->variables_["exit"] = Create<Function>("exit", Exit);
-  global_scope_->variables_["map"] = Create<Function>("map", Map);
+SchemeInterpreter::SchemeInterpreter(EvalMode mode)
+    : global_scope_(Scope::Create()), mode_(mode) {
+  InstallBuiltins(global_scope_.get());
 }
 
 SchemeInterpreter::~SchemeInterpreter() { global_scope_->variables_.clear(); }
@@ -58,7 +21,23 @@ Object *SchemeInterpreter::Eval(Object *in) {
   if (in == nullptr)
     throw RuntimeError("First element of the list must be function");
 
-  return in->Eval(global_scope_);
+  // The JIT and the optimizer level are process-wide; they follow whichever
+  // interpreter evaluates.
+  Jit::GetInstance().SetEnabled(mode_ == EvalMode::Native);
+  Resolver::SetOptLevel(opt_level_);
+  Resolver::SetMachine(mode_ == EvalMode::Cek);
+  if (mode_ == EvalMode::TreeWalk)
+    return in->Eval(global_scope_);
+
+  GCManager::SafeLock lock(in);
+  Resolver resolver(global_scope_.get());
+  auto code = resolver.ResolveTopLevel(in);
+  if (mode_ == EvalMode::Cek)
+    return code->Run(global_scope_);
+  Compiler::Compile(code);
+  FrameArena::Frame stack(GCManager::GetInstance().GetFrameArena(),
+                          code->StackSize());
+  return code->Run(global_scope_);
 }
 
 inline std::string Print(const Object *obj) {
@@ -85,6 +64,20 @@ std::vector<Object *> ToVector(const Object *head) {
   return elements;
 }
 
+void SchemeInterpreter::Load(std::istream *in) {
+  Parser parser((Tokenizer(in)));
+  while (true) {
+    GCManager::GetInstance().SetPhase(Phase::Read);
+    auto obj = parser.Read();
+    if (!obj)
+      break;
+    GCManager::GetInstance().SetPhase(Phase::Eval);
+    Eval(obj);
+    GCManager::GetInstance().Safepoint();
+  }
+  GCManager::GetInstance().SetPhase(Phase::Read);
+}
+
 void SchemeInterpreter::REPL(std::istream *in) {
   Parser parser((Tokenizer(in)));
   while (true) {
@@ -98,5 +91,6 @@ void SchemeInterpreter::REPL(std::istream *in) {
     PrintTo(res, &std::cout);
 
     std::cout << "\n";
+    GCManager::GetInstance().Safepoint();
   }
 }
\ No newline at end of file
@@ -1,20 +1,38 @@
 #pragma once
 
 #include "../scheme-parser/parser.h"
+#include "../scheme-parser/resolver.h"
 #include <istream>
 #include <memory>
 #include <sstream>
 
+// How Eval runs a top-level form: by walking the tree of the form, or by
+// compiling it, and the lambdas in it, to bytecode for the VM (vm.h); in
+// Native mode hot lambdas are further compiled to machine code (jit.h), and
+// in Cek mode the form runs on the stackless CEK machine (cek.h). Closures
+// run as they were created, whatever the mode is later.
+enum class EvalMode { TreeWalk, Bytecode, Native, Cek };
+
 class SchemeInterpreter {
 public:
-  SchemeInterpreter();
+  explicit SchemeInterpreter(EvalMode mode = EvalMode::TreeWalk);
 
   ~SchemeInterpreter();
 
   Object *Eval(Object *in);
 
+  void SetEvalMode(EvalMode mode) { mode_ = mode; }
+
+  // How much the code of this interpreter is optimized; see OptLevel.
+  void SetOptLevel(OptLevel level) { opt_level_ = level; }
+
+  // Evaluates every form read from `in`, without printing the results.
+  void Load(std::istream *in);
+
   void REPL(std::istream *in = &std::cin);
 
 private:
   std::shared_ptr<Scope> global_scope_;
+  EvalMode mode_;
+  OptLevel opt_level_ = OptLevel::Inline;
 };